@@ -0,0 +1,84 @@
+#include "async_readback.h"
+
+#include <algorithm>
+#include <cstring>
+
+AsyncPixelReader::AsyncPixelReader(const size_t& n_buffer)
+    : slots(std::max<size_t>(1, n_buffer)) {
+  for (auto& slot : slots) {
+    glGenBuffers(1, &slot.pbo);
+  }
+}
+
+AsyncPixelReader::~AsyncPixelReader() {
+  for (auto& slot : slots) {
+    if (slot.fence != nullptr) glDeleteSync(slot.fence);
+    glDeleteBuffers(1, &slot.pbo);
+  }
+}
+
+bool AsyncPixelReader::request(const OpenGLTexture<GL_TEXTURE_2D, GLfloat>& tex,
+                               const size_t& tag) {
+  if (isFull()) return false;
+
+  Slot& slot = slots[(head + n_pending) % slots.size()];
+  const auto& size = tex.getSize();
+  slot.tag = tag;
+  slot.n_float = size_t(size[0]) * size_t(size[1]) * 4;
+
+  tex.bindFB();
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+  glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(slot.n_float * sizeof(GLfloat)),
+               nullptr, GL_STREAM_READ);
+  // with a pack buffer bound, glReadPixels returns without waiting.
+  glReadPixels(0, 0, size[0], size[1], GL_RGBA, GL_FLOAT, nullptr);
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  tex.resetFB();
+  CHECK_GL_ERROR();
+
+  n_pending++;
+  return true;
+}
+
+void AsyncPixelReader::poll(const Handler& handler) {
+  while (n_pending > 0) {
+    Slot& slot = slots[head];
+    const GLenum status = glClientWaitSync(slot.fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) break;
+    complete(&slot, handler);
+  }
+}
+
+void AsyncPixelReader::finish(const Handler& handler) {
+  while (n_pending > 0) {
+    Slot& slot = slots[head];
+    glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(-1));
+    complete(&slot, handler);
+  }
+}
+
+void AsyncPixelReader::complete(Slot* slot, const Handler& handler) {
+  glDeleteSync(slot->fence);
+  slot->fence = nullptr;
+
+  std::vector<GLfloat> pixels(slot->n_float);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+  const void* mapped =
+      glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                       GLsizeiptr(slot->n_float * sizeof(GLfloat)),
+                       GL_MAP_READ_BIT);
+  if (mapped != nullptr) {
+    std::memcpy(pixels.data(), mapped, slot->n_float * sizeof(GLfloat));
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  } else {
+    std::cerr << "AsyncPixelReader : failed to map pixel buffer." << std::endl;
+    pixels.clear();
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  head = (head + 1) % slots.size();
+  n_pending--;
+
+  if (!pixels.empty()) handler(std::move(pixels), slot->tag);
+}
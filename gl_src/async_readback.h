@@ -0,0 +1,58 @@
+#ifndef ASYNC_READBACK_H_2026_10_17
+#define ASYNC_READBACK_H_2026_10_17
+
+#include <functional>
+#include <vector>
+
+#include "glsl_utility.h"
+
+/**
+ Read RGBA float pixels of framebuffer textures without stalling the render
+ loop. request() starts glReadPixels into a pixel buffer object and inserts a
+ fence, poll() hands the pixels of finished requests to a handler.
+ Pixels are in the row order of OpenGL (the first row is the bottom).
+ **/
+class AsyncPixelReader {
+public:
+  // pixels (4 floats per pixel) and the tag given to request().
+  using Handler =
+      std::function<void(std::vector<GLfloat>&& pixels, const size_t& tag)>;
+
+private:
+  struct Slot {
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+    size_t tag = 0;
+    size_t n_float = 0;
+  };
+
+  std::vector<Slot> slots;
+  size_t head = 0;  // oldest pending slot
+  size_t n_pending = 0;
+
+public:
+  // n_buffer is the max number of requests in flight.
+  explicit AsyncPixelReader(const size_t& n_buffer = 3);
+  ~AsyncPixelReader();
+
+  AsyncPixelReader(const AsyncPixelReader&) = delete;
+  AsyncPixelReader& operator=(const AsyncPixelReader&) = delete;
+
+  // false if all buffers are in flight.
+  bool request(const OpenGLTexture<GL_TEXTURE_2D, GLfloat>& tex,
+               const size_t& tag);
+
+  // call handler for finished requests in request order. never blocks.
+  void poll(const Handler& handler);
+
+  // wait all requests and call handler for them.
+  void finish(const Handler& handler);
+
+  bool isFull() const { return n_pending == slots.size(); }
+  size_t numPending() const { return n_pending; }
+
+private:
+  void complete(Slot* slot, const Handler& handler);
+};
+
+#endif /* ASYNC_READBACK_H_2026_10_17 */
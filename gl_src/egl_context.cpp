@@ -0,0 +1,151 @@
+#include "egl_context.h"
+
+#include <cstring>
+#include <iostream>
+
+#ifdef LINUX
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+namespace {
+
+bool hasExtension(const char* extensions, const char* name) {
+  if (extensions == nullptr) return false;
+  const size_t len = strlen(name);
+  for (const char* p = strstr(extensions, name); p != nullptr;
+       p = strstr(p + len, name)) {
+    if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// surfaceless platform of Mesa first, then the first EGL device.
+EGLDisplay getHeadlessDisplay() {
+  const char* client_ext = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+      eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  if (getPlatformDisplay == nullptr) {
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  if (hasExtension(client_ext, "EGL_MESA_platform_surfaceless")) {
+    EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                            EGL_DEFAULT_DISPLAY, nullptr);
+    if (display != EGL_NO_DISPLAY) return display;
+  }
+
+  if (hasExtension(client_ext, "EGL_EXT_platform_device")) {
+    auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(
+        eglGetProcAddress("eglQueryDevicesEXT"));
+    EGLDeviceEXT device;
+    EGLint n_device = 0;
+    if (queryDevices != nullptr && queryDevices(1, &device, &n_device) &&
+        n_device > 0) {
+      EGLDisplay display =
+          getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+      if (display != EGL_NO_DISPLAY) return display;
+    }
+  }
+
+  return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+}  // namespace
+
+bool HeadlessGLContext::init(const int& major, const int& minor) {
+  destroy();
+
+  EGLDisplay egl_display = getHeadlessDisplay();
+  EGLint egl_major, egl_minor;
+  if (egl_display == EGL_NO_DISPLAY ||
+      !eglInitialize(egl_display, &egl_major, &egl_minor)) {
+    std::cerr << "HeadlessGLContext : failed to initialize EGL display."
+              << std::endl;
+    return false;
+  }
+  display = egl_display;
+
+  const char* ext = eglQueryString(egl_display, EGL_EXTENSIONS);
+  if (!hasExtension(ext, "EGL_KHR_surfaceless_context")) {
+    std::cerr << "HeadlessGLContext : EGL_KHR_surfaceless_context is not "
+                 "supported."
+              << std::endl;
+    destroy();
+    return false;
+  }
+
+  const EGLint config_attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                   EGL_NONE};
+  EGLConfig config = nullptr;
+  EGLint n_config = 0;
+  if (!eglChooseConfig(egl_display, config_attribs, &config, 1, &n_config) ||
+      n_config < 1) {
+    if (!hasExtension(ext, "EGL_KHR_no_config_context")) {
+      std::cerr << "HeadlessGLContext : no EGL config for OpenGL."
+                << std::endl;
+      destroy();
+      return false;
+    }
+    config = nullptr;  // EGL_NO_CONFIG_KHR
+  }
+
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    std::cerr << "HeadlessGLContext : desktop OpenGL is not supported."
+              << std::endl;
+    destroy();
+    return false;
+  }
+
+  const EGLint context_attribs[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                    major,
+                                    EGL_CONTEXT_MINOR_VERSION,
+                                    minor,
+                                    EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                    EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                    EGL_NONE};
+  EGLContext egl_context =
+      eglCreateContext(egl_display, config, EGL_NO_CONTEXT, context_attribs);
+  if (egl_context == EGL_NO_CONTEXT) {
+    std::cerr << "HeadlessGLContext : failed to create OpenGL " << major << "."
+              << minor << " context." << std::endl;
+    destroy();
+    return false;
+  }
+  context = egl_context;
+
+  if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                      egl_context)) {
+    std::cerr << "HeadlessGLContext : failed to make context current."
+              << std::endl;
+    destroy();
+    return false;
+  }
+
+  return true;
+}
+
+void HeadlessGLContext::destroy() {
+  if (display == nullptr) return;
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (context != nullptr) {
+    eglDestroyContext(display, context);
+    context = nullptr;
+  }
+  eglTerminate(display);
+  display = nullptr;
+}
+
+#else
+
+bool HeadlessGLContext::init(const int&, const int&) {
+  std::cerr << "HeadlessGLContext : headless rendering needs EGL on Linux."
+            << std::endl;
+  return false;
+}
+
+void HeadlessGLContext::destroy() {}
+
+#endif
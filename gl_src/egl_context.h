@@ -0,0 +1,29 @@
+#ifndef EGL_CONTEXT_H_2026_10_17
+#define EGL_CONTEXT_H_2026_10_17
+
+/**
+ OpenGL core profile context without any window or display server.
+ It uses EGL with the surfaceless platform of Mesa (e.g. llvmpipe) or an
+ EGL device, so rendering must be done into framebuffer objects.
+ Only available on Linux, init() returns false elsewhere.
+ **/
+class HeadlessGLContext {
+private:
+  void* display = nullptr;
+  void* context = nullptr;
+
+public:
+  HeadlessGLContext() {}
+  ~HeadlessGLContext() { destroy(); }
+
+  HeadlessGLContext(const HeadlessGLContext&) = delete;
+  HeadlessGLContext& operator=(const HeadlessGLContext&) = delete;
+
+  // create the context and make it current on this thread.
+  bool init(const int& major, const int& minor);
+  void destroy();
+
+  bool isValid() const { return context != nullptr; }
+};
+
+#endif /* EGL_CONTEXT_H_2026_10_17 */
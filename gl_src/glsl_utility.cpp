@@ -1,6 +1,7 @@
 
 #include "glsl_utility.h"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <memory>
@@ -74,7 +75,7 @@ bool OpenGLTexture<target, Datatype>::initFrameBuffer() {
     std::exit(EXIT_FAILURE);
   }
 
-  glActiveTexture(GL_TEXTURE0 + name);
+  glActiveTexture(GL_TEXTURE0 + tex_num);
   glGenFramebuffers(1, &fbID);
   glBindFramebuffer(GL_FRAMEBUFFER, fbID);
   if (internal_format == GL_DEPTH_COMPONENT) {
@@ -109,6 +110,35 @@ bool OpenGLTexture<target, Datatype>::initFrameBuffer() {
   return true;
 }
 
+template <GLint target, typename Datatype>
+bool OpenGLTexture<target, Datatype>::attachColorBuffer(
+    const OpenGLTexture& tex, const GLuint& index) {
+  if (fbID == GLuint(-1)) {
+    std::cerr << "[error] call initFrameBuffer() before attachColorBuffer()."
+              << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, fbID);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + index, target,
+                         tex.name, 0);
+  std::vector<GLenum> buffers(index + 1);
+  for (GLuint i = 0; i <= index; i++) {
+    buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+  }
+  glDrawBuffers(GLsizei(buffers.size()), buffers.data());
+
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cout << fbID << " : " << glCheckFramebufferStatus(GL_FRAMEBUFFER)
+              << std::endl;
+  }
+
+  CHECK_GL_ERROR();
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  return true;
+}
+
 template <GLint target, typename Datatype>
 bool OpenGLTexture<target, Datatype>::bindFB() const {
   if (Dimention<target> != 2) {
@@ -204,3 +234,128 @@ template class OpenGLTexture<GL_TEXTURE_2D, GLubyte>;
 template class OpenGLTexture<GL_TEXTURE_1D, GLint>;
 template class OpenGLTexture<GL_TEXTURE_1D, GLfloat>;
 template class OpenGLTexture<GL_TEXTURE_1D, GLubyte>;
+
+size_t TextureBuffer::texelSize(const GLenum& format) {
+  switch (format) {
+    case GL_R32F:
+    case GL_R32I:
+    case GL_R32UI:
+    case GL_RG16F:
+      return 4;
+    case GL_RG32F:
+    case GL_RG32I:
+    case GL_RG32UI:
+    case GL_RGBA16F:
+      return 8;
+    case GL_RGBA32F:
+    case GL_RGBA32I:
+    case GL_RGBA32UI:
+      return 16;
+    default:
+      std::cerr << "TextureBuffer : unsupported format " << format
+                << std::endl;
+      return 0;
+  }
+}
+
+size_t TextureBuffer::maxTexels() {
+  GLint max_size = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_size);
+  return size_t(max_size);
+}
+
+bool TextureBuffer::init(const size_t& n_texel, const int& tex_num_,
+                         GLenum internal_format_, const void* data,
+                         GLenum usage) {
+  CHECK_GL_ERROR();
+  if (n_texel > maxTexels()) {
+    std::cerr << "TextureBuffer : " << n_texel
+              << " texels are over GL_MAX_TEXTURE_BUFFER_SIZE " << maxTexels()
+              << std::endl;
+    return false;
+  }
+  internal_format = internal_format_;
+  size = n_texel * texelSize(internal_format);
+
+  if (name == 0) {
+    glGenBuffers(1, &buffer);
+    glGenTextures(1, &name);
+  }
+  if (tex_num_ == -1)
+    tex_num = name - 1;
+  else
+    tex_num = GLuint(tex_num_);
+
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  // empty buffer is not allowed to attach, keep one texel at least.
+  glBufferData(GL_TEXTURE_BUFFER,
+               GLsizeiptr(std::max(size, texelSize(internal_format))),
+               size == 0 ? nullptr : data, usage);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  glActiveTexture(GL_TEXTURE0 + tex_num);
+  glBindTexture(GL_TEXTURE_BUFFER, name);
+  glTexBuffer(GL_TEXTURE_BUFFER, internal_format, buffer);
+  glActiveTexture(GL_TEXTURE0);
+  CHECK_GL_ERROR();
+
+  return true;
+}
+
+bool TextureBuffer::subData(const size_t& offset, const size_t& bytes,
+                            const void* data) {
+  if (offset + bytes > size) return false;
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferSubData(GL_TEXTURE_BUFFER, GLintptr(offset), GLsizeiptr(bytes), data);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  CHECK_GL_ERROR();
+  return true;
+}
+
+bool TextureBuffer::uniform(const GLuint& program,
+                            const char* uniform_name) const {
+  GLint loc;
+  bool f = getUniLoc(uniform_name, loc, program);
+
+  if (!f) return false;
+
+  glActiveTexture(GL_TEXTURE0 + tex_num);
+  glBindTexture(GL_TEXTURE_BUFFER, name);
+  glUniform1i(loc, GLint(tex_num));
+
+  return true;
+}
+
+bool UniformBuffer::init(const GLuint& binding_, const size_t& bytes,
+                         const void* data, GLenum usage) {
+  binding = binding_;
+  size = bytes;
+  if (buffer == 0) glGenBuffers(1, &buffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  glBufferData(GL_UNIFORM_BUFFER, GLsizeiptr(size), data, usage);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  CHECK_GL_ERROR();
+  return true;
+}
+
+bool UniformBuffer::subData(const size_t& offset, const size_t& bytes,
+                            const void* data) {
+  if (offset + bytes > size) return false;
+  glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+  glBufferSubData(GL_UNIFORM_BUFFER, GLintptr(offset), GLsizeiptr(bytes), data);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  CHECK_GL_ERROR();
+  return true;
+}
+
+void UniformBuffer::bind() const {
+  glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+}
+
+bool UniformBuffer::bindBlock(const GLuint& program, const char* block_name,
+                              const GLuint& binding) {
+  const GLuint index = glGetUniformBlockIndex(program, block_name);
+  if (index == GL_INVALID_INDEX) return false;
+  glUniformBlockBinding(program, index, binding);
+  return true;
+}
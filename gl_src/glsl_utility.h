@@ -87,6 +87,8 @@ public:
                 Datatype* pixels);
 
   bool initFrameBuffer();
+  // draw also to tex as color attachment index (> 0) of the framebuffer.
+  bool attachColorBuffer(const OpenGLTexture& tex, const GLuint& index);
   bool copyColorBuffer(const Size& offset, const Size& pos, const Size& area);
   bool bindFB() const;
   void resetFB() const;
@@ -96,6 +98,8 @@ public:
   bool uniform(const GLuint& program, const char* name) const;
 
   const GLuint& get_num() const { return tex_num; }
+  const GLuint& getName() const { return name; }
+  const Size& getSize() const { return size; }
   const GLenum& getInternalFormat() const { return internal_format; }
   const GLint& getFilterParameter() const { return f_param; }
   const GLint& getWrapParameter() const { return w_param; }
@@ -112,12 +116,115 @@ using PTexture2Df = TextureP<GL_TEXTURE_2D, GLfloat>;
 // template bool OpenGLTexture<GL_TEXTURE_2D, GLfloat>::init(const Size&, const
 // int&, GLenum, GLenum, GLfloat*, GLint, GLint);
 
-/** For RayTrace with OpenGL **/
+/**
+ Buffer texture (GL_TEXTURE_BUFFER) read by texelFetch in shaders.
+ Its size is only limited by GL_MAX_TEXTURE_BUFFER_SIZE texels.
+ internal_format is a 1, 2 or 4 channel sized format like GL_RGBA32F.
+ **/
+class TextureBuffer {
+private:
+  GLuint buffer = 0;
+  GLuint name = 0;
+  GLuint tex_num = 0;
+  GLenum internal_format = GL_RGBA32F;
+  size_t size = 0;  // bytes
+
+public:
+  TextureBuffer() {}
+  ~TextureBuffer() {
+    if (name != 0) {
+      glDeleteTextures(1, &name);
+      glDeleteBuffers(1, &buffer);
+    }
+  }
+
+  TextureBuffer(const TextureBuffer&) = delete;
+  TextureBuffer& operator=(const TextureBuffer&) = delete;
+
+  // false if n_texel is over GL_MAX_TEXTURE_BUFFER_SIZE.
+  bool init(const size_t& n_texel, const int& tex_num_, GLenum internal_format_,
+            const void* data, GLenum usage = GL_STATIC_DRAW);
+  bool subData(const size_t& offset, const size_t& bytes, const void* data);
+
+  bool uniform(const GLuint& program, const char* name) const;
+
+  const GLuint& get_num() const { return tex_num; }
+  const GLuint& getName() const { return name; }
+  size_t getByteSize() const { return size; }
+
+  static size_t texelSize(const GLenum& internal_format);
+  static size_t maxTexels();
+};
+
+/**
+ Uniform buffer object for a std140 uniform block, which is attached to the
+ block by a binding point instead of setting its uniforms one by one.
+ **/
+class UniformBuffer {
+private:
+  GLuint buffer = 0;
+  GLuint binding = 0;
+  size_t size = 0;  // bytes
+
+public:
+  UniformBuffer() {}
+  ~UniformBuffer() {
+    if (buffer != 0) glDeleteBuffers(1, &buffer);
+  }
+
+  UniformBuffer(const UniformBuffer&) = delete;
+  UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+  bool init(const GLuint& binding_, const size_t& bytes, const void* data,
+            GLenum usage = GL_STATIC_DRAW);
+  bool subData(const size_t& offset, const size_t& bytes, const void* data);
+  // attach to the binding point, blocks of all programs bound to it read it.
+  void bind() const;
+
+  size_t getByteSize() const { return size; }
+
+  // bind the block of program to binding. false if the block is not used.
+  static bool bindBlock(const GLuint& program, const char* block_name,
+                        const GLuint& binding);
+};
+
+/**
+ Textures bound to units. Binding the texture already bound to the unit
+ makes no GL call, so draws can bind all their textures every time.
+ Call invalidate() after binding textures to units without it, like
+ OpenGLTexture::init() does.
+ **/
+class TextureBindingCache {
+private:
+  std::vector<GLuint> names;  // by unit, 0 if unknown
+
+public:
+  void bind(const GLuint& unit, const GLenum& target, const GLuint& name) {
+    if (unit >= names.size()) names.resize(unit + 1, 0);
+    if (names[unit] == name) return;
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(target, name);
+    glActiveTexture(GL_TEXTURE0);
+    names[unit] = name;
+  }
+  template <GLint target, typename Datatype>
+  void bind(const GLuint& unit, const OpenGLTexture<target, Datatype>& tex) {
+    bind(unit, target, tex.getName());
+  }
+  void bind(const GLuint& unit, const TextureBuffer& tex) {
+    bind(unit, GL_TEXTURE_BUFFER, tex.getName());
+  }
+
+  void invalidate() { names.clear(); }
+};
+
+/** For RayTrace with OpenGL. the vertex array and buffer are deleted with
+ the object. **/
 class QuadDrawer {
-  GLuint attr_coord_id;
-  GLuint vbo;
-  GLuint program_id;
-  GLuint vao;
+  GLuint attr_coord_id = 0;
+  GLuint vbo = 0;
+  GLuint program_id = 0;
+  GLuint vao = 0;
 
 public:
   QuadDrawer(const std::string& name, const GLuint& program_id_,
@@ -137,24 +244,29 @@ public:
     glUseProgram(program_id);
     glVertexAttribPointer(attr_coord_id, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
   }
+  ~QuadDrawer() {
+    if (vao != 0) {
+      glDeleteVertexArrays(1, &vao);
+      glDeleteBuffers(1, &vbo);
+    }
+  }
 
-  void draw() {
-    glUseProgram(program_id);
-    glEnableVertexAttribArray(attr_coord_id);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  QuadDrawer(const QuadDrawer&) = delete;
+  QuadDrawer& operator=(const QuadDrawer&) = delete;
+  QuadDrawer(QuadDrawer&& other)
+      : attr_coord_id(other.attr_coord_id),
+        vbo(other.vbo),
+        program_id(other.program_id),
+        vao(other.vao) {
+    other.vbo = 0;
+    other.vao = 0;
+  }
 
-    // Describe our vertices array to OpenGL (it can't guess its format
-    // automatically)
-    glVertexAttribPointer(
-        attr_coord_id,        // attribute
-        2,                    // number of elements per vertex, here (x,y)
-        GL_FLOAT,             // the type of each element
-        GL_FALSE,             // take our values as-is
-        2 * sizeof(GLfloat),  // no extra data between each position
-        0                     // pointer to the C array
-    );
+  // the vertex array keeps the attribute set by the constructor, and the
+  // program stays in use between draws, so a draw is a single call.
+  void draw() {
+    glBindVertexArray(vao);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-    glDisableVertexAttribArray(attr_coord_id);
   }
 };
 
@@ -0,0 +1,164 @@
+#include "program_cache.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+struct BinaryHeader {
+  char magic[8] = {'G', 'R', 'T', 'P', 'R', 'O', 'G', '\0'};
+  uint64_t key = 0;
+  uint32_t format = 0;  // of glGetProgramBinary
+  uint32_t size = 0;    // bytes of the binary which follows
+};
+
+// FNV-1a
+uint64_t hashString(const std::string& s, uint64_t hash) {
+  for (const char c : s) {
+    hash = (hash ^ uint8_t(c)) * 0x100000001B3ull;
+  }
+  // separates strings when hashes are chained.
+  return (hash ^ 0xFF) * 0x100000001B3ull;
+}
+
+std::string glString(const GLenum& name) {
+  const GLubyte* s = glGetString(name);
+  return s == nullptr ? "" : reinterpret_cast<const char*>(s);
+}
+
+GLuint compile(const std::string& vs_src, const std::string& fs_src,
+               const bool& retrievable) {
+  const GLuint vs = create_shader_from_src(vs_src.c_str(), GL_VERTEX_SHADER);
+  const GLuint fs = create_shader_from_src(fs_src.c_str(), GL_FRAGMENT_SHADER);
+  if (vs == 0 || fs == 0) {
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    return 0;
+  }
+  const GLuint program = glCreateProgram();
+  if (retrievable) {
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+  glAttachShader(program, vs);
+  glAttachShader(program, fs);
+  glLinkProgram(program);
+  // shaders are freed with the program.
+  glDeleteShader(vs);
+  glDeleteShader(fs);
+
+  GLint link_ok = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+  if (!link_ok) {
+    fprintf(stderr, "glLinkProgram failed\n");
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+}  // namespace
+
+ProgramBinaryCache::ProgramBinaryCache(const std::string& dir_) : dir(dir_) {
+  GLint n_format = 0;
+  if (GLEW_ARB_get_program_binary) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &n_format);
+  }
+  supported = !dir.empty() && n_format > 0;
+  driver_hash = 0xCBF29CE484222325ull;
+  driver_hash = hashString(glString(GL_VENDOR), driver_hash);
+  driver_hash = hashString(glString(GL_RENDERER), driver_hash);
+  driver_hash = hashString(glString(GL_VERSION), driver_hash);
+}
+
+GLuint ProgramBinaryCache::link(const std::string& vs_src,
+                                const std::string& fs_src,
+                                bool* loaded) const {
+  if (loaded != nullptr) *loaded = false;
+  if (!supported) return compile(vs_src, fs_src, false);
+
+  const uint64_t key = hashString(fs_src, hashString(vs_src, driver_hash));
+  const std::string filename = path(key);
+  GLuint program = load(filename, key);
+  if (program != 0) {
+    if (loaded != nullptr) *loaded = true;
+    return program;
+  }
+  program = compile(vs_src, fs_src, true);
+  if (program != 0 && !save(filename, key, program)) {
+    fprintf(stderr, "failed to save a program binary : %s\n",
+            filename.c_str());
+  }
+  return program;
+}
+
+std::string ProgramBinaryCache::path(const uint64_t& key) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016" PRIx64 ".program", key);
+  if (dir.back() == '/') return dir + name;
+  return dir + "/" + name;
+}
+
+GLuint ProgramBinaryCache::load(const std::string& filename,
+                                const uint64_t& key) const {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == nullptr) return 0;
+  BinaryHeader header;
+  const BinaryHeader expected;
+  std::vector<char> binary;
+  bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            std::memcmp(header.magic, expected.magic, sizeof(header.magic)) ==
+                0 &&
+            header.key == key;
+  if (ok) {
+    binary.resize(header.size);
+    ok = fread(binary.data(), 1, binary.size(), file) == binary.size();
+  }
+  fclose(file);
+  if (!ok) return 0;
+
+  const GLuint program = glCreateProgram();
+  glProgramBinary(program, header.format, binary.data(), GLsizei(header.size));
+  GLint link_ok = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+  if (!link_ok) {
+    glDeleteProgram(program);
+    // a rejected binary is not an error of the program.
+    glGetError();
+    return 0;
+  }
+  return program;
+}
+
+bool ProgramBinaryCache::save(const std::string& filename,
+                              const uint64_t& key,
+                              const GLuint& program) const {
+  GLint size = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+  if (size <= 0) return false;
+  BinaryHeader header;
+  header.key = key;
+  std::vector<char> binary(static_cast<size_t>(size));
+  GLsizei length = 0;
+  GLenum format = 0;
+  glGetProgramBinary(program, size, &length, &format, binary.data());
+  header.format = format;
+  header.size = uint32_t(length);
+  if (length <= 0) return false;
+
+  // readers never see a partial file.
+  const std::string tmp_name = filename + ".tmp";
+  FILE* file = fopen(tmp_name.c_str(), "wb");
+  if (file == nullptr) return false;
+  const bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                       fwrite(binary.data(), 1, size_t(length), file) ==
+                           size_t(length);
+  const bool closed = fclose(file) == 0;
+  if (!written || !closed ||
+      std::rename(tmp_name.c_str(), filename.c_str()) != 0) {
+    std::remove(tmp_name.c_str());
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,52 @@
+#ifndef PROGRAM_CACHE_H_2026_10_17
+#define PROGRAM_CACHE_H_2026_10_17
+
+#include <cstdint>
+#include <string>
+
+#include "glsl.h"
+
+/** Linked program, deleted with the object. **/
+class LinkedProgram {
+public:
+  const GLuint id;
+
+  explicit LinkedProgram(const GLuint& id_) : id(id_) {}
+  ~LinkedProgram() {
+    if (id != 0) glDeleteProgram(id);
+  }
+
+  LinkedProgram(const LinkedProgram&) = delete;
+  LinkedProgram& operator=(const LinkedProgram&) = delete;
+};
+
+/**
+ Link programs of a vertex and a fragment shader source, and save their
+ binaries by glGetProgramBinary in dir, named by a hash of the sources and
+ of the driver (vendor, renderer and version strings). Later runs load them
+ by glProgramBinary instead of compiling. A binary the driver rejects, like
+ after an update which keeps the version string, is compiled and saved
+ again. Without ARB_get_program_binary or dir, programs are always compiled.
+ **/
+class ProgramBinaryCache {
+private:
+  const std::string dir;
+  uint64_t driver_hash = 0;
+  bool supported = false;
+
+public:
+  // needs the current context.
+  explicit ProgramBinaryCache(const std::string& dir_);
+
+  // linked program or 0. *loaded tells if it is from the cache.
+  GLuint link(const std::string& vs_src, const std::string& fs_src,
+              bool* loaded = nullptr) const;
+
+private:
+  std::string path(const uint64_t& key) const;
+  GLuint load(const std::string& filename, const uint64_t& key) const;
+  bool save(const std::string& filename, const uint64_t& key,
+            const GLuint& program) const;
+};
+
+#endif /* PROGRAM_CACHE_H_2026_10_17 */
@@ -0,0 +1,206 @@
+#include "tile_scheduler.h"
+
+#include <cmath>
+
+namespace {
+
+// weights of new measurements. the estimate rises faster than it falls,
+// since tiles of heavy regions must not overrun the target.
+constexpr double kRISE_RATE = 0.5;
+constexpr double kFALL_RATE = 0.125;
+
+// tiles grow at most by this factor per frame.
+constexpr int kMAX_GROWTH = 2;
+
+int alignDown(const int& v, const int& align) { return v / align * align; }
+int alignUp(const int& v, const int& align) {
+  return (v + align - 1) / align * align;
+}
+
+}  // namespace
+
+constexpr int TileScheduler::kTILE_ALIGN;
+constexpr int TileScheduler::kMIN_TILE;
+
+TileScheduler::TileScheduler(const int& width_, const int& height_,
+                             const int& n_sample_frame_,
+                             const double& target_ms, const size_t& n_query)
+    : width(width_),
+      height(height_),
+      n_sample_frame(n_sample_frame_),
+      target_ns(target_ms * 1e6),
+      queries(target_ms > 0.0 ? std::max<size_t>(1, n_query) : 0),
+      tile_size(target_ms > 0.0 ? kMIN_TILE : std::max(width_, height_)) {
+  for (auto& query : queries) {
+    glGenQueries(1, &query.id);
+  }
+}
+
+TileScheduler::~TileScheduler() {
+  for (auto& query : queries) {
+    glDeleteQueries(1, &query.id);
+  }
+}
+
+TileScheduler::Dispatch TileScheduler::next() const {
+  Dispatch d;
+  d.sample_offset = sample_done;
+  const int remain = n_sample_frame - sample_done;
+  if (!isTiled()) {
+    d.x = d.y = 0;
+    d.width = width;
+    d.height = height;
+    d.n_sample = remain;
+    d.n_pixel = activePixels(0, 0, width, height);
+    d.end_of_frame = true;
+    return d;
+  }
+
+  d.x = tile_x;
+  d.y = tile_y;
+  if (sample_done == 0) findTile(&d.x, &d.y);
+  d.width = std::min(tile_size, width - d.x);
+  d.height = std::min(tile_size, height - d.y);
+  d.n_pixel = activePixels(d.x, d.y, d.width, d.height);
+
+  if (ns_per_sample <= 0.0) {
+    d.n_sample = 1;
+  } else {
+    const double n = target_ns / (ns_per_sample * double(d.n_pixel));
+    d.n_sample = int(std::max(1.0, std::min(double(remain), std::floor(n))));
+  }
+
+  // the frame ends if no tile is left after this one.
+  int x = d.x + tile_size, y = d.y;
+  if (x >= width) {
+    x = 0;
+    y += tile_size;
+  }
+  d.end_of_frame = d.n_sample == remain && (y >= height || !findTile(&x, &y));
+  return d;
+}
+
+void TileScheduler::begin(const Dispatch& d) {
+  if (!isTiled()) return;
+  // wait the oldest measurement, which also bounds dispatches in flight.
+  if (n_pending == queries.size()) collect(true);
+
+  Query& query = queries[(head + n_pending) % queries.size()];
+  query.n_pixel_sample = double(d.n_pixel) * double(d.n_sample);
+  glBeginQuery(GL_TIME_ELAPSED, query.id);
+}
+
+void TileScheduler::end(const Dispatch& d) {
+  if (isTiled()) {
+    glEndQuery(GL_TIME_ELAPSED);
+    n_pending++;
+    collect(false);
+  }
+
+  if (d.end_of_frame) {
+    tile_x = tile_y = sample_done = 0;
+    in_frame = false;
+    resizeTile();
+    return;
+  }
+  in_frame = true;
+  tile_x = d.x;
+  tile_y = d.y;
+  sample_done += d.n_sample;
+  if (sample_done < n_sample_frame) return;
+  sample_done = 0;
+  tile_x += tile_size;
+  if (tile_x < width) return;
+  tile_x = 0;
+  tile_y += tile_size;
+}
+
+void TileScheduler::setMask(const std::vector<uint8_t>& mask_,
+                            const int& block_size_) {
+  mask = mask_;
+  block_size = block_size_;
+  converged = !mask.empty() && std::all_of(mask.begin(), mask.end(),
+                                           [](uint8_t m) { return m != 0; });
+}
+
+void TileScheduler::restart() {
+  tile_x = tile_y = sample_done = 0;
+  in_frame = false;
+  mask.clear();
+  converged = false;
+}
+
+void TileScheduler::collect(const bool& wait_oldest) {
+  bool wait = wait_oldest;
+  while (n_pending > 0) {
+    Query& query = queries[head];
+    if (!wait) {
+      GLint available = GL_FALSE;
+      glGetQueryObjectiv(query.id, GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available) return;
+    }
+    wait = false;
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query.id, GL_QUERY_RESULT, &elapsed);
+    const double sample = double(elapsed) / query.n_pixel_sample;
+    if (ns_per_sample <= 0.0) {
+      ns_per_sample = sample;
+    } else {
+      const double rate = sample > ns_per_sample ? kRISE_RATE : kFALL_RATE;
+      ns_per_sample += rate * (sample - ns_per_sample);
+    }
+
+    head = (head + 1) % queries.size();
+    n_pending--;
+  }
+}
+
+void TileScheduler::setEstimate(const double& ns) {
+  if (ns <= 0.0 || in_frame) return;
+  ns_per_sample = ns;
+  if (isTiled()) tile_size = fitTile();
+}
+
+void TileScheduler::resizeTile() {
+  if (!isTiled() || ns_per_sample <= 0.0) return;
+  tile_size = std::min(fitTile(), tile_size * kMAX_GROWTH);
+}
+
+// square tile, within the image.
+int TileScheduler::fitTile() const {
+  const int max_tile = alignUp(std::max(width, height), kTILE_ALIGN);
+  const double side = std::sqrt(target_ns / ns_per_sample);
+  const int size = int(std::min(double(max_tile), side));
+  return std::max(kMIN_TILE, alignDown(size, kTILE_ALIGN));
+}
+
+bool TileScheduler::findTile(int* x, int* y) const {
+  if (mask.empty()) return true;
+  for (; *y < height; *y += tile_size, *x = 0) {
+    for (; *x < width; *x += tile_size) {
+      const int w = std::min(tile_size, width - *x);
+      const int h = std::min(tile_size, height - *y);
+      if (activePixels(*x, *y, w, h) > 0) return true;
+    }
+  }
+  return false;
+}
+
+int TileScheduler::activePixels(const int& x, const int& y, const int& w,
+                                const int& h) const {
+  if (mask.empty()) return w * h;
+  const int n_block_x = (width + block_size - 1) / block_size;
+  int n_pixel = 0;
+  for (int by = y / block_size; by * block_size < y + h; by++) {
+    const int y0 = std::max(y, by * block_size);
+    const int y1 = std::min(y + h, (by + 1) * block_size);
+    for (int bx = x / block_size; bx * block_size < x + w; bx++) {
+      if (mask[size_t(by * n_block_x + bx)]) continue;
+      const int x0 = std::max(x, bx * block_size);
+      const int x1 = std::min(x + w, (bx + 1) * block_size);
+      n_pixel += (x1 - x0) * (y1 - y0);
+    }
+  }
+  return n_pixel;
+}
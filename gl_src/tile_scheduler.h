@@ -0,0 +1,107 @@
+#ifndef TILE_SCHEDULER_H_2026_10_17
+#define TILE_SCHEDULER_H_2026_10_17
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "glsl_utility.h"
+
+/**
+ Split each frame into tiles of the accumulator, drawn by glScissor, so that
+ no single draw runs long enough to trip the watchdog of the driver.
+ GPU time of each dispatch is measured by GL_TIME_ELAPSED queries, and the
+ tile size (at frame boundaries) and the samples per dispatch are chosen
+ to take about target_ms. Tiles are drawn in rows from the bottom, and
+ every pixel gets n_sample_frame samples per frame, except in blocks masked
+ as converged by setMask(), which are skipped by tiles and not counted.
+ **/
+class TileScheduler {
+public:
+  struct Dispatch {
+    int x, y, width, height;  // scissor box
+    int sample_offset;        // first sample in the frame
+    int n_sample;
+    int n_pixel;              // pixels in the box not masked
+    bool end_of_frame;        // last dispatch of the frame
+  };
+
+  // tiles are multiples of kTILE_ALIGN and at least kMIN_TILE.
+  static constexpr int kTILE_ALIGN = 16;
+  static constexpr int kMIN_TILE = 64;
+
+private:
+  struct Query {
+    GLuint id = 0;
+    double n_pixel_sample = 0;
+  };
+
+  const int width, height, n_sample_frame;
+  const double target_ns;
+
+  std::vector<Query> queries;
+  size_t head = 0;  // oldest pending query
+  size_t n_pending = 0;
+
+  // estimated GPU time per sample of a pixel. negative until measured.
+  double ns_per_sample = -1.0;
+
+  int tile_size;
+  // position in the frame. tile_x, tile_y may be on a masked tile, which
+  // next() skips.
+  int tile_x = 0, tile_y = 0, sample_done = 0;
+  bool in_frame = false;
+
+  // nonzero for converged blocks, row by row from the bottom. empty for
+  // no mask.
+  std::vector<uint8_t> mask;
+  int block_size = 1;
+  bool converged = false;
+
+public:
+  // target_ms <= 0 draws one dispatch of the whole frame.
+  TileScheduler(const int& width_, const int& height_,
+                const int& n_sample_frame_, const double& target_ms,
+                const size_t& n_query = 4);
+  ~TileScheduler();
+
+  TileScheduler(const TileScheduler&) = delete;
+  TileScheduler& operator=(const TileScheduler&) = delete;
+
+  // the dispatch to draw next. the position moves on by end().
+  Dispatch next() const;
+
+  // measure the draw of d between begin() and end().
+  void begin(const Dispatch& d);
+  void end(const Dispatch& d);
+
+  bool atFrameStart() const { return !in_frame; }
+
+  // mask of blocks of block_size_ pixels. call at frame boundaries.
+  void setMask(const std::vector<uint8_t>& mask_, const int& block_size_);
+  // all blocks are masked, then next() must not be called.
+  bool isConverged() const { return converged; }
+  // drop the frame in progress and the mask, to draw the frame again from
+  // the start. the estimate and the tile size are kept.
+  void restart();
+
+  // estimated GPU time per sample of a pixel in ns, 0 until measured.
+  double nsPerSample() const { return std::max(0.0, ns_per_sample); }
+  // start from the estimate of a previous render of the scene instead of
+  // the smallest tiles. call before the first dispatch, ns <= 0 is ignored.
+  void setEstimate(const double& ns);
+
+private:
+  bool isTiled() const { return target_ns > 0.0; }
+  void collect(const bool& wait_oldest);
+  void resizeTile();
+  // tile which takes target_ns by 1 sample.
+  int fitTile() const;
+
+  // first tile from (x, y) in drawing order which has pixels not masked.
+  bool findTile(int* x, int* y) const;
+  int activePixels(const int& x, const int& y, const int& w,
+                   const int& h) const;
+};
+
+#endif /* TILE_SCHEDULER_H_2026_10_17 */
@@ -26,7 +26,7 @@ workspace "GlslRayTracerWorkspace"
 		linkoptions { "-framework OpenGL" }
 
 	configuration { "linux", "gmake" }
-		links { "glfw", "GLEW", "GL" }
+		links { "glfw", "GLEW", "GL", "EGL", "pthread" }
 		defines { "LINUX" }
 
 	configuration "debug" 
@@ -44,3 +44,9 @@ project "GlslRender"
 	files { sources }
 	removefiles { exec_source }
 	files { "./src/main.cpp" }
+
+project "GlslTest"
+	kind "ConsoleApp"
+	files { sources }
+	removefiles { exec_source }
+	files { "./src/test.cpp" }
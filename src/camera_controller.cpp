@@ -0,0 +1,81 @@
+//
+//  camera_controller.cpp
+//  NewGlslRenderer
+//
+
+#include "camera_controller.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// radians per pixel of dragging.
+constexpr double kTURN_RATE = 0.005;
+// pitch stays off the poles, where the screen axes of the shader vanish.
+constexpr real kMAX_PITCH = 1.55f;
+// longest step of a move, so a stall doesn't jump.
+constexpr double kMAX_STEP = 0.1;
+
+}  // namespace
+
+CameraController::CameraController(const Vec& pos_, const Vec& dir_,
+                                   const real& speed_)
+    : pos(pos_), speed(speed_), last_time(std::chrono::steady_clock::now()) {
+  const Vec d = normalize(dir_);
+  yaw = std::atan2(d.y, d.x);
+  pitch = std::max(-kMAX_PITCH, std::min(kMAX_PITCH, std::asin(d.z)));
+  dir = d;
+}
+
+bool CameraController::update(GLFWwindow* window) {
+  const auto now = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> elapsed = now - last_time;
+  last_time = now;
+
+  const int keys[kNUM_MOVE] = {GLFW_KEY_UP,      GLFW_KEY_DOWN,
+                               GLFW_KEY_RIGHT,   GLFW_KEY_LEFT,
+                               GLFW_KEY_PAGE_UP, GLFW_KEY_PAGE_DOWN};
+  Input input;
+  for (int i = 0; i < kNUM_MOVE; i++) {
+    input.pressed[i] = glfwGetKey(window, keys[i]) == GLFW_PRESS;
+  }
+  input.dragging =
+      glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+  glfwGetCursorPos(window, &input.cursor_x, &input.cursor_y);
+  return update(input, elapsed.count());
+}
+
+bool CameraController::update(const Input& input, const double& elapsed) {
+  const real step = real(std::min(elapsed, kMAX_STEP)) * speed;
+
+  bool moved = false;
+  const double x = input.cursor_x, y = input.cursor_y;
+  if (input.dragging) {
+    if (dragging && (x != last_x || y != last_y)) {
+      yaw -= real((x - last_x) * kTURN_RATE);
+      pitch -= real((y - last_y) * kTURN_RATE);
+      pitch = std::max(-kMAX_PITCH, std::min(kMAX_PITCH, pitch));
+      dir = Vec(std::cos(pitch) * std::cos(yaw),
+                std::cos(pitch) * std::sin(yaw), std::sin(pitch));
+      moved = true;
+    }
+    dragging = true;
+  } else {
+    dragging = false;
+  }
+  last_x = x;
+  last_y = y;
+
+  // right is the x axis of the screen in the shader.
+  const Vec right = normalize(cross(dir, Vec(0, 0, 1)));
+  const Vec axes[kNUM_MOVE] = {dir,        dir * -1,     right,
+                               right * -1, Vec(0, 0, 1), Vec(0, 0, -1)};
+  for (int i = 0; i < kNUM_MOVE; i++) {
+    if (input.pressed[i] && step > 0) {
+      pos += axes[i] * step;
+      moved = true;
+    }
+  }
+  return moved;
+}
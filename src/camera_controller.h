@@ -0,0 +1,83 @@
+//
+//  camera_controller.h
+//  NewGlslRenderer
+//
+
+#ifndef camera_controller_h20261017
+#define camera_controller_h20261017
+
+#include <chrono>
+
+#include "../gl_src/glsl.h"
+#include "common.h"
+
+/**
+ Fly camera driven by the window, with z up. Arrow keys move forward, back
+ and sideways, page up / down move along z, and dragging with the left
+ button turns the view. Moves are per second, so they don't depend on the
+ frame rate.
+ **/
+class CameraController {
+public:
+  // moves by keys : arrows up, down, right, left, then page up and down.
+  enum Move { kFORWARD, kBACK, kRIGHT, kLEFT, kUP, kDOWN, kNUM_MOVE };
+  // state of the window at an update.
+  struct Input {
+    bool pressed[kNUM_MOVE] = {};
+    bool dragging = false;  // the left button is pressed
+    double cursor_x = 0.0, cursor_y = 0.0;
+  };
+
+  Vec pos, dir;
+
+private:
+  // distance of a move per second.
+  const real speed;
+  real yaw, pitch;  // radians of dir
+  bool dragging = false;
+  double last_x = 0.0, last_y = 0.0;
+  std::chrono::steady_clock::time_point last_time;
+
+public:
+  CameraController(const Vec& pos_, const Vec& dir_, const real& speed_);
+
+  // read keys and the mouse of window. true if the camera moved since the
+  // last update.
+  bool update(GLFWwindow* window);
+  // move by input, held for elapsed seconds. true if the camera moved.
+  bool update(const Input& input, const double& elapsed);
+};
+
+/**
+ Previews of the view drawn after the camera moves, from the lowest
+ resolution, one per loop of the renderer. Then frames of full resolution
+ are drawn, and the last preview is shown until the first of them ends.
+ **/
+class PreviewSchedule {
+private:
+  const int n_preview;
+  int n_drawn;     // previews drawn since the camera moved
+  int shown = -1;  // preview shown instead of frames
+public:
+  // no preview is drawn until the first restart().
+  explicit PreviewSchedule(const int& n_preview_)
+      : n_preview(n_preview_), n_drawn(n_preview_) {}
+
+  // the camera moved.
+  void restart() { n_drawn = 0; }
+  // preview to draw in this loop, which is shown from now, or -1 to draw
+  // frames.
+  int next() {
+    if (n_drawn >= n_preview) return -1;
+    shown = n_drawn++;
+    return shown;
+  }
+  // a frame of full resolution ended.
+  void frameEnd() {
+    if (n_drawn >= n_preview) shown = -1;
+  }
+  // preview to show, or -1 to show frames.
+  int showing() const { return shown; }
+};
+
+#endif /* camera_controller_h20261017 */
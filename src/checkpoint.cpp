@@ -0,0 +1,93 @@
+//
+//  checkpoint.cpp
+//  NewGlslRenderer
+//
+
+#include "checkpoint.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+
+#include "logger.h"
+
+namespace {
+
+// bytes of a layer.
+size_t layerBytes(const CheckpointHeader& header) {
+  return size_t(header.width) * size_t(header.height) * 4 * sizeof(float);
+}
+
+}  // namespace
+
+constexpr uint32_t CheckpointHeader::kVERSION;
+constexpr size_t CheckpointHeader::kLAYER;
+
+bool Checkpoint::open(const std::string& filename) {
+  if (!file.open(filename)) return false;
+
+  const CheckpointHeader expected;
+  if (file.size() >= sizeof(CheckpointHeader)) {
+    std::memcpy(&header_, file.data(), sizeof(header_));
+  }
+  if (file.size() < sizeof(CheckpointHeader) ||
+      std::memcmp(header_.magic, expected.magic, sizeof(expected.magic)) != 0 ||
+      header_.version != CheckpointHeader::kVERSION ||
+      file.size() != sizeof(CheckpointHeader) +
+                         CheckpointHeader::kLAYER * layerBytes(header_)) {
+    LOG_INFO("broken checkpoint : ", filename);
+    close();
+    return false;
+  }
+  return true;
+}
+
+const float* Checkpoint::layer(const size_t& i) const {
+  if (!file.isOpen() || i >= CheckpointHeader::kLAYER) return nullptr;
+  return reinterpret_cast<const float*>(
+      file.data() + sizeof(CheckpointHeader) + i * layerBytes(header_));
+}
+
+bool Checkpoint::save(const std::string& filename,
+                      const CheckpointHeader& header,
+                      const float* const* layers) {
+  const std::string tmp_name = filename + ".tmp";
+  const size_t size =
+      sizeof(CheckpointHeader) + CheckpointHeader::kLAYER * layerBytes(header);
+
+  const int fd = ::open(tmp_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_INFO("failed to open a file : ", tmp_name);
+    return false;
+  }
+  if (ftruncate(fd, off_t(size)) != 0) {
+    ::close(fd);
+    LOG_INFO("failed to allocate a file : ", tmp_name);
+    return false;
+  }
+  void* dst = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (dst == MAP_FAILED) {
+    ::close(fd);
+    LOG_INFO("failed to map a file : ", tmp_name);
+    return false;
+  }
+
+  std::memcpy(dst, &header, sizeof(header));
+  char* body = static_cast<char*>(dst) + sizeof(header);
+  for (size_t i = 0; i < CheckpointHeader::kLAYER; i++) {
+    std::memcpy(body + i * layerBytes(header), layers[i], layerBytes(header));
+  }
+  // data must reach the disk before rename replaces the old checkpoint.
+  const bool synced = msync(dst, size, MS_SYNC) == 0;
+  munmap(dst, size);
+  ::close(fd);
+
+  if (!synced || std::rename(tmp_name.c_str(), filename.c_str()) != 0) {
+    LOG_INFO("failed to write checkpoint : ", filename);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,64 @@
+//
+//  checkpoint.h
+//  NewGlslRenderer
+//
+
+#ifndef checkpoint_h20261017
+#define checkpoint_h20261017
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "mapped_file.h"
+
+/**
+ Header of a checkpoint file, followed by kLAYER images of width * height * 4
+ floats : the accumulator, the moments, the normal and the albedo AOVs.
+ **/
+struct CheckpointHeader {
+  static constexpr uint32_t kVERSION = 7;
+  static constexpr size_t kLAYER = 4;
+
+  char magic[8] = {'G', 'R', 'T', 'C', 'K', 'P', 'T', '\0'};
+  uint32_t version = kVERSION;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t n_sample_frame = 0;
+  uint64_t num_frame = 0;   // complete frames in the accumulator
+  uint32_t sampler_type = 0;  // SamplerType of the samples
+  uint32_t sampler_seed = 0;
+  uint64_t scene_hash = 0;  // hashScene() of the rendered polygons
+  float camera_pos[3] = {};
+  float camera_dir[3] = {};
+  uint32_t max_depth = 0;  // paths of the shader, RenderConfig::max_depth
+  float roulette = 0.f;
+};
+
+/**
+ Accumulator of progressive rendering saved to a memory mapped file.
+ save() writes to a temporary file and renames it, so an interrupted save
+ leaves the previous checkpoint.
+ **/
+class Checkpoint {
+private:
+  CheckpointHeader header_;
+  MappedFile file;
+
+public:
+
+  // map filename. fails if it is missing, broken or of another version.
+  bool open(const std::string& filename);
+  void close() { file.close(); }
+
+  const CheckpointHeader& header() const { return header_; }
+  // image i of the layers in the row order of OpenGL. valid until close().
+  const float* layer(const size_t& i) const;
+
+  // layers has kLAYER images.
+  static bool save(const std::string& filename, const CheckpointHeader& header,
+                   const float* const* layers);
+};
+
+#endif /* checkpoint_h20261017 */
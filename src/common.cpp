@@ -9,135 +9,500 @@
 #include "common.h"
 
 #include <algorithm>
-#include <deque>
-#include <functional>
+#include <cstring>
+#include <memory>
 
 #include "logger.h"
+#include "thread_pool.h"
 
 namespace {
 
-constexpr int kMAX_POL = 7;
+// ranges larger than these are split over threads.
+constexpr size_t kPARALLEL_BIN_SIZE = 1 << 16;
+constexpr size_t kSUBTREE_TASK_SIZE = 1 << 12;
 
-BVH::Node buildBVHNode(const std::vector<Polygon>& polygons,
-                       const size_t& start, const size_t& end,
-                       const size_t& parent) {
+struct AABB {
+  Vec start = Vec(kINF);
+  Vec end = Vec(-kINF);
+
+  void grow(const Vec& v) {
+    start = min(start, v);
+    end = max(end, v);
+  }
+  void grow(const AABB& b) {
+    start = min(start, b.start);
+    end = max(end, b.end);
+  }
+  real surfaceArea() const {
+    const Vec l = end - start;
+    return 2 * (l[0] * l[1] + l[1] * l[2] + l[2] * l[0]);
+  }
+};
+
+// exactly equal, so refit tells moves however small.
+bool sameVec(const Vec& a, const Vec& b) {
+  return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+struct Bin {
+  AABB bounds;
+  size_t count = 0;
+};
+
+struct Split {
+  int axis = -1;
+  int bin = 0;  // primitives in bins [0, bin) go to the left child.
+  real cost = kINF;
+};
+
+// bounds and centroids of primitives, computed once before building.
+struct BuildInput {
+  std::vector<AABB> bounds;
+  std::vector<Vec> centroid;
+  std::vector<size_t> order;  // permutation of primitives, sorted by build
+  BVH::Config config;
+  int n_chunk;  // number of chunks for parallel loops
+
+  BuildInput(const std::vector<Polygon>& polygons, const BVH::Config& config_)
+      : bounds(polygons.size()),
+        centroid(polygons.size()),
+        order(polygons.size()),
+        config(config_),
+        n_chunk(config_.parallel ? ThreadPool::shared().size() : 1) {
+    parallelFor(0, polygons.size(), size_t(n_chunk),
+                [&](const size_t& s, const size_t& e, const size_t&) {
+                  for (size_t i = s; i < e; i++) {
+                    for (auto& vert : polygons[i].vert) {
+                      bounds[i].grow(vert);
+                    }
+                    centroid[i] = (bounds[i].start + bounds[i].end) / 2;
+                    order[i] = i;
+                  }
+                });
+  }
+
+  size_t chunks(const size_t& s_idx, const size_t& e_idx) const {
+    return e_idx - s_idx >= kPARALLEL_BIN_SIZE ? size_t(n_chunk) : 1;
+  }
+};
+
+// a node which is not built yet, with bounds of centroids of its primitives.
+struct Issue {
   BVH::Node node;
-  node.start = Vec(kINF);
-  node.end = Vec(-kINF);
-  for (size_t i = start; i < end; i++) {
-    for (auto& vert : polygons[i].vert) {
-      node.end = max(vert, node.end);
-      node.start = min(vert, node.start);
+  AABB c_bounds;
+};
+
+int binIndex(const real& c, const real& c_min, const real& scale,
+             const int& n_bin) {
+  return std::min(n_bin - 1, int((c - c_min) * scale));
+}
+
+// bin [s_idx, e_idx) on 3 axes at once. bins has 3 * n_bin elements.
+void binPrimitives(const BuildInput& in, const size_t& s_idx,
+                   const size_t& e_idx, const AABB& c_bounds,
+                   std::vector<Bin>* bins) {
+  const int n_bin = in.config.n_bin;
+  real scale[3];
+  for (int axis : {0, 1, 2}) {
+    const real extent = c_bounds.end[axis] - c_bounds.start[axis];
+    scale[axis] = extent > 0 ? real(n_bin) / extent : 0;
+  }
+  for (size_t i = s_idx; i < e_idx; i++) {
+    const size_t p = in.order[i];
+    for (int axis : {0, 1, 2}) {
+      const int b =
+          binIndex(in.centroid[p][axis], c_bounds.start[axis], scale[axis],
+                   n_bin);
+      Bin& bin = (*bins)[size_t(axis * n_bin + b)];
+      bin.bounds.grow(in.bounds[p]);
+      bin.count++;
+    }
+  }
+}
+
+// find the split of [s_idx, e_idx) with minimum SAH cost over binned
+// centroids. cost is relative to making a leaf of one primitive.
+Split findSplit(const BuildInput& in, const size_t& s_idx, const size_t& e_idx,
+                const AABB& bounds, const AABB& c_bounds) {
+  const int n_bin = in.config.n_bin;
+  const size_t n_chunk = in.chunks(s_idx, e_idx);
+
+  // each chunk bins its own range, then they are merged in chunk order.
+  std::vector<std::vector<Bin>> chunk_bins(
+      n_chunk, std::vector<Bin>(static_cast<size_t>(3 * n_bin)));
+  parallelFor(s_idx, e_idx, n_chunk,
+              [&](const size_t& s, const size_t& e, const size_t& c) {
+                binPrimitives(in, s, e, c_bounds, &chunk_bins[c]);
+              });
+  std::vector<Bin>& bins = chunk_bins[0];
+  for (size_t c = 1; c < n_chunk; c++) {
+    for (size_t b = 0; b < bins.size(); b++) {
+      bins[b].bounds.grow(chunk_bins[c][b].bounds);
+      bins[b].count += chunk_bins[c][b].count;
+    }
+  }
+
+  std::vector<real> right_area(static_cast<size_t>(n_bin));
+  std::vector<size_t> right_count(static_cast<size_t>(n_bin));
+
+  Split best;
+  const real inv_area = 1 / bounds.surfaceArea();
+
+  for (int axis : {0, 1, 2}) {
+    if (c_bounds.end[axis] - c_bounds.start[axis] <= 0) continue;
+    const Bin* axis_bins = &bins[size_t(axis * n_bin)];
+
+    // sweep from right, then evaluate each plane sweeping from left.
+    AABB acc;
+    size_t count = 0;
+    for (int b = n_bin - 1; b > 0; b--) {
+      acc.grow(axis_bins[b].bounds);
+      count += axis_bins[b].count;
+      right_area[size_t(b)] = acc.surfaceArea();
+      right_count[size_t(b)] = count;
+    }
+    acc = AABB();
+    count = 0;
+    for (int b = 1; b < n_bin; b++) {
+      acc.grow(axis_bins[b - 1].bounds);
+      count += axis_bins[b - 1].count;
+      if (count == 0 || right_count[size_t(b)] == 0) continue;
+      const real cost = in.config.traversal_cost +
+                        (acc.surfaceArea() * real(count) +
+                         right_area[size_t(b)] * real(right_count[size_t(b)])) *
+                            inv_area;
+      if (cost < best.cost) {
+        best.axis = axis;
+        best.bin = b;
+        best.cost = cost;
+      }
     }
   }
-  node.s_idx = start;
-  node.e_idx = end;
-  node.parent = parent;
-  return node;
+  return best;
 }
 
-constexpr real getMax(const Polygon& pol, const int& axis) {
-  return mymax(pol.vert[0][axis], mymax(pol.vert[1][axis], pol.vert[2][axis]));
+// partition [s_idx, e_idx) of in->order and return the index of the first
+// primitive of the right child.
+size_t partition(BuildInput* in, const Split& split, const size_t& s_idx,
+                 const size_t& e_idx, const AABB& c_bounds) {
+  auto begin = in->order.begin() + long(s_idx);
+  auto end = in->order.begin() + long(e_idx);
+
+  if (split.axis == -1) {
+    // all centroids are at the same point, split at the middle.
+    return (s_idx + e_idx) / 2;
+  }
+
+  const int axis = split.axis;
+  const int n_bin = in->config.n_bin;
+  const real scale =
+      real(n_bin) / (c_bounds.end[axis] - c_bounds.start[axis]);
+  auto mid = std::partition(begin, end, [&](const size_t& p) {
+    return binIndex(in->centroid[p][axis], c_bounds.start[axis], scale,
+                    n_bin) < split.bin;
+  });
+  return size_t(mid - in->order.begin());
 }
 
-template <int axis>
-constexpr bool comparePolygon(const Polygon& a, const Polygon& b) {
-  return (getMax(a, axis) > getMax(b, axis));
+Issue buildBVHNode(const BuildInput& in, const size_t& start,
+                   const size_t& end, const size_t& parent) {
+  const size_t n_chunk = in.chunks(start, end);
+  std::vector<AABB> bounds(n_chunk), c_bounds(n_chunk);
+  parallelFor(start, end, n_chunk,
+              [&](const size_t& s, const size_t& e, const size_t& c) {
+                for (size_t i = s; i < e; i++) {
+                  const size_t p = in.order[i];
+                  bounds[c].grow(in.bounds[p]);
+                  c_bounds[c].grow(in.centroid[p]);
+                }
+              });
+  for (size_t c = 1; c < n_chunk; c++) {
+    bounds[0].grow(bounds[c]);
+    c_bounds[0].grow(c_bounds[c]);
+  }
+
+  Issue issue;
+  issue.node.start = bounds[0].start;
+  issue.node.end = bounds[0].end;
+  issue.node.s_idx = start;
+  issue.node.e_idx = end;
+  issue.node.parent = parent;
+  issue.c_bounds = c_bounds[0];
+  return issue;
 }
 
-real surfaceArea(const BVH::Node& a) {
-  const Vec l = a.end - a.start;
-  return 2 * (l[0] * l[1] + l[1] * l[2] + l[2] * l[0]);
+bool makeLeaf(const BuildInput& in, BVH::Node* node) {
+  node->leaf = node->e_idx - node->s_idx <= in.config.max_leaf_size;
+  return node->leaf;
 }
 
-// sort pols and decide partitioning index.
-size_t decidePartition(const BVH::Node& parent, std::vector<Polygon>* pols) {
-  static std::function<decltype(comparePolygon<0>)> compare[3]{
-      comparePolygon<0>,
-      comparePolygon<1>,
-      comparePolygon<2>,
-  };
+// split the node and return its children with parent index.
+void splitNode(BuildInput* in, const Issue& issue, const size_t& parent,
+               Issue* left, Issue* right) {
+  const size_t start = issue.node.s_idx;
+  const size_t end = issue.node.e_idx;
+  const AABB bounds = {issue.node.start, issue.node.end};
 
-  size_t s_id = parent.s_idx;
-  size_t e_id = parent.e_idx;
-
-  real vmin = kINF;
-  size_t min_idx = (s_id + e_id) / 2;
-  int min_c = 0;
-  Vec center = (parent.start + parent.end) / 2;
-  for (int c : {0, 1, 2}) {
-    std::sort(std::begin(*pols) + s_id, std::begin(*pols) + e_id, compare[c]);
-    for (size_t i = s_id + 1; i < e_id; i++) {
-      if (getMax(pols->at(i), c) < center[c]) {
-        float s = surfaceArea(buildBVHNode(*pols, s_id, i, 0)) +
-                  surfaceArea(buildBVHNode(*pols, i, e_id, 0));
-        if (s < vmin) {
-          vmin = s;
-          min_idx = i;
-          min_c = c;
-        }
-        break;
-      }
+  const Split split = findSplit(*in, start, end, bounds, issue.c_bounds);
+  const size_t p_idx = partition(in, split, start, end, issue.c_bounds);
+
+  *left = buildBVHNode(*in, start, p_idx, parent);
+  *right = buildBVHNode(*in, p_idx, end, parent);
+}
+
+// build subtree of root serially in depth first order. parent of root is
+// left as is, other parents are indices in *nodes.
+void buildSubtree(BuildInput* in, const Issue& root,
+                  std::vector<BVH::Node>* nodes) {
+  std::vector<Issue> issue_stack(1, root);
+  while (!issue_stack.empty()) {
+    Issue issue = issue_stack.back();
+    issue_stack.pop_back();
+
+    if (makeLeaf(*in, &issue.node)) {
+      nodes->emplace_back(issue.node);
+      continue;
+    }
+
+    Issue left, right;
+    splitNode(in, issue, nodes->size(), &left, &right);
+    issue_stack.emplace_back(right);
+    issue_stack.emplace_back(left);
+
+    nodes->emplace_back(issue.node);
+  }
+}
+
+/**
+ Top of the tree is built recursively and children of large nodes are built
+ as parallel tasks. Small subtrees are built serially into their own arrays,
+ which are joined in depth first order at the end.
+ **/
+struct Subtree {
+  BVH::Node node;  // valid if nodes is empty
+  std::unique_ptr<Subtree> left, right;
+  std::vector<BVH::Node> nodes;
+};
+
+void buildTop(BuildInput* in, const Issue& issue, Subtree* tree) {
+  const size_t size = issue.node.e_idx - issue.node.s_idx;
+  if (!in->config.parallel || size < kSUBTREE_TASK_SIZE) {
+    buildSubtree(in, issue, &tree->nodes);
+    return;
+  }
+
+  tree->node = issue.node;
+  if (makeLeaf(*in, &tree->node)) {
+    return;
+  }
+
+  // primitives of children are disjoint ranges of in->order.
+  Issue left, right;
+  splitNode(in, issue, size_t(-1), &left, &right);
+  tree->left.reset(new Subtree());
+  tree->right.reset(new Subtree());
+
+  TaskGroup group;
+  group.run([&]() { buildTop(in, left, tree->left.get()); });
+  buildTop(in, right, tree->right.get());
+  group.wait();
+}
+
+void joinSubtree(const Subtree& tree, const size_t& parent,
+                 std::vector<BVH::Node>* nodes) {
+  const size_t offset = nodes->size();
+  if (!tree.nodes.empty()) {
+    for (const BVH::Node& node : tree.nodes) {
+      nodes->emplace_back(node);
+      nodes->back().parent =
+          node.parent == size_t(-1) ? parent : node.parent + offset;
     }
+    return;
+  }
+
+  nodes->emplace_back(tree.node);
+  nodes->back().parent = parent;
+  if (tree.left) {
+    joinSubtree(*tree.left, offset, nodes);
+    joinSubtree(*tree.right, offset, nodes);
   }
-  std::sort(std::begin(*pols) + s_id, std::begin(*pols) + e_id, compare[min_c]);
+}
 
-  return min_idx;
+// nodes are in depth first order, so left child of node i is i + 1.
+// brother of a left child is its right sibling, and nodes without sibling
+// on the right take brother of their parent.
+void linkBrothers(std::vector<BVH::Node>* nodes) {
+  for (size_t i = 1; i < nodes->size(); i++) {
+    const size_t parent = (*nodes)[i].parent;
+    if (i != parent + 1) {
+      (*nodes)[parent + 1].brother = i;
+    }
+  }
+  for (size_t i = 1; i < nodes->size(); i++) {
+    BVH::Node& node = (*nodes)[i];
+    if (node.brother == size_t(-1)) {
+      node.brother = (*nodes)[node.parent].brother;
+    }
+  }
 }
 
 }  // namespace
 
 bool BVH::init(const std::vector<Polygon>& pols) {
-  polygons = pols;
-  if (polygons.size() < 1) {
+  nodes.clear();
+  polygons.clear();
+  order.clear();
+  if (pols.size() < 1) {
     return false;
   }
   DEBUG_LOG("start building BVH !");
 
-  static std::function<decltype(comparePolygon<0>)> compare[3]{
-      comparePolygon<0>,
-      comparePolygon<1>,
-      comparePolygon<2>,
-  };
+  BuildInput in(pols, config);
 
-  std::deque<Node> issue_stack;
-  issue_stack.push_back(buildBVHNode(polygons, 0, polygons.size(), -1));
+  Subtree root;
+  buildTop(&in, buildBVHNode(in, 0, pols.size(), size_t(-1)), &root);
+  joinSubtree(root, size_t(-1), &nodes);
 
-  while (!issue_stack.empty()) {
-    Node node = issue_stack.back();
-    issue_stack.pop_back();
+  linkBrothers(&nodes);
 
-    if (node.parent == size_t(-1)) {
-    } else if (node.parent != nodes.size() - 1) {
-      nodes[node.parent + 1].brother = nodes.size();
-    }
+  polygons.resize(pols.size(), pols[0]);
+  parallelFor(0, pols.size(), size_t(in.n_chunk),
+              [&](const size_t& s, const size_t& e, const size_t&) {
+                for (size_t i = s; i < e; i++) {
+                  polygons[i] = pols[in.order[i]];
+                }
+              });
+  order = std::move(in.order);
 
-    if (node.e_idx - node.s_idx <= kMAX_POL) {
-      node.leaf = true;
-      nodes.emplace_back(node);
-      continue;
-    }
-    size_t start = node.s_idx;
-    size_t end = node.e_idx;
+  DEBUG_LOG("finish building BVH !");
+  DEBUG_LOG("BVH size is ", nodes.size());
 
-    size_t p_idx = decidePartition(node, &polygons);
+  return true;
+}
 
-    issue_stack.emplace_back(buildBVHNode(polygons, p_idx, end, nodes.size()));
-    issue_stack.emplace_back(
-        buildBVHNode(polygons, start, p_idx, nodes.size()));
+bool BVH::refit(const std::vector<Vec>& vertices,
+                std::vector<size_t>* moved_polygons,
+                std::vector<size_t>* moved_nodes) {
+  moved_polygons->clear();
+  moved_nodes->clear();
+  if (vertices.size() != polygons.size() * 3 || nodes.empty()) {
+    return false;
+  }
 
-    nodes.emplace_back(node);
+  const size_t n_chunk = config.parallel ? ThreadPool::shared().size() : 1;
+  std::vector<uint8_t> moved(polygons.size(), 0);
+  parallelFor(0, polygons.size(), n_chunk,
+              [&](const size_t& s, const size_t& e, const size_t&) {
+                for (size_t i = s; i < e; i++) {
+                  const Vec* v = &vertices[3 * order[i]];
+                  Polygon& pol = polygons[i];
+                  for (int k = 0; k < 3; k++) {
+                    if (!sameVec(pol.vert[k], v[k])) {
+                      pol.vert[k] = v[k];
+                      moved[i] = 1;
+                    }
+                  }
+                }
+              });
+  for (size_t i = 0; i < polygons.size(); i++) {
+    if (moved[i]) moved_polygons->emplace_back(i);
   }
+  if (moved_polygons->empty()) return true;
 
-  for (size_t i = 1; i < nodes.size() - 1; i++) {
+  // children follow their parent, so they are done before it in reverse
+  // order. only leaves with moved polygons are computed again.
+  std::vector<AABB> bounds(nodes.size());
+  std::vector<uint8_t> dirty(nodes.size(), 0);
+  for (size_t i = nodes.size(); i-- > 0;) {
     Node& node = nodes[i];
-    if (node.brother == size_t(-1)) {
-      node.brother = nodes[node.parent].brother;
+    if (node.leaf) {
+      for (size_t p = node.s_idx; p < node.e_idx; p++) {
+        dirty[i] |= moved[p];
+      }
+      if (dirty[i]) {
+        for (size_t p = node.s_idx; p < node.e_idx; p++) {
+          for (auto& vert : polygons[p].vert) {
+            bounds[i].grow(vert);
+          }
+        }
+      }
+    }
+    if (dirty[i]) {
+      if (!sameVec(bounds[i].start, node.start) ||
+          !sameVec(bounds[i].end, node.end)) {
+        node.start = bounds[i].start;
+        node.end = bounds[i].end;
+        moved_nodes->emplace_back(i);
+      } else {
+        // ancestors don't change by this node.
+        dirty[i] = 0;
+      }
+    }
+    if (node.parent != size_t(-1)) {
+      bounds[node.parent].grow(AABB{node.start, node.end});
+      dirty[node.parent] |= dirty[i];
     }
   }
+  std::reverse(moved_nodes->begin(), moved_nodes->end());
+  return true;
+}
 
-  DEBUG_LOG("finish building BVH !");
-  DEBUG_LOG("BVH size is ", nodes.size());
+real BVH::sahCost() const {
+  if (nodes.empty()) return 0;
+  const real root_area = AABB{nodes[0].start, nodes[0].end}.surfaceArea();
+  if (root_area <= 0) return 0;
+  real cost = 0;
+  for (const Node& node : nodes) {
+    const real area = AABB{node.start, node.end}.surfaceArea();
+    cost += area * (node.leaf ? real(node.e_idx - node.s_idx)
+                              : config.traversal_cost);
+  }
+  return cost / root_area;
+}
 
-  return true;
+uint64_t hashScene(const std::vector<Polygon>& polygons) {
+  static_assert(sizeof(real) == sizeof(uint32_t), "real must be 32 bit");
+  uint64_t hash = 0xCBF29CE484222325ull;
+  auto mix = [&hash](const uint32_t& word) {
+    hash = (hash ^ word) * 0x100000001B3ull;
+  };
+  auto mixVec = [&mix](const Vec& v) {
+    uint32_t words[3];
+    std::memcpy(words, &v.x, sizeof(uint32_t));
+    std::memcpy(words + 1, &v.y, sizeof(uint32_t));
+    std::memcpy(words + 2, &v.z, sizeof(uint32_t));
+    mix(words[0]);
+    mix(words[1]);
+    mix(words[2]);
+  };
+  for (auto& pol : polygons) {
+    mixVec(pol.vert[0]);
+    mixVec(pol.vert[1]);
+    mixVec(pol.vert[2]);
+    mixVec(pol.col);
+    mix(uint32_t(pol.material));
+  }
+  return hash;
+}
+
+float computeBrightMagnification(std::vector<Polygon>* polygons) {
+  float max_v = 0.f;
+
+  for (auto& pol : *polygons) {
+    if (pol.material != Material::Light && pol.material != Material::DirLight) {
+      continue;
+    }
+    max_v = std::max(std::abs(pol.col[0]), max_v);
+    max_v = std::max(std::abs(pol.col[1]), max_v);
+    max_v = std::max(std::abs(pol.col[2]), max_v);
+  }
+
+  for (auto& pol : *polygons) {
+    if (pol.material != Material::Light && pol.material != Material::DirLight) {
+      continue;
+    }
+    pol.col /= max_v;
+  }
+
+  return max_v;
 }
@@ -10,9 +10,11 @@
 #define common_h_20160322
 
 #include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <random>
 #include <string>
+#include <vector>
 
 typedef float real;
 
@@ -101,7 +103,7 @@ constexpr Vec min(const Vec& a, const Vec& b) {
   return Vec(mymin(a.x, b.x), mymin(a.y, b.y), mymin(a.z, b.z));
 }
 
-constexpr real length(const Vec& v) { return v.length(); }
+inline real length(const Vec& v) { return v.length(); }
 
 inline Vec operator*(const real& f, const Vec& v) { return v * f; }
 inline Vec normalize(const Vec& v) { return v * (real(1) / v.length()); }
@@ -156,6 +158,21 @@ constexpr color GRAY = color(0.5f);
 
 inline real rand_() { return real(std::rand()) / RAND_MAX; }
 
+/** splitmix64. unlike rand_(), its whole state can be saved and restored. **/
+struct SplitMix64 {
+  uint64_t state;
+  explicit SplitMix64(const uint64_t& seed = 0) : state(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+  // uniform in [0, 1).
+  real rand() { return real(next() >> 40) * (1.f / real(1ull << 24)); }
+};
+
 enum Material { Light, DirLight, Normal };
 
 struct Ray {
@@ -197,13 +214,44 @@ public:
     size_t parent = size_t(-1);
     bool leaf = false;
   };
+  // parameters of binned SAH build.
+  struct Config {
+    int n_bin = 16;
+    size_t max_leaf_size = 7;
+    real traversal_cost = 1.f;  // relative to cost of a triangle test
+    bool parallel = true;        // build with ThreadPool::shared()
+  };
   std::vector<Node> nodes;
   std::vector<Polygon> polygons;
+  std::vector<size_t> order;  // index in polygons_ of init() of polygons
+  Config config;
 
 public:
   BVH() {}
+  explicit BVH(const Config& config_) : config(config_) {}
 
+  // reorder polygons_ and build nodes in depth first order.
+  // the result does not depend on the number of threads.
   bool init(const std::vector<Polygon>& polygons_);
+
+  // move polygons to vertices, 3 per polygon in the order of polygons_ of
+  // init(), and refit bounds of nodes bottom up. the tree is kept, so it
+  // gets worse as polygons move far, see sahCost(). indices of polygons and
+  // nodes which changed are set in increasing order. false if the number of
+  // vertices doesn't match.
+  bool refit(const std::vector<Vec>& vertices,
+             std::vector<size_t>* moved_polygons,
+             std::vector<size_t>* moved_nodes);
+
+  // expected cost of a ray hitting the root by SAH, relative to a triangle
+  // test.
+  real sahCost() const;
 };
 
+// FNV-1a hash of polygons by 32 bit words, to identify a scene in files.
+uint64_t hashScene(const std::vector<Polygon>& polygons);
+
+// normalize colors of emitters by max component and return its magnitude.
+float computeBrightMagnification(std::vector<Polygon>* polygons);
+
 #endif /* common_h */
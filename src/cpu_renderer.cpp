@@ -0,0 +1,487 @@
+//
+//  cpu_renderer.cpp
+//  NewGlslRenderer
+//
+
+#include "cpu_renderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "fps.h"
+#include "light_sampler.h"
+#include "sampler.h"
+#include "logger.h"
+#include "simd_kernels.h"
+#include "snapshot_writer.h"
+#include "wide_bvh.h"
+
+namespace {
+
+constexpr real kPI = 3.1415926535f;
+constexpr real kZERO = 0.0001f;
+constexpr int kTILE_SIZE = 16;
+// camera rays are traced as packets of kPACKET_W x kPACKET_H pixels.
+constexpr int kPACKET_W = 4, kPACKET_H = 2;
+static_assert(kPACKET_W * kPACKET_H == kSIMD_LANES, "packet size");
+constexpr size_t kWIDE_STACK_SIZE = 512;
+
+// same constants as test.frag.
+constexpr real kSCREEN_W = 640, kSCREEN_H = 480;
+
+struct Scene {
+  const BVH& bvh;
+  const TriangleSoA& tris;
+  const SimdKernels& kernels;
+  const WideBVH<4>* wide4;  // used instead of bvh for single rays if not null
+  const WideBVH<8>* wide8;
+  const LightSampler& lights;
+};
+
+// fill the hit record of the nearest triangle, as intersectTriangle does.
+void setIntersection(const Ray& ray, const Scene& scene, const size_t& tri_idx,
+                     const real& t, Intersection* result) {
+  const Polygon& pol = scene.bvh.polygons[tri_idx];
+  const Vec edge0 = pol.vert[1] - pol.vert[0];
+  const Vec edge1 = pol.vert[2] - pol.vert[0];
+
+  result->point = ray.org + ray.dir * t;
+  result->t = t;
+  result->col = pol.col;
+  result->normal = normalize(cross(edge0, edge1));
+  result->solid_id = tri_idx;
+  if (dot(result->normal, ray.dir) > 0) {
+    result->normal = result->normal * -1;
+  }
+  result->material = pol.material;
+}
+
+bool intersectBoundingBox(const Ray& ray, const BVH::Node& node) {
+  real t_far = kINF, t_near = -kINF;
+  for (int i = 0; i < 3; i++) {
+    real t1 = (node.start[i] - ray.org[i]) / ray.dir[i];
+    real t2 = (node.end[i] - ray.org[i]) / ray.dir[i];
+    if (t1 < t2) {
+      t_far = std::min(t_far, t2);
+      t_near = std::max(t_near, t1);
+    } else {
+      t_far = std::min(t_far, t1);
+      t_near = std::max(t_near, t2);
+    }
+    if (t_far < t_near) return false;
+  }
+  return t_far > 0;
+}
+
+// stackless traversal with brother links, same as intersectBVHStackless in
+// test.frag.
+// triangles of a leaf are tested kSIMD_LANES at a time.
+Intersection intersectBinaryBVH(const Ray& ray, const Scene& scene) {
+  const BVH& bvh = scene.bvh;
+  real t = kINF;
+  int hit = -1;
+
+  size_t node_idx = 0;
+  while (true) {
+    const BVH::Node& node = bvh.nodes[node_idx];
+
+    if (intersectBoundingBox(ray, node)) {
+      if (node.leaf) {
+        for (size_t i = node.s_idx; i < node.e_idx; i += kSIMD_LANES) {
+          const int count = int(std::min(node.e_idx - i, size_t(kSIMD_LANES)));
+          const int idx =
+              scene.kernels.intersectTriangles(scene.tris, ray, i, count, &t);
+          if (idx != -1) hit = idx;
+        }
+      }
+      node_idx++;
+      if (node_idx >= bvh.nodes.size()) break;
+    } else {
+      if (node.brother == size_t(-1)) {
+        break;
+      }
+      node_idx = node.brother;
+    }
+  }
+
+  Intersection isect;
+  if (hit != -1) {
+    setIntersection(ray, scene, size_t(hit), t, &isect);
+  }
+  return isect;
+}
+
+// traverse children nearest first with a stack, skipping nodes farther than
+// the current hit.
+template <int N>
+Intersection intersectWideBVH(const Ray& ray, const WideBVH<N>& wide,
+                              const Scene& scene) {
+  using Wide = WideBVH<N>;
+  struct Entry {
+    uint32_t ref;
+    float t;
+  };
+  Entry stack[kWIDE_STACK_SIZE];
+  int sp = 0;
+
+  const Vec inv_dir(1 / ray.dir.x, 1 / ray.dir.y, 1 / ray.dir.z);
+  real t = kINF;
+  int hit = -1;
+
+  stack[sp++] = {0, -kINF};
+  while (sp > 0) {
+    const Entry entry = stack[--sp];
+    if (entry.t >= t) continue;
+
+    if (Wide::isLeaf(entry.ref)) {
+      const size_t start = Wide::leafStart(entry.ref);
+      const int count = int(Wide::leafCount(entry.ref));
+      for (int i = 0; i < count; i += kSIMD_LANES) {
+        const int idx = scene.kernels.intersectTriangles(
+            scene.tris, ray, start + size_t(i),
+            std::min(count - i, kSIMD_LANES), &t);
+        if (idx != -1) hit = idx;
+      }
+      continue;
+    }
+
+    const typename Wide::Node& node = wide.nodes[entry.ref];
+    float t_near[N];
+    int mask = scene.kernels.intersectBoxes(node.start[0], node.end[0], N, ray,
+                                            inv_dir, t, t_near);
+
+    // push hit children in order of distance, farthest first.
+    const int base = sp;
+    while (mask) {
+      const int k = __builtin_ctz(unsigned(mask));
+      mask &= mask - 1;
+      if (node.child[k] == Wide::kEMPTY) continue;
+      int i = sp++;
+      for (; i > base && stack[i - 1].t < t_near[k]; i--) {
+        stack[i] = stack[i - 1];
+      }
+      stack[i] = {node.child[k], t_near[k]};
+    }
+  }
+
+  Intersection isect;
+  if (hit != -1) {
+    setIntersection(ray, scene, size_t(hit), t, &isect);
+  }
+  return isect;
+}
+
+Intersection intersectBVH(const Ray& ray, const Scene& scene) {
+  if (scene.wide8) return intersectWideBVH(ray, *scene.wide8, scene);
+  if (scene.wide4) return intersectWideBVH(ray, *scene.wide4, scene);
+  return intersectBinaryBVH(ray, scene);
+}
+
+// same traversal for coherent camera rays, a node is entered when any of
+// the active lanes hits it.
+void intersectBVH(const Scene& scene, RayPacket* packet) {
+  const BVH& bvh = scene.bvh;
+
+  size_t node_idx = 0;
+  while (true) {
+    const BVH::Node& node = bvh.nodes[node_idx];
+
+    const int mask =
+        scene.kernels.intersectBoxPacket(*packet, node.start, node.end);
+    if (mask) {
+      if (node.leaf) {
+        for (size_t i = node.s_idx; i < node.e_idx; i++) {
+          scene.kernels.intersectTrianglePacket(packet, scene.tris, i, mask);
+        }
+      }
+      node_idx++;
+      if (node_idx >= bvh.nodes.size()) break;
+    } else {
+      if (node.brother == size_t(-1)) {
+        break;
+      }
+      node_idx = node.brother;
+    }
+  }
+}
+
+Ray decideRay(const Vec& normal, const Vec& point, const Vec& color, real* pdf,
+              PixelSampler* seed) {
+  const real phi = 2 * kPI * seed->rand();
+  const real costheta = std::sqrt(seed->rand());
+
+  Vec u;
+  if (std::abs(normal.x) > kZERO) {
+    u = normalize(cross(normal, Vec(0, 1, 0)));
+  } else {
+    u = normalize(cross(normal, Vec(1, 0, 0)));
+  }
+  const Vec v = normalize(cross(normal, u));
+  Ray ray(point, normalize(u * std::cos(phi) * costheta +
+                           v * std::sin(phi) * costheta +
+                           normal * std::sqrt(1 - costheta * costheta)));
+  ray.col = color;
+  *pdf *= kPI;
+  return ray;
+}
+
+real powerHeuristic(const real& pdf_a, const real& pdf_b) {
+  return pdf_a * pdf_a / (pdf_a * pdf_a + pdf_b * pdf_b);
+}
+
+// pdf per solid angle that sampleLight chooses the emitter hit by ray.
+real lightPdf(const Ray& ray, const Intersection& isect, const Scene& scene) {
+  const real cos_l = std::abs(dot(isect.normal, ray.dir));
+  if (scene.lights.entries.empty() || cos_l <= 0) return 0;
+  return scene.lights.pdfArea(scene.bvh.polygons[isect.solid_id]) * isect.t *
+         isect.t / cos_l;
+}
+
+// next event estimation, same as sampleLight in test.frag.
+Vec sampleLight(const Intersection& isect, const Scene& scene,
+                PixelSampler* seed) {
+  const real u1 = seed->rand();
+  const real u2 = seed->rand();
+  const Polygon& pol = scene.bvh.polygons[scene.lights.sample(u1, u2)];
+
+  const Vec edge0 = pol.vert[1] - pol.vert[0];
+  const Vec edge1 = pol.vert[2] - pol.vert[0];
+  const real su = std::sqrt(seed->rand());
+  const real v = seed->rand();
+  const Vec pos = pol.vert[0] + edge0 * (su * (1 - v)) + edge1 * (su * v);
+  const Vec normal = normalize(cross(edge0, edge1));
+
+  const Vec to_light = pos - isect.point;
+  const real dist2 = dot(to_light, to_light);
+  const real dist = std::sqrt(dist2);
+  const Vec dir = to_light / dist;
+  const real cos_x = dot(isect.normal, dir);
+  const real cos_l = std::abs(dot(normal, dir));
+  if (cos_x <= 0 || cos_l <= 0) return Vec(0);
+  // the emitter itself is at dist.
+  if (intersectBVH(Ray(isect.point, dir), scene).t < dist * (1 - 1e-3f)) {
+    return Vec(0);
+  }
+
+  const real pdf_light = scene.lights.pdfArea(pol) * dist2 / cos_l;
+  const real pdf_bsdf = cos_x / kPI;
+  return pol.col * (cos_x / (kPI * kPI * pdf_light) *
+                    powerHeuristic(pdf_light, pdf_bsdf));
+}
+
+// radiance along ray divided by its pdf.
+// result is the first intersection of ray, which is traced as a packet.
+// paths end after max_depth bounces, and survive bounce n by roulette^(n-1).
+Vec renderRay(Ray ray, Intersection result, const Scene& scene,
+              const int& max_depth, const real& roulette,
+              PixelSampler* seed) {
+  real pdf = 1;
+  ray.col = Vec(1);
+  Vec radiance(0);
+  real pdf_bsdf = 0;  // pdf per solid angle of decideRay which made ray
+  int n = 1;
+  while (true) {
+    if (result.t == kINF) {
+      return radiance;
+    } else if (result.material == Material::Light) {
+      // camera rays are not sampled by sampleLight.
+      const real weight =
+          n == 1 ? 1 : powerHeuristic(pdf_bsdf, lightPdf(ray, result, scene));
+      return radiance + ray.col * result.col * (weight / pdf);
+    } else if (result.material == Material::DirLight) {
+      return radiance +
+             ray.col * result.col * (-dot(result.normal, ray.dir) / pdf);
+    }
+    const real rr = std::pow(roulette, real(n - 1));
+    if (n > max_depth || seed->rand() > rr) {
+      return radiance;
+    }
+    pdf *= rr;
+
+    ray.col = ray.col * result.col;
+    if (!scene.lights.entries.empty()) {
+      radiance += ray.col * sampleLight(result, scene, seed) / pdf;
+    }
+    ray = decideRay(result.normal, result.point, ray.col, &pdf, seed);
+    pdf_bsdf = dot(result.normal, ray.dir) / kPI;
+    result = intersectBVH(ray, scene);
+
+    n += 1;
+  }
+}
+
+}  // namespace
+
+CpuRayTraceRenderer::CpuRayTraceRenderer(const RenderConfig& r_config_,
+                                         const int& n_threads_,
+                                         const int& bvh_width_)
+    : r_config(r_config_),
+      n_threads(n_threads_ > 0
+                    ? n_threads_
+                    : std::max(1, int(std::thread::hardware_concurrency()))),
+      bvh_width(bvh_width_),
+      accumulator(size_t(r_config_.width) * size_t(r_config_.height) * 4,
+                  0.f) {}
+
+bool CpuRayTraceRenderer::setPolygons(const std::vector<Polygon>& polygons_,
+                                      const BVH::Config& bvh_config) {
+  bvh.config = bvh_config;
+  if (!bvh.init(polygons_)) {
+    return false;
+  }
+  bright_mag = computeBrightMagnification(&bvh.polygons);
+  tris.init(bvh.polygons);
+  lights.init(bvh.polygons);
+
+  // traversal stack holds at most (N - 1) entries per level.
+  use_wide = false;
+  if (bvh_width == 8 && wide8.init(bvh)) {
+    use_wide = wide8.depth * 7 + 1 <= kWIDE_STACK_SIZE;
+  } else if (bvh_width == 4 && wide4.init(bvh)) {
+    use_wide = wide4.depth * 3 + 1 <= kWIDE_STACK_SIZE;
+  }
+  if (bvh_width != 2 && !use_wide) {
+    LOG_INFO("CpuRayTraceRenderer : use binary BVH instead of BVH", bvh_width);
+  }
+  return true;
+}
+
+void CpuRayTraceRenderer::renderFrame() {
+  if (bvh.nodes.empty()) return;
+
+  const int width = r_config.width;
+  const int height = r_config.height;
+  const int n_tile_x = (width + kTILE_SIZE - 1) / kTILE_SIZE;
+  const int n_tile_y = (height + kTILE_SIZE - 1) / kTILE_SIZE;
+  const int n_tile = n_tile_x * n_tile_y;
+  const real aspect_ratio = real(width) / real(height);
+
+  const Vec camera_pos = r_config.camera_pos;
+  const Vec camera_dir = normalize(r_config.camera_dir);
+  const Vec c_x = normalize(cross(camera_dir, Vec(0, 0, 1)));
+  const Vec c_y = normalize(cross(camera_dir, c_x));
+
+  const Scene scene = {bvh, tris, selectSimdKernels(),
+                       use_wide && bvh_width == 4 ? &wide4 : nullptr,
+                       use_wide && bvh_width == 8 ? &wide8 : nullptr, lights};
+  std::atomic<int> next_tile(0);
+
+  auto worker = [&]() {
+    for (int tile = next_tile++; tile < n_tile; tile = next_tile++) {
+      const int x0 = (tile % n_tile_x) * kTILE_SIZE;
+      const int y0 = (tile / n_tile_x) * kTILE_SIZE;
+      const int x1 = std::min(x0 + kTILE_SIZE, width);
+      const int y1 = std::min(y0 + kTILE_SIZE, height);
+
+      for (int by = y0; by < y1; by += kPACKET_H) {
+        for (int bx = x0; bx < x1; bx += kPACKET_W) {
+          PixelSampler seed[kSIMD_LANES];
+          Vec color[kSIMD_LANES];
+          int lanes = 0;
+
+          for (int l = 0; l < kPACKET_W * kPACKET_H; l++) {
+            const int x = bx + l % kPACKET_W, y = by + l / kPACKET_W;
+            if (x >= x1 || y >= y1) continue;
+            lanes |= 1 << l;
+            seed[l].init(r_config.sampler, r_config.sampler_seed, x, y);
+          }
+
+          for (int i = 0; i < r_config.n_sample_frame; i++) {
+            RayPacket packet = RayPacket();
+            for (int l = 0; l < kSIMD_LANES; l++) {
+              if (!(lanes & (1 << l))) continue;
+              const int x = bx + l % kPACKET_W, y = by + l / kPACKET_W;
+              seed[l].start(uint32_t(n_frame * size_t(r_config.n_sample_frame) +
+                                     size_t(i)));
+              // position of the fragment in [0, 1], as in test.vert.
+              const real px = (real(x) + 0.5f) / real(width);
+              const real py = (real(y) + 0.5f) / real(height);
+              const real dx = seed[l].rand() / kSCREEN_W;
+              const real dy = seed[l].rand() / kSCREEN_H;
+              packet.set(l, camera_pos,
+                         normalize(c_x * (px - 0.5f + dx) * aspect_ratio +
+                                   c_y * (py - 0.5f + dy) + camera_dir));
+            }
+            intersectBVH(scene, &packet);
+
+            for (int l = 0; l < kSIMD_LANES; l++) {
+              if (!(lanes & (1 << l))) continue;
+              const Ray ray(
+                  camera_pos,
+                  Vec(packet.dir[0][l], packet.dir[1][l], packet.dir[2][l]));
+              Intersection first;
+              if (packet.tri_idx[l] != -1) {
+                setIntersection(ray, scene, size_t(packet.tri_idx[l]),
+                                packet.t[l], &first);
+              }
+              color[l] += renderRay(ray, first, scene, r_config.max_depth,
+                                    r_config.roulette, &seed[l]);
+            }
+          }
+
+          for (int l = 0; l < kSIMD_LANES; l++) {
+            if (!(lanes & (1 << l))) continue;
+            const int x = bx + l % kPACKET_W, y = by + l / kPACKET_W;
+            float* pixel =
+                &accumulator[(size_t(y) * size_t(width) + size_t(x)) * 4];
+            pixel[0] += color[l].x;
+            pixel[1] += color[l].y;
+            pixel[2] += color[l].z;
+            pixel[3] += float(r_config.n_sample_frame);
+          }
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < n_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& th : threads) {
+    th.join();
+  }
+
+  n_frame++;
+}
+
+int CpuRayTraceRenderer::start() {
+  if (bvh.nodes.empty()) return -1;
+
+  FpsCounter fps;
+  fps.init();
+
+  while (n_frame * size_t(r_config.n_sample_frame) < r_config.max_sample) {
+    renderFrame();
+
+    // log fps avarage. and compute ray/sec. the first update has no average.
+    if (-1 != fps.update() && fps.ave_fps > 0.f) {
+      size_t rps =
+          size_t(double(fps.ave_fps) * double(r_config.width) *
+                 double(r_config.height) * double(r_config.n_sample_frame));
+      std::clog << "fps : " << fps.fps << "  rps average : " << rps
+                << std::endl;
+    }
+  }
+
+  if (saveImage(r_config.output_path)) {
+    LOG_INFO("Save Image : ", r_config.output_path);
+  }
+
+  return 0;
+}
+
+bool CpuRayTraceRenderer::saveImage(const std::string& filename) const {
+  std::vector<float> pixels;
+  ImageFormat format = r_config.output_format;
+  if (format == ImageFormat::Auto) format = imageFormatFromPath(filename);
+  if (isHDRFormat(format)) {
+    radiancePixels(bright_mag, accumulator, &pixels);
+  } else {
+    toneMapPixels(bright_mag, r_config.gamma, accumulator, &pixels);
+  }
+
+  return SaveImage(filename, pixels, r_config.width, r_config.height, format);
+}
@@ -0,0 +1,65 @@
+//
+//  cpu_renderer.h
+//  NewGlslRenderer
+//
+
+#ifndef cpu_renderer_h20261017
+#define cpu_renderer_h20261017
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "light_sampler.h"
+#include "render_config.h"
+#include "simd_kernels.h"
+#include "wide_bvh.h"
+
+/**
+ Path tracer on CPU which follows test.frag step by step.
+ The image is split into tiles and traced by all cores, and the result is
+ accumulated with the same layout as the GL_RGBA32F accumulator texture
+ (sum of samples in RGB and their count in A, rows from bottom), so it can be
+ compared with GPU output directly.
+ Camera rays are traced as packets on the binary BVH, and other rays use a
+ 4 or 8 wide BVH collapsed from it. Leaves are tested with SIMD kernels.
+ **/
+class CpuRayTraceRenderer {
+public:
+  const RenderConfig r_config;
+  const int n_threads;
+  const int bvh_width;  // 2, 4 or 8
+
+private:
+  BVH bvh;
+  TriangleSoA tris;
+  WideBVH<4> wide4;
+  WideBVH<8> wide8;
+  bool use_wide = false;
+  LightSampler lights;
+  float bright_mag = 1.f;
+
+  std::vector<float> accumulator;
+  size_t n_frame = 0;
+
+public:
+  // if n_threads_ is 0, use all hardware threads.
+  CpuRayTraceRenderer(const RenderConfig& r_config_, const int& n_threads_ = 0,
+                      const int& bvh_width_ = 8);
+
+  bool setPolygons(const std::vector<Polygon>& polygons_,
+                   const BVH::Config& bvh_config = BVH::Config());
+
+  // trace n_sample_frame samples for every pixel and accumulate them.
+  void renderFrame();
+
+  // render until max_sample and save the result to output_path.
+  int start();
+
+  bool saveImage(const std::string& filename) const;
+
+  const std::vector<float>& getAccumulator() const { return accumulator; }
+  size_t getNumFrame() const { return n_frame; }
+};
+
+#endif /* cpu_renderer_h20261017 */
@@ -0,0 +1,371 @@
+//
+//  distributed.cpp
+//  NewGlslRenderer
+//
+
+#include "distributed.h"
+
+#include <poll.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+#include "logger.h"
+#include "message_socket.h"
+#include "renderer.hpp"
+#include "snapshot_writer.h"
+
+namespace {
+
+// jobs sent to a worker before it returns any.
+constexpr size_t kJOB_IN_FLIGHT = 2;
+// sample ranges of max_sample by default.
+constexpr size_t kSAMPLE_SPLIT = 16;
+// workers may start before the coordinator.
+constexpr int kCONNECT_RETRY = 100;
+constexpr std::chrono::milliseconds kCONNECT_INTERVAL(100);
+// seconds a worker may stop in the middle of a result before it is lost.
+constexpr double kRECEIVE_TIMEOUT = 30.0;
+
+enum class Message : uint32_t { Scene = 1, Job = 2, Result = 3, Quit = 4 };
+
+// followed by n_polygon polygons.
+struct SceneMessage {
+  uint32_t width, height, n_sample_frame;
+  uint32_t sampler_type, sampler_seed;
+  float camera_pos[3], camera_dir[3];
+  int32_t max_depth;
+  float roulette;
+  uint64_t n_polygon;
+};
+
+// results are followed by width * height RGBA floats of the accumulator.
+struct JobMessage {
+  uint64_t id;
+  int32_t x, y, width, height;
+  uint64_t first_sample, n_sample;
+};
+
+static_assert(std::is_trivially_copyable<Polygon>::value,
+              "polygons are sent as bytes");
+
+}  // namespace
+
+int RenderCoordinator::start() {
+  if (polygons.empty() || r_config.n_sample_frame <= 0) return -1;
+  // jobs are whole sample ranges, and the merged accumulator is saved as is.
+  if (r_config.denoise_pass > 0 || r_config.adaptive_threshold > 0.f ||
+      r_config.noise_threshold > 0.f) {
+    std::cerr << "RenderCoordinator : --denoise, --adaptive and --noise are "
+                 "ignored"
+              << std::endl;
+  }
+  const int width = r_config.width, height = r_config.height;
+
+  // whole frames, as a local render.
+  const size_t n_sample_frame = size_t(r_config.n_sample_frame);
+  auto round_up = [&](const size_t& n) {
+    return (n + n_sample_frame - 1) / n_sample_frame * n_sample_frame;
+  };
+  const size_t n_sample = round_up(r_config.max_sample);
+  const size_t job_sample = std::max(
+      n_sample_frame, round_up(d_config.job_sample > 0
+                                   ? d_config.job_sample
+                                   : n_sample / kSAMPLE_SPLIT));
+  const int tile = d_config.job_tile > 0 ? d_config.job_tile
+                                         : std::max(width, height);
+
+  // sample ranges are outermost, so early jobs cover the whole image.
+  std::deque<JobMessage> queue;
+  for (size_t s = 0; s < n_sample; s += job_sample) {
+    for (int y = 0; y < height; y += tile) {
+      for (int x = 0; x < width; x += tile) {
+        JobMessage job;
+        job.id = queue.size();
+        job.x = x;
+        job.y = y;
+        job.width = std::min(tile, width - x);
+        job.height = std::min(tile, height - y);
+        job.first_sample = s;
+        job.n_sample = std::min(job_sample, n_sample - s);
+        queue.push_back(job);
+      }
+    }
+  }
+  const size_t n_job = queue.size();
+  // results of larger payloads are rejected before they are allocated.
+  uint64_t max_result = 0;
+  for (const JobMessage& job : queue) {
+    max_result = std::max<uint64_t>(
+        max_result, sizeof(JobMessage) + uint64_t(job.width) *
+                                             uint64_t(job.height) * 4 *
+                                             sizeof(float));
+  }
+
+  SceneMessage scene = SceneMessage();
+  scene.width = uint32_t(width);
+  scene.height = uint32_t(height);
+  scene.n_sample_frame = uint32_t(r_config.n_sample_frame);
+  scene.sampler_type = uint32_t(r_config.sampler);
+  scene.sampler_seed = r_config.sampler_seed;
+  const Vec pos = r_config.camera_pos, dir = r_config.camera_dir;
+  const float camera[6] = {pos.x, pos.y, pos.z, dir.x, dir.y, dir.z};
+  std::copy(camera, camera + 3, scene.camera_pos);
+  std::copy(camera + 3, camera + 6, scene.camera_dir);
+  scene.max_depth = r_config.max_depth;
+  scene.roulette = r_config.roulette;
+  scene.n_polygon = polygons.size();
+
+  MessageListener listener;
+  if (!listener.listen(d_config.address)) {
+    std::cerr << "RenderCoordinator : can't listen on " << d_config.address
+              << std::endl;
+    return -1;
+  }
+  LOG_INFO("Coordinator listens on ", d_config.address, " for ", n_job,
+           " jobs");
+
+  struct Worker {
+    MessageSocket socket;
+    size_t id;
+    std::vector<JobMessage> jobs;  // sent and not returned
+  };
+  std::vector<Worker> workers;
+  size_t n_joined = 0;
+
+  // sums and counts of samples of all merged jobs.
+  std::vector<float> accumulator(size_t(width) * size_t(height) * 4, 0.f);
+  size_t n_merged = 0;
+  auto merge = [&](const JobMessage& job, const float* pixels) {
+    for (int r = 0; r < job.height; r++) {
+      float* dst = &accumulator[(size_t(job.y + r) * size_t(width) +
+                                 size_t(job.x)) * 4];
+      const float* src = pixels + size_t(r) * size_t(job.width) * 4;
+      for (size_t i = 0; i < size_t(job.width) * 4; i++) dst[i] += src[i];
+    }
+    n_merged++;
+  };
+
+  auto hand_out = [&](Worker& worker) {
+    while (worker.jobs.size() < kJOB_IN_FLIGHT && !queue.empty()) {
+      const JobMessage job = queue.front();
+      if (!worker.socket.send(uint32_t(Message::Job), &job, sizeof(job))) {
+        return false;
+      }
+      queue.pop_front();
+      worker.jobs.push_back(job);
+    }
+    return true;
+  };
+  // jobs of a lost worker are handed out first.
+  auto lose = [&](Worker& worker) {
+    LOG_INFO("Worker ", worker.id, " is lost, ", worker.jobs.size(),
+             " jobs are handed out again");
+    queue.insert(queue.begin(), worker.jobs.begin(), worker.jobs.end());
+    worker.jobs.clear();
+    worker.socket.close();
+  };
+  // a result of a job in flight of the worker.
+  auto receive = [&](Worker& worker) {
+    uint32_t type;
+    std::vector<char> payload;
+    if (!worker.socket.receive(&type, &payload, max_result) ||
+        type != uint32_t(Message::Result) ||
+        payload.size() < sizeof(JobMessage)) {
+      return false;
+    }
+    JobMessage result;
+    std::memcpy(&result, payload.data(), sizeof(result));
+    auto it = std::find_if(
+        worker.jobs.begin(), worker.jobs.end(),
+        [&](const JobMessage& job) { return job.id == result.id; });
+    if (it == worker.jobs.end() ||
+        payload.size() != sizeof(JobMessage) + size_t(it->width) *
+                                                   size_t(it->height) * 4 *
+                                                   sizeof(float)) {
+      return false;
+    }
+    std::vector<float> pixels(size_t(it->width) * size_t(it->height) * 4);
+    std::memcpy(pixels.data(), payload.data() + sizeof(JobMessage),
+                pixels.size() * sizeof(float));
+    merge(*it, pixels.data());
+    worker.jobs.erase(it);
+    DEBUG_LOG("Merged ", n_merged, " / ", n_job, " jobs, last by worker ",
+              worker.id);
+    return true;
+  };
+
+  const auto start_time = std::chrono::steady_clock::now();
+  while (n_merged < n_job) {
+    std::vector<pollfd> fds(workers.size() + 1);
+    fds[0].fd = listener.handle();
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < workers.size(); i++) {
+      fds[i + 1].fd = workers[i].socket.handle();
+      fds[i + 1].events = POLLIN;
+    }
+    if (poll(fds.data(), nfds_t(fds.size()), -1) < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "RenderCoordinator : poll failed" << std::endl;
+      return -1;
+    }
+
+    // a failure of a worker loses only the worker.
+    for (size_t i = 0; i < workers.size(); i++) {
+      if (fds[i + 1].revents == 0) continue;
+      bool received = false;
+      try {
+        received = receive(workers[i]);
+      } catch (const std::exception& e) {
+        LOG_INFO("Result of worker ", workers[i].id, " failed : ", e.what());
+      }
+      if (!received) lose(workers[i]);
+    }
+    if (fds[0].revents & POLLIN) {
+      Worker worker;
+      if (listener.accept(&worker.socket) &&
+          worker.socket.setReceiveTimeout(kRECEIVE_TIMEOUT)) {
+        worker.id = n_joined++;
+        if (worker.socket.send(uint32_t(Message::Scene), &scene,
+                               sizeof(scene), polygons.data(),
+                               polygons.size() * sizeof(Polygon))) {
+          LOG_INFO("Worker ", worker.id, " joins");
+          workers.push_back(std::move(worker));
+        }
+      }
+    }
+
+    // until no more worker is lost, as their jobs go to the others.
+    bool lost = true;
+    while (lost) {
+      lost = false;
+      for (auto& worker : workers) {
+        if (worker.socket.isOpen() && !hand_out(worker)) {
+          lose(worker);
+          lost = true;
+        }
+      }
+    }
+    workers.erase(std::remove_if(workers.begin(), workers.end(),
+                                 [](const Worker& worker) {
+                                   return !worker.socket.isOpen();
+                                 }),
+                  workers.end());
+  }
+
+  for (auto& worker : workers) {
+    worker.socket.send(uint32_t(Message::Quit), nullptr, 0);
+  }
+  listener.close();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start_time;
+  LOG_INFO("Rendered ", n_sample, " samples in ", elapsed.count(), " sec by ",
+           n_joined, " workers");
+
+  // the same brightness as the renderers of workers.
+  std::vector<Polygon> normalized = polygons;
+  SnapshotWriter snapshot_writer(computeBrightMagnification(&normalized),
+                                 r_config.gamma);
+  Snapshot snapshot;
+  snapshot.pixels = std::move(accumulator);
+  snapshot.width = width;
+  snapshot.height = height;
+  snapshot.filename = r_config.output_path;
+  snapshot.format = r_config.output_format;
+  snapshot_writer.push(std::move(snapshot));
+  snapshot_writer.wait();
+  return snapshot_writer.numFailed() == 0 ? 0 : -1;
+}
+
+int RenderWorker::start(const std::string& address) {
+  MessageSocket socket;
+  for (int i = 0; !socket.connect(address); i++) {
+    if (i + 1 >= kCONNECT_RETRY) {
+      std::cerr << "RenderWorker : can't connect to " << address << std::endl;
+      return -1;
+    }
+    std::this_thread::sleep_for(kCONNECT_INTERVAL);
+  }
+
+  std::unique_ptr<GlslRayTraceRenderer> renderer;
+  std::vector<float> pixels;
+  uint32_t type;
+  std::vector<char> payload;
+  while (socket.receive(&type, &payload)) {
+    if (type == uint32_t(Message::Quit)) return 0;
+
+    if (type == uint32_t(Message::Scene)) {
+      SceneMessage scene;
+      if (payload.size() < sizeof(scene)) break;
+      std::memcpy(&scene, payload.data(), sizeof(scene));
+      if (payload.size() != sizeof(scene) + scene.n_polygon * sizeof(Polygon)) {
+        break;
+      }
+      std::vector<Polygon> polygons(size_t(scene.n_polygon),
+                                    Polygon(Vec(), Vec(), Vec(), Vec()));
+      std::memcpy(polygons.data(), payload.data() + sizeof(scene),
+                  polygons.size() * sizeof(Polygon));
+
+      RenderConfig config = r_config;
+      config.display = false;
+      config.headless = true;
+      config.width = int(scene.width);
+      config.height = int(scene.height);
+      config.n_sample_frame = int(scene.n_sample_frame);
+      config.sampler = SamplerType(scene.sampler_type);
+      config.sampler_seed = scene.sampler_seed;
+      config.camera_pos = Vec(scene.camera_pos[0], scene.camera_pos[1],
+                              scene.camera_pos[2]);
+      config.camera_dir = Vec(scene.camera_dir[0], scene.camera_dir[1],
+                              scene.camera_dir[2]);
+      config.max_depth = scene.max_depth;
+      config.roulette = scene.roulette;
+      config.checkpoint_path.clear();
+
+      // one GL context at a time.
+      renderer.reset();
+      WindowConfig window;
+      window.title = "worker";
+      window.is_retina = false;
+      renderer.reset(new GlslRayTraceRenderer(config, window));
+      if (!renderer->setPolygons(polygons)) return -1;
+      LOG_INFO("Worker got the scene of ", polygons.size(), " polygons");
+      continue;
+    }
+
+    if (type != uint32_t(Message::Job) || renderer == nullptr ||
+        payload.size() != sizeof(JobMessage)) {
+      break;
+    }
+    JobMessage job;
+    std::memcpy(&job, payload.data(), sizeof(job));
+    GlslRayTraceRenderer::Job rect;
+    rect.x = job.x;
+    rect.y = job.y;
+    rect.width = job.width;
+    rect.height = job.height;
+    rect.first_sample = size_t(job.first_sample);
+    rect.n_sample = size_t(job.n_sample);
+    if (!renderer->renderJob(rect, &pixels)) {
+      std::cerr << "RenderWorker : job " << job.id << " failed" << std::endl;
+      return -1;
+    }
+    DEBUG_LOG("Job ", job.id, " : ", job.n_sample, " samples from ",
+              job.first_sample, " of ", job.width, "x", job.height, " at (",
+              job.x, ", ", job.y, ")");
+    if (!socket.send(uint32_t(Message::Result), &job, sizeof(job),
+                     pixels.data(), pixels.size() * sizeof(float))) {
+      break;
+    }
+  }
+  std::cerr << "RenderWorker : connection to " << address
+            << " is closed or broken" << std::endl;
+  return -1;
+}
@@ -0,0 +1,76 @@
+//
+//  distributed.h
+//  NewGlslRenderer
+//
+
+#ifndef distributed_h20261017
+#define distributed_h20261017
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "render_config.h"
+
+struct DistributedConfig {
+  // "host:port" or "unix:<path>" where the coordinator listens.
+  std::string address;
+  // samples of a job, rounded up to whole frames. 0 splits max_sample into
+  // about 16 ranges.
+  size_t job_sample = 0;
+  // side of the square pixel rects of jobs. 0 renders whole images.
+  int job_tile = 0;
+};
+
+/**
+ Render with worker processes on this or other hosts. The coordinator splits
+ the image into tiles and max_sample into sample ranges, and hands the jobs
+ out to workers as they connect and finish, two at a time per worker so
+ they never wait for the next one. Workers send back the raw accumulator of
+ each job, sums of samples with their counts, which are merged by adding
+ both, so each pixel is the mean of all its samples whichever workers took
+ them. Samples are indexed as in a single renderer, so the merged image is
+ the same as a local render of max_sample without denoising or adaptive
+ sampling, which the coordinator doesn't do. Jobs of a lost worker are
+ handed out again. The coordinator needs no OpenGL.
+ **/
+class RenderCoordinator {
+public:
+  const RenderConfig r_config;
+  const DistributedConfig d_config;
+
+private:
+  std::vector<Polygon> polygons;
+
+public:
+  RenderCoordinator(const RenderConfig& r_config_,
+                    const DistributedConfig& d_config_)
+      : r_config(r_config_), d_config(d_config_) {}
+
+  void setPolygons(const std::vector<Polygon>& polygons_) {
+    polygons = polygons_;
+  }
+
+  // render max_sample and save output_path. 0 on success.
+  int start();
+};
+
+/**
+ Worker of RenderCoordinator. It receives the scene and the settings of the
+ coordinator, renders jobs by the headless GlslRayTraceRenderer and sends
+ back their accumulators, until the coordinator quits.
+ **/
+class RenderWorker {
+public:
+  // dispatch_time and scene_cache_dir are of this worker, others are sent
+  // by the coordinator.
+  const RenderConfig r_config;
+
+  explicit RenderWorker(const RenderConfig& r_config_)
+      : r_config(r_config_) {}
+
+  // 0 if the coordinator at address quits normally.
+  int start(const std::string& address);
+};
+
+#endif /* distributed_h20261017 */
@@ -19,6 +19,8 @@ public:
   ~FpsCounter() {}
   void init() {
     last_time = std::chrono::system_clock::now();
+    fps = 0;
+    ave_fps = 0.f;  // until the second update which returns fps
     frame_cnt = 0;
     call_cnt = 0;
     sum_fps = 0;
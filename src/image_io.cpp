@@ -0,0 +1,135 @@
+//
+//  image_io.cpp
+//  NewGlslRenderer
+//
+
+#include "image_io.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+#include "logger.h"
+#include "thread_pool.h"
+
+namespace {
+
+// rows per task of encoding.
+constexpr size_t kENCODE_ROWS = 64;
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+  if (str.size() < suffix.size()) return false;
+  return std::equal(suffix.rbegin(), suffix.rend(), str.rbegin(),
+                    [](const char& a, const char& b) {
+                      return std::tolower(a) == std::tolower(b);
+                    });
+}
+
+bool isLittleEndian() {
+  const uint16_t one = 1;
+  uint8_t byte;
+  std::memcpy(&byte, &one, 1);
+  return byte == 1;
+}
+
+std::string makeHeader(const ImageFormat& format, const int& width,
+                       const int& height) {
+  const std::string size =
+      std::to_string(width) + " " + std::to_string(height) + "\n";
+  switch (format) {
+    case ImageFormat::PPM16:
+      return "P6\n" + size + "65535\n";
+    case ImageFormat::PFM:
+      // negative scale means little endian.
+      return "PF\n" + size + (isLittleEndian() ? "-1.0\n" : "1.0\n");
+    default:
+      return "P6\n" + size + "255\n";
+  }
+}
+
+size_t bytesPerChannel(const ImageFormat& format) {
+  switch (format) {
+    case ImageFormat::PPM16:
+      return 2;
+    case ImageFormat::PFM:
+      return 4;
+    default:
+      return 1;
+  }
+}
+
+// encode src row to dst row.
+void encodeRow(const ImageFormat& format, const float* src, const size_t& n,
+               uint8_t* dst) {
+  switch (format) {
+    case ImageFormat::PPM16:
+      for (size_t i = 0; i < n; i++) {
+        const float v = std::max(0.f, std::min(1.f, src[i]));
+        const uint16_t q = uint16_t(v * 65535.f + 0.5f);
+        dst[i * 2 + 0] = uint8_t(q >> 8);  // big endian
+        dst[i * 2 + 1] = uint8_t(q & 0xFF);
+      }
+      break;
+    case ImageFormat::PFM:
+      std::memcpy(dst, src, n * sizeof(float));
+      break;
+    default:
+      for (size_t i = 0; i < n; i++) {
+        const float v = std::max(0.f, std::min(1.f, src[i]));
+        dst[i] = uint8_t(v * 255.f + 0.5f);
+      }
+      break;
+  }
+}
+
+}  // namespace
+
+ImageFormat imageFormatFromPath(const std::string& filename) {
+  if (endsWith(filename, ".pfm")) return ImageFormat::PFM;
+  return ImageFormat::PPM8;
+}
+
+bool SaveImage(const std::string& filename, const std::vector<float>& pixels,
+               const int& width, const int& height, ImageFormat format) {
+  if (format == ImageFormat::Auto) format = imageFormatFromPath(filename);
+
+  const size_t row_len = size_t(width) * 3;
+  const size_t n_row = size_t(height);
+  if (pixels.size() < row_len * n_row) {
+    LOG_INFO("too few pixels to save : ", filename);
+    return false;
+  }
+
+  const std::string header = makeHeader(format, width, height);
+  const size_t row_bytes = row_len * bytesPerChannel(format);
+  std::vector<uint8_t> buffer(header.size() + row_bytes * n_row);
+  std::memcpy(buffer.data(), header.data(), header.size());
+  uint8_t* data = buffer.data() + header.size();
+
+  // PFM is stored from bottom to top like OpenGL, PPM from top to bottom.
+  const bool flip = format != ImageFormat::PFM;
+  const size_t n_chunk = std::max<size_t>(1, n_row / kENCODE_ROWS);
+  parallelFor(0, n_row, n_chunk, [&](size_t s, size_t e, size_t) {
+    for (size_t y = s; y < e; y++) {
+      const size_t dst_y = flip ? n_row - 1 - y : y;
+      encodeRow(format, &pixels[y * row_len], row_len,
+                data + dst_y * row_bytes);
+    }
+  });
+
+  std::ofstream file(filename, std::ios::binary);
+  if (!file) {
+    LOG_INFO("failed to open a file : ", filename);
+    return false;
+  }
+  file.write(reinterpret_cast<const char*>(buffer.data()),
+             std::streamsize(buffer.size()));
+  if (!file) {
+    LOG_INFO("failed to write a file : ", filename);
+    return false;
+  }
+
+  return true;
+}
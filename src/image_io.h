@@ -0,0 +1,48 @@
+//
+//  image_io.h
+//  NewGlslRenderer
+//
+
+#ifndef image_io_h20261017
+#define image_io_h20261017
+
+#include <string>
+#include <vector>
+
+enum class ImageFormat {
+  Auto,   // decided by extension of file name, ".pfm" or else PPM8
+  PPM8,   // binary P6, 8 bit per channel
+  PPM16,  // binary P6, 16 bit per channel
+  PFM,    // linear 32 bit float, for HDR compositing
+};
+
+ImageFormat imageFormatFromPath(const std::string& filename);
+
+// PFM keeps radiance, so it is saved without tone mapping.
+inline bool isHDRFormat(const ImageFormat& format) {
+  return format == ImageFormat::PFM;
+}
+
+/**
+ Save RGB pixels (3 floats per pixel) in the row order of OpenGL, that is
+ the first row is the bottom of the image.
+ LDR formats clamp values to [0, 1]. Pixels are encoded in bulk to one buffer
+ and written by one call.
+ **/
+bool SaveImage(const std::string& filename, const std::vector<float>& pixels,
+               const int& width, const int& height,
+               ImageFormat format = ImageFormat::Auto);
+
+inline bool SaveImageAsPPM(const std::string& filename,
+                           const std::vector<float>& pixels, const int& width,
+                           const int& height) {
+  return SaveImage(filename, pixels, width, height, ImageFormat::PPM8);
+}
+
+inline bool SaveImageAsPFM(const std::string& filename,
+                           const std::vector<float>& pixels, const int& width,
+                           const int& height) {
+  return SaveImage(filename, pixels, width, height, ImageFormat::PFM);
+}
+
+#endif /* image_io_h20261017 */
@@ -0,0 +1,74 @@
+//
+//  light_sampler.cpp
+//  NewGlslRenderer
+//
+
+#include "light_sampler.h"
+
+#include <algorithm>
+
+#include "logger.h"
+
+bool LightSampler::init(const std::vector<Polygon>& polygons) {
+  entries.clear();
+  total_power = 0.f;
+
+  std::vector<double> weight;
+  double sum = 0.0;
+  for (size_t i = 0; i < polygons.size(); i++) {
+    if (polygons[i].material != Material::Light) continue;
+    const double w = double(power(polygons[i].col)) * area(polygons[i]);
+    if (w <= 0.0) continue;
+    entries.push_back({int32_t(i), int32_t(i), 1.f, 0});
+    weight.emplace_back(w);
+    sum += w;
+  }
+  if (entries.empty()) return false;
+  total_power = float(sum);
+
+  // Vose's method : scaled weights under 1 are filled by ones over 1.
+  const size_t n = entries.size();
+  std::vector<size_t> small, large;
+  for (size_t k = 0; k < n; k++) {
+    weight[k] *= double(n) / sum;
+    (weight[k] < 1.0 ? small : large).emplace_back(k);
+  }
+  while (!small.empty() && !large.empty()) {
+    const size_t s = small.back(), l = large.back();
+    small.pop_back();
+    entries[s].threshold = float(weight[s]);
+    entries[s].alias_idx = entries[l].tri_idx;
+    weight[l] -= 1.0 - weight[s];
+    if (weight[l] < 1.0) {
+      large.pop_back();
+      small.emplace_back(l);
+    }
+  }
+  // the rest is 1 up to rounding errors.
+  for (const size_t& k : small) entries[k].threshold = 1.f;
+  for (const size_t& k : large) entries[k].threshold = 1.f;
+
+  DEBUG_LOG("LightSampler : ", n, " emitters, power ", total_power);
+  return true;
+}
+
+size_t LightSampler::sample(const real& u1, const real& u2) const {
+  const size_t k = std::min(size_t(u1 * real(entries.size())),
+                            entries.size() - 1);
+  const Entry& entry = entries[k];
+  return size_t(u2 < entry.threshold ? entry.tri_idx : entry.alias_idx);
+}
+
+real LightSampler::pdfArea(const Polygon& pol) const {
+  if (total_power <= 0.f || pol.material != Material::Light) return 0;
+  return power(pol.col) / total_power;
+}
+
+real LightSampler::power(const color& col) {
+  return std::max(real(0), 0.2126f * col.x + 0.7152f * col.y + 0.0722f * col.z);
+}
+
+real LightSampler::area(const Polygon& pol) {
+  return 0.5f * cross(pol.vert[1] - pol.vert[0], pol.vert[2] - pol.vert[0])
+                    .length();
+}
@@ -0,0 +1,48 @@
+//
+//  light_sampler.h
+//  NewGlslRenderer
+//
+
+#ifndef light_sampler_h20261017
+#define light_sampler_h20261017
+
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+/**
+ Emitters (Material::Light) for next event estimation, chosen in
+ proportion to power x area by Walker's alias method.
+ Power of a triangle is the luminance of its color, so a point sampled
+ uniformly on the chosen triangle has the area density
+ power(col) / total_power, whichever triangle it is on.
+ **/
+class LightSampler {
+public:
+  // uploaded as one RGBA32I texel, threshold is read by intBitsToFloat.
+  struct Entry {
+    int32_t tri_idx;    // index of polygons
+    int32_t alias_idx;  // index of polygons taken if u >= threshold
+    float threshold;
+    int32_t pad;
+  };
+
+  std::vector<Entry> entries;
+  float total_power = 0.f;  // sum of power x area
+
+public:
+  // build the table of polygons. returns false if there is no emitter.
+  bool init(const std::vector<Polygon>& polygons);
+
+  // index of a polygon for u1, u2 in [0, 1).
+  size_t sample(const real& u1, const real& u2) const;
+
+  // pdf per unit area of a point on pol. 0 if it is never sampled.
+  real pdfArea(const Polygon& pol) const;
+
+  static real power(const color& col);
+  static real area(const Polygon& pol);
+};
+
+#endif /* light_sampler_h20261017 */
@@ -0,0 +1,81 @@
+//
+//  lru_cache.h
+//  NewGlslRenderer
+//
+
+#ifndef lru_cache_h20261017
+#define lru_cache_h20261017
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+/**
+ Values by key up to a total cost, like bytes of memory. Adding a value
+ evicts the least recently used ones until the total fits, except the
+ added one, which is kept even if it costs more than the capacity alone.
+ Values are destroyed on eviction, so shared values should be shared_ptr.
+ **/
+template <class Key, class Value>
+class LruCache {
+private:
+  struct Entry {
+    Key key;
+    Value value;
+    size_t cost;
+  };
+
+  const size_t capacity;
+  size_t total = 0;
+  // most recently used first.
+  std::list<Entry> entries;
+  std::unordered_map<Key, typename std::list<Entry>::iterator> index;
+
+public:
+  explicit LruCache(const size_t& capacity_) : capacity(capacity_) {}
+
+  // nullptr if key is missing, else marks it as the most recently used.
+  Value* get(const Key& key) {
+    auto it = index.find(key);
+    if (it == index.end()) return nullptr;
+    entries.splice(entries.begin(), entries, it->second);
+    return &it->second->value;
+  }
+
+  // replaces the value of the same key. returns the number of evicted ones.
+  size_t put(const Key& key, Value value, const size_t& cost) {
+    erase(key);
+    entries.push_front(Entry{key, std::move(value), cost});
+    index[key] = entries.begin();
+    total += cost;
+
+    size_t n_evicted = 0;
+    while (total > capacity && entries.size() > 1) {
+      total -= entries.back().cost;
+      index.erase(entries.back().key);
+      entries.pop_back();
+      n_evicted++;
+    }
+    return n_evicted;
+  }
+
+  void erase(const Key& key) {
+    auto it = index.find(key);
+    if (it == index.end()) return;
+    total -= it->second->cost;
+    entries.erase(it->second);
+    index.erase(it);
+  }
+
+  void clear() {
+    entries.clear();
+    index.clear();
+    total = 0;
+  }
+
+  size_t size() const { return entries.size(); }
+  size_t cost() const { return total; }
+};
+
+#endif /* lru_cache_h20261017 */
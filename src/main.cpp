@@ -6,10 +6,16 @@
 //  Copyright © 2018年 Skatto. All rights reserved.
 //
 
+#include <cstdio>
 #include <iostream>
+#include <string>
+#include "cpu_renderer.h"
+#include "distributed.h"
+#include "mesh_loader.h"
+#include "render_server.h"
 #include "renderer.hpp"
 
-int main() {
+int main(int argc, char** argv) {
   std::vector<Polygon> polygons{
       Polygon(Vec(-8.f, -3.f, 3.f), Vec(8.f, -3.f, 3.f), Vec(-8.f, 3.f, 3.f),
               WHITE),
@@ -58,11 +64,152 @@ int main() {
   render.n_sample_frame = 10;
   render.max_sample = 1e10;
 
+  // "--mesh <file>" renders OBJ or PLY instead of the room above.
+  // "--cache <dir>" saves and reuses BVH and textures of the scene, and
+  //   linked shader programs.
+  // "--sampler <pcg|sobol|bluenoise>" selects random numbers (sobol).
+  // "--dispatch <ms>" sets GPU time per draw, 0 draws whole frames (8).
+  // "--adaptive <error>" stops sampling pixels under the relative error.
+  // "--noise <error>" stops rendering at the mean relative error.
+  // "--denoise <passes>" filters display and output by a-trous passes (0).
+  // "--camera <x,y,z,dx,dy,dz>" sets the position and the direction.
+  // "--depth <bounces>" sets the max bounces of paths (5).
+  // other options follow them.
+  while (argc > 2) {
+    const std::string option = argv[1];
+    if (option == "--mesh") {
+      std::vector<Polygon> mesh;
+      if (!LoadMesh(argv[2], &mesh)) {
+        return 1;
+      }
+      polygons.swap(mesh);
+    } else if (option == "--cache") {
+      render.scene_cache_dir = argv[2];
+      render.program_cache_dir = argv[2];
+    } else if (option == "--sampler") {
+      const std::string name = argv[2];
+      if (name == "pcg") {
+        render.sampler = SamplerType::PCG;
+      } else if (name == "sobol") {
+        render.sampler = SamplerType::Sobol;
+      } else if (name == "bluenoise") {
+        render.sampler = SamplerType::BlueNoise;
+      } else {
+        std::cerr << "unknown sampler : " << name << std::endl;
+        return 1;
+      }
+    } else if (option == "--dispatch") {
+      render.dispatch_time = std::stod(argv[2]);
+    } else if (option == "--adaptive") {
+      render.adaptive_threshold = std::stof(argv[2]);
+    } else if (option == "--noise") {
+      render.noise_threshold = std::stof(argv[2]);
+    } else if (option == "--denoise") {
+      render.denoise_pass = std::stoi(argv[2]);
+    } else if (option == "--camera") {
+      float v[6];
+      if (sscanf(argv[2], "%f,%f,%f,%f,%f,%f", &v[0], &v[1], &v[2], &v[3],
+                 &v[4], &v[5]) != 6) {
+        std::cerr << "camera must be x,y,z,dx,dy,dz : " << argv[2]
+                  << std::endl;
+        return 1;
+      }
+      render.camera_pos = Vec(v[0], v[1], v[2]);
+      render.camera_dir = Vec(v[3], v[4], v[5]);
+    } else if (option == "--depth") {
+      render.max_depth = std::stoi(argv[2]);
+    } else {
+      break;
+    }
+    argv[2] = argv[0];
+    argv += 2;
+    argc -= 2;
+  }
+
+  // "--cpu [max_sample]" traces on all cores without OpenGL.
+  if (argc > 1 && std::string(argv[1]) == "--cpu") {
+    render.display = false;
+    render.max_sample = argc > 2 ? size_t(std::stoul(argv[2])) : 100;
+
+    CpuRayTraceRenderer cpu_renderer(render);
+    cpu_renderer.setPolygons(polygons);
+    return cpu_renderer.start();
+  }
+
+  // "--worker <address>" renders jobs of the coordinator at address, which
+  // is "host:port" or "unix:<path>", until it quits.
+  if (argc > 2 && std::string(argv[1]) == "--worker") {
+    render.display = false;
+    render.headless = true;
+    RenderWorker worker(render);
+    return worker.start(argv[2]);
+  }
+
+  // "--coordinator <address> [max_sample] [output] [job_sample] [job_tile]"
+  // hands out jobs to workers connecting to address, merges their
+  // accumulators and saves the image. no OpenGL is needed.
+  if (argc > 2 && std::string(argv[1]) == "--coordinator") {
+    DistributedConfig distributed;
+    distributed.address = argv[2];
+    render.display = false;
+    render.max_sample = argc > 3 ? size_t(std::stoul(argv[3])) : 1000;
+    if (argc > 4) render.output_path = argv[4];
+    if (argc > 5) distributed.job_sample = size_t(std::stoul(argv[5]));
+    if (argc > 6) distributed.job_tile = std::stoi(argv[6]);
+
+    RenderCoordinator coordinator(render, distributed);
+    coordinator.setPolygons(polygons);
+    return coordinator.start();
+  }
+
+  // "--server <address> [cache_mb]" renders jobs of clients, keeping the
+  // program and scenes on the GPU. it serves until killed.
+  if (argc > 2 && std::string(argv[1]) == "--server") {
+    ServerConfig server;
+    server.address = argv[2];
+    if (argc > 3) server.scene_cache_bytes = size_t(std::stoul(argv[3])) << 20;
+    render.display = false;
+    render.headless = true;
+    RenderServer render_server(render, server);
+    render_server.setPolygons(polygons);
+    return render_server.start();
+  }
+
+  // "--submit <address> <scene> <output> [max_sample] [width] [height]"
+  // renders by the server at address and waits. scene "-" is the scene of
+  // the server.
+  if (argc > 4 && std::string(argv[1]) == "--submit") {
+    ServerJob job;
+    job.scene = std::string(argv[3]) == "-" ? "" : argv[3];
+    job.output_path = argv[4];
+    job.max_sample = argc > 5 ? size_t(std::stoul(argv[5])) : 100;
+    job.width = argc > 6 ? std::stoi(argv[6]) : render.width;
+    job.height = argc > 7 ? std::stoi(argv[7]) : render.height;
+    job.camera_pos = render.camera_pos;
+    job.camera_dir = render.camera_dir;
+    return submitJob(argv[2], job) == 0 ? 0 : 1;
+  }
+
+  // "--headless [max_sample] [time_budget] [output] [checkpoint]" renders
+  // with EGL context without display server, saves the image and exits.
+  // with checkpoint, it resumes and saves the checkpoint every minute.
+  if (argc > 1 && std::string(argv[1]) == "--headless") {
+    render.display = false;
+    render.headless = true;
+    render.max_sample = argc > 2 ? size_t(std::stoul(argv[2])) : 1000;
+    render.time_budget = argc > 3 ? std::stod(argv[3]) : 0.0;
+    if (argc > 4) render.output_path = argv[4];
+    if (argc > 5) {
+      render.checkpoint_path = argv[5];
+      render.checkpoint_interval = 60.0;
+    }
+  }
+
+  // in the window, arrow keys and page up / down move the camera, dragging
+  // turns it, W saves the image and Esc quits.
   GlslRayTraceRenderer renderer(render, window);
 
   renderer.setPolygons(polygons);
 
-  renderer.start();
-
-  return 0;
+  return renderer.start();
 }
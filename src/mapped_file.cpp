@@ -0,0 +1,41 @@
+//
+//  mapped_file.cpp
+//  NewGlslRenderer
+//
+
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool MappedFile::open(const std::string& filename) {
+  close();
+
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+  void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return false;
+
+  // files are parsed from the head to the tail once.
+  madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+  mapped = p;
+  size_ = size_t(st.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if (mapped != nullptr) {
+    munmap(mapped, size_);
+    mapped = nullptr;
+    size_ = 0;
+  }
+}
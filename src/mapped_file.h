@@ -0,0 +1,33 @@
+//
+//  mapped_file.h
+//  NewGlslRenderer
+//
+
+#ifndef mapped_file_h20261017
+#define mapped_file_h20261017
+
+#include <cstddef>
+#include <string>
+
+/** Read only memory map of a whole file. **/
+class MappedFile {
+private:
+  void* mapped = nullptr;
+  size_t size_ = 0;
+
+public:
+  MappedFile() {}
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const std::string& filename);
+  void close();
+
+  bool isOpen() const { return mapped != nullptr; }
+  const char* data() const { return static_cast<const char*>(mapped); }
+  size_t size() const { return size_; }
+};
+
+#endif /* mapped_file_h20261017 */
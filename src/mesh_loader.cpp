@@ -0,0 +1,711 @@
+//
+//  mesh_loader.cpp
+//  NewGlslRenderer
+//
+
+#include "mesh_loader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+#include "logger.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+namespace {
+
+// bytes of text or binary records parsed by a task.
+constexpr size_t kPARSE_CHUNK = 1 << 22;
+
+constexpr Polygon kEMPTY_POLYGON(Vec(0), Vec(0), Vec(0), BLACK);
+
+bool endsWith(const std::string& str, const std::string& suffix) {
+  if (str.size() < suffix.size()) return false;
+  return std::equal(suffix.rbegin(), suffix.rend(), str.rbegin(),
+                    [](const char& a, const char& b) {
+                      return std::tolower(a) == std::tolower(b);
+                    });
+}
+
+std::string directoryOf(const std::string& filename) {
+  const size_t slash = filename.find_last_of('/');
+  return slash == std::string::npos ? "" : filename.substr(0, slash + 1);
+}
+
+// ---- text ----
+
+bool isBlank(const char& c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+void skipBlank(const char** p, const char* end) {
+  while (*p < end && isBlank(**p)) (*p)++;
+}
+
+const char* findLineEnd(const char* p, const char* end) {
+  if (p >= end) return end;
+  const void* nl = std::memchr(p, '\n', size_t(end - p));
+  return nl == nullptr ? end : static_cast<const char*>(nl);
+}
+
+// word until blank or end of line.
+std::string readWord(const char** p, const char* end) {
+  skipBlank(p, end);
+  const char* s = *p;
+  while (*p < end && !isBlank(**p) && **p != '\n') (*p)++;
+  return std::string(s, *p);
+}
+
+// rest of line without blanks at both ends.
+std::string readRest(const char** p, const char* end) {
+  skipBlank(p, end);
+  const char* s = *p;
+  const char* e = findLineEnd(s, end);
+  *p = e;
+  while (e > s && isBlank(e[-1])) e--;
+  return std::string(s, e);
+}
+
+bool parseInt(const char** p, const char* end, int64_t* value) {
+  skipBlank(p, end);
+  const char* s = *p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+  if (s >= end || *s < '0' || *s > '9') return false;
+  int64_t v = 0;
+  while (s < end && *s >= '0' && *s <= '9') v = v * 10 + (*s++ - '0');
+  *value = negative ? -v : v;
+  *p = s;
+  return true;
+}
+
+// decimal float without locale, about 3x faster than strtof.
+bool parseReal(const char** p, const char* end, real* value) {
+  static const double kPOW10[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+  skipBlank(p, end);
+  const char* s = *p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) negative = *s++ == '-';
+
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int n_digit = 0;
+  const char* digits = s;
+  for (; s < end && *s >= '0' && *s <= '9'; s++) {
+    if (n_digit < 19) {
+      mantissa = mantissa * 10 + uint64_t(*s - '0');
+      if (mantissa != 0) n_digit++;
+    } else {
+      exponent++;
+    }
+  }
+  if (s < end && *s == '.') {
+    for (s++; s < end && *s >= '0' && *s <= '9'; s++) {
+      if (n_digit < 19) {
+        mantissa = mantissa * 10 + uint64_t(*s - '0');
+        if (mantissa != 0) n_digit++;
+        exponent--;
+      }
+    }
+  }
+  if (s == digits || (s == digits + 1 && *digits == '.')) return false;
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    int64_t e;
+    const char* q = s + 1;
+    if (parseInt(&q, end, &e)) {
+      exponent += int(std::max<int64_t>(-400, std::min<int64_t>(400, e)));
+      s = q;
+    }
+  }
+
+  double v = double(mantissa);
+  if (exponent < 0) {
+    v = -exponent <= 22 ? v / kPOW10[-exponent] : v * std::pow(10.0, exponent);
+  } else if (exponent > 0) {
+    v = exponent <= 22 ? v * kPOW10[exponent] : v * std::pow(10.0, exponent);
+  }
+  *value = real(negative ? -v : v);
+  *p = s;
+  return true;
+}
+
+bool parseVec(const char** p, const char* end, Vec* v) {
+  return parseReal(p, end, &v->x) && parseReal(p, end, &v->y) &&
+         parseReal(p, end, &v->z);
+}
+
+// split [0, size) to chunks which begin at the head of a line.
+std::vector<size_t> splitLines(const char* data, const size_t& size) {
+  std::vector<size_t> bounds{0};
+  for (size_t pos = kPARSE_CHUNK; pos < size; pos += kPARSE_CHUNK) {
+    const char* nl = findLineEnd(data + pos, data + size);
+    const size_t next = size_t(nl - data) + 1;
+    if (next >= size) break;
+    if (next > bounds.back()) bounds.emplace_back(next);
+    pos = next;
+  }
+  bounds.emplace_back(size);
+  return bounds;
+}
+
+// ---- OBJ ----
+
+struct MtlEntry {
+  color col = WHITE;
+  Material material = Material::Normal;
+};
+
+// vertex index of a face. relative one is counted from the vertices which
+// are defined before the chunk.
+struct ObjIndex {
+  int64_t idx;
+  bool relative;
+};
+
+struct ObjChunk {
+  std::vector<Vec> verts;
+  std::vector<ObjIndex> tris;  // 3 indices per triangle
+  std::vector<std::pair<size_t, std::string>> usemtl;  // first triangle
+  std::vector<std::string> mtllib;
+  size_t error_line = 0;  // 0 if no error, else offset of the line + 1
+};
+
+void parseObjChunk(const char* begin, const char* end, const char* data,
+                   ObjChunk* chunk) {
+  std::vector<ObjIndex> face;
+  for (const char* p = begin; p < end;) {
+    const char* line_end = findLineEnd(p, end);
+    skipBlank(&p, line_end);
+    const char* line = p;
+    bool ok = true;
+
+    if (p + 1 < line_end && p[0] == 'v' && isBlank(p[1])) {
+      Vec v;
+      p += 2;
+      ok = parseVec(&p, line_end, &v);
+      chunk->verts.emplace_back(v);
+    } else if (p + 1 < line_end && p[0] == 'f' && isBlank(p[1])) {
+      face.clear();
+      p += 2;
+      int64_t idx;
+      while (parseInt(&p, line_end, &idx)) {
+        if (idx > 0) {
+          face.push_back({idx - 1, false});
+        } else if (idx < 0) {
+          face.push_back({int64_t(chunk->verts.size()) + idx, true});
+        } else {
+          ok = false;
+          break;
+        }
+        // skip texture and normal indices.
+        while (p < line_end && !isBlank(*p)) p++;
+      }
+      ok = ok && face.size() >= 3;
+      for (size_t k = 1; ok && k + 1 < face.size(); k++) {
+        chunk->tris.emplace_back(face[0]);
+        chunk->tris.emplace_back(face[k]);
+        chunk->tris.emplace_back(face[k + 1]);
+      }
+    } else if (line_end - p > 7 && std::strncmp(p, "usemtl", 6) == 0 &&
+               isBlank(p[6])) {
+      p += 7;
+      chunk->usemtl.emplace_back(chunk->tris.size() / 3,
+                                 readRest(&p, line_end));
+    } else if (line_end - p > 7 && std::strncmp(p, "mtllib", 6) == 0 &&
+               isBlank(p[6])) {
+      p += 7;
+      chunk->mtllib.emplace_back(readRest(&p, line_end));
+    }
+
+    if (!ok && chunk->error_line == 0) {
+      chunk->error_line = size_t(line - data) + 1;
+    }
+    p = line_end + 1;
+  }
+}
+
+void loadMtl(const std::string& filename,
+             std::unordered_map<std::string, MtlEntry>* materials) {
+  MappedFile file;
+  if (!file.open(filename)) {
+    LOG_INFO("failed to open a file : ", filename);
+    return;
+  }
+  const char* end = file.data() + file.size();
+  MtlEntry* current = nullptr;
+  for (const char* p = file.data(); p < end;) {
+    const char* line_end = findLineEnd(p, end);
+    const std::string key = readWord(&p, line_end);
+    if (key == "newmtl") {
+      current = &(*materials)[readRest(&p, line_end)];
+    } else if (current != nullptr && key == "Kd") {
+      parseVec(&p, line_end, &current->col);
+    } else if (current != nullptr && key == "Ke") {
+      Vec ke;
+      if (parseVec(&p, line_end, &ke) && (ke.x > 0 || ke.y > 0 || ke.z > 0)) {
+        current->col = ke;
+        current->material = Material::Light;
+      }
+    }
+    p = line_end + 1;
+  }
+}
+
+// ---- PLY ----
+
+enum class PlyType { Int8, Uint8, Int16, Uint16, Int32, Uint32, Float, Double };
+
+struct PlyProperty {
+  std::string name;
+  PlyType type;
+  bool is_list = false;
+  PlyType count_type;
+};
+
+struct PlyElement {
+  std::string name;
+  size_t count;
+  std::vector<PlyProperty> props;
+};
+
+bool parsePlyType(const std::string& name, PlyType* type) {
+  static const std::pair<const char*, PlyType> kTYPES[] = {
+      {"char", PlyType::Int8},     {"int8", PlyType::Int8},
+      {"uchar", PlyType::Uint8},   {"uint8", PlyType::Uint8},
+      {"short", PlyType::Int16},   {"int16", PlyType::Int16},
+      {"ushort", PlyType::Uint16}, {"uint16", PlyType::Uint16},
+      {"int", PlyType::Int32},     {"int32", PlyType::Int32},
+      {"uint", PlyType::Uint32},   {"uint32", PlyType::Uint32},
+      {"float", PlyType::Float},   {"float32", PlyType::Float},
+      {"double", PlyType::Double}, {"float64", PlyType::Double},
+  };
+  for (auto& t : kTYPES) {
+    if (name == t.first) {
+      *type = t.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t plyTypeSize(const PlyType& type) {
+  switch (type) {
+    case PlyType::Int8:
+    case PlyType::Uint8:
+      return 1;
+    case PlyType::Int16:
+    case PlyType::Uint16:
+      return 2;
+    case PlyType::Double:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
+template <class T>
+T loadValue(const char* p, const bool& swap) {
+  char bytes[sizeof(T)];
+  std::memcpy(bytes, p, sizeof(T));
+  if (swap) std::reverse(bytes, bytes + sizeof(T));
+  T v;
+  std::memcpy(&v, bytes, sizeof(T));
+  return v;
+}
+
+double readPlyValue(const char* p, const PlyType& type, const bool& swap) {
+  switch (type) {
+    case PlyType::Int8:
+      return loadValue<int8_t>(p, swap);
+    case PlyType::Uint8:
+      return loadValue<uint8_t>(p, swap);
+    case PlyType::Int16:
+      return loadValue<int16_t>(p, swap);
+    case PlyType::Uint16:
+      return loadValue<uint16_t>(p, swap);
+    case PlyType::Int32:
+      return loadValue<int32_t>(p, swap);
+    case PlyType::Uint32:
+      return loadValue<uint32_t>(p, swap);
+    case PlyType::Float:
+      return loadValue<float>(p, swap);
+    default:
+      return loadValue<double>(p, swap);
+  }
+}
+
+// size of one record. 0 if element has list properties.
+size_t fixedStride(const PlyElement& element) {
+  size_t stride = 0;
+  for (auto& prop : element.props) {
+    if (prop.is_list) return 0;
+    stride += plyTypeSize(prop.type);
+  }
+  return stride;
+}
+
+// size of the record at p, or 0 if it runs over end.
+size_t recordSize(const PlyElement& element, const char* p, const char* end,
+                  const bool& swap) {
+  size_t size = 0;
+  for (auto& prop : element.props) {
+    if (prop.is_list) {
+      const size_t count_size = plyTypeSize(prop.count_type);
+      if (p + size + count_size > end) return 0;
+      const size_t n = size_t(readPlyValue(p + size, prop.count_type, swap));
+      size += count_size + n * plyTypeSize(prop.type);
+    } else {
+      size += plyTypeSize(prop.type);
+    }
+  }
+  return p + size <= end ? size : 0;
+}
+
+bool parsePlyHeader(const MappedFile& file, std::vector<PlyElement>* elements,
+                    bool* swap, size_t* data_offset) {
+  const char* p = file.data();
+  const char* end = p + file.size();
+  if (file.size() < 4 || std::strncmp(p, "ply", 3) != 0) return false;
+
+  bool binary = false;
+  while (p < end) {
+    const char* line_end = findLineEnd(p, end);
+    const std::string key = readWord(&p, line_end);
+    if (key == "format") {
+      const std::string format = readWord(&p, line_end);
+      binary = format == "binary_little_endian" ||
+               format == "binary_big_endian";
+      const uint16_t one = 1;
+      uint8_t little;
+      std::memcpy(&little, &one, 1);
+      *swap = (format == "binary_big_endian") == (little == 1);
+    } else if (key == "element") {
+      PlyElement element;
+      element.name = readWord(&p, line_end);
+      int64_t count;
+      if (!parseInt(&p, line_end, &count) || count < 0) return false;
+      element.count = size_t(count);
+      elements->emplace_back(element);
+    } else if (key == "property") {
+      if (elements->empty()) return false;
+      PlyProperty prop;
+      std::string type = readWord(&p, line_end);
+      if (type == "list") {
+        prop.is_list = true;
+        if (!parsePlyType(readWord(&p, line_end), &prop.count_type)) {
+          return false;
+        }
+        type = readWord(&p, line_end);
+      }
+      if (!parsePlyType(type, &prop.type)) return false;
+      prop.name = readWord(&p, line_end);
+      elements->back().props.emplace_back(prop);
+    } else if (key == "end_header") {
+      *data_offset = size_t(line_end - file.data()) + 1;
+      if (!binary) LOG_INFO("only binary PLY is supported.");
+      return binary;
+    }
+    p = line_end + 1;
+  }
+  return false;
+}
+
+int findProperty(const PlyElement& element, const char* name) {
+  for (size_t i = 0; i < element.props.size(); i++) {
+    if (element.props[i].name == name) return int(i);
+  }
+  return -1;
+}
+
+}  // namespace
+
+bool LoadMesh(const std::string& filename, std::vector<Polygon>* polygons) {
+  if (endsWith(filename, ".obj")) return LoadOBJ(filename, polygons);
+  if (endsWith(filename, ".ply")) return LoadPLY(filename, polygons);
+  LOG_INFO("unknown mesh format : ", filename);
+  return false;
+}
+
+bool LoadOBJ(const std::string& filename, std::vector<Polygon>* polygons) {
+  MappedFile file;
+  if (!file.open(filename)) {
+    LOG_INFO("failed to open a file : ", filename);
+    return false;
+  }
+
+  // parse chunks of lines independently.
+  const std::vector<size_t> bounds = splitLines(file.data(), file.size());
+  const size_t n_chunk = bounds.size() - 1;
+  std::vector<ObjChunk> chunks(n_chunk);
+  parallelFor(0, n_chunk, n_chunk, [&](size_t s, size_t e, size_t) {
+    for (size_t c = s; c < e; c++) {
+      parseObjChunk(file.data() + bounds[c], file.data() + bounds[c + 1],
+                    file.data(), &chunks[c]);
+    }
+  });
+
+  // offsets of vertices and triangles of each chunk.
+  std::vector<size_t> vert_offset(n_chunk + 1, 0);
+  std::vector<size_t> tri_offset(n_chunk + 1, 0);
+  for (size_t c = 0; c < n_chunk; c++) {
+    if (chunks[c].error_line != 0) {
+      LOG_INFO("invalid line in ", filename, " at byte ",
+               chunks[c].error_line - 1);
+      return false;
+    }
+    vert_offset[c + 1] = vert_offset[c] + chunks[c].verts.size();
+    tri_offset[c + 1] = tri_offset[c] + chunks[c].tris.size() / 3;
+  }
+  const size_t n_vert = vert_offset[n_chunk];
+
+  std::vector<Vec> verts(n_vert);
+  parallelFor(0, n_chunk, n_chunk, [&](size_t s, size_t e, size_t) {
+    for (size_t c = s; c < e; c++) {
+      std::copy(chunks[c].verts.begin(), chunks[c].verts.end(),
+                verts.begin() + std::ptrdiff_t(vert_offset[c]));
+      std::vector<Vec>().swap(chunks[c].verts);
+    }
+  });
+
+  // materials, and the one which is used at the head of each chunk.
+  std::unordered_map<std::string, MtlEntry> materials;
+  for (auto& chunk : chunks) {
+    for (auto& lib : chunk.mtllib) {
+      loadMtl(directoryOf(filename) + lib, &materials);
+    }
+  }
+  const MtlEntry kDEFAULT;
+  auto findMaterial = [&](const std::string& name) {
+    const auto it = materials.find(name);
+    return it == materials.end() ? &kDEFAULT : &it->second;
+  };
+  std::vector<const MtlEntry*> head_material(n_chunk, &kDEFAULT);
+  for (size_t c = 1; c < n_chunk; c++) {
+    const auto& usemtl = chunks[c - 1].usemtl;
+    head_material[c] = usemtl.empty() ? head_material[c - 1]
+                                      : findMaterial(usemtl.back().second);
+  }
+
+  // write triangles to their final place.
+  const size_t base = polygons->size();
+  polygons->resize(base + tri_offset[n_chunk], kEMPTY_POLYGON);
+  std::atomic<bool> out_of_range(false);
+  parallelFor(0, n_chunk, n_chunk, [&](size_t s, size_t e, size_t) {
+    for (size_t c = s; c < e; c++) {
+      const ObjChunk& chunk = chunks[c];
+      const MtlEntry* material = head_material[c];
+      size_t next_usemtl = 0;
+      const size_t n_tri = chunk.tris.size() / 3;
+      for (size_t t = 0; t < n_tri; t++) {
+        while (next_usemtl < chunk.usemtl.size() &&
+               chunk.usemtl[next_usemtl].first == t) {
+          material = findMaterial(chunk.usemtl[next_usemtl++].second);
+        }
+        Vec v[3];
+        for (size_t k = 0; k < 3; k++) {
+          const ObjIndex& idx = chunk.tris[t * 3 + k];
+          const int64_t i =
+              idx.relative ? int64_t(vert_offset[c]) + idx.idx : idx.idx;
+          if (i < 0 || i >= int64_t(n_vert)) {
+            out_of_range = true;
+            return;
+          }
+          v[k] = verts[size_t(i)];
+        }
+        (*polygons)[base + tri_offset[c] + t] =
+            Polygon(v[0], v[1], v[2], material->col, material->material);
+      }
+    }
+  });
+  if (out_of_range) {
+    LOG_INFO("vertex index is out of range in ", filename);
+    polygons->resize(base, kEMPTY_POLYGON);
+    return false;
+  }
+
+  LOG_INFO("Load ", filename, " : ", n_vert, " vertices, ", tri_offset[n_chunk],
+           " triangles");
+  return true;
+}
+
+bool LoadPLY(const std::string& filename, std::vector<Polygon>* polygons) {
+  MappedFile file;
+  if (!file.open(filename)) {
+    LOG_INFO("failed to open a file : ", filename);
+    return false;
+  }
+
+  std::vector<PlyElement> elements;
+  bool swap = false;
+  size_t offset = 0;
+  if (!parsePlyHeader(file, &elements, &swap, &offset)) {
+    LOG_INFO("invalid PLY header : ", filename);
+    return false;
+  }
+
+  const char* end = file.data() + file.size();
+  std::vector<Vec> verts;
+  std::vector<Vec> colors;
+  const size_t base = polygons->size();
+
+  for (auto& element : elements) {
+    const char* data = file.data() + offset;
+    const size_t stride = fixedStride(element);
+
+    if (element.name == "vertex") {
+      const int px = findProperty(element, "x");
+      const int py = findProperty(element, "y");
+      const int pz = findProperty(element, "z");
+      const int pr = findProperty(element, "red");
+      const int pg = findProperty(element, "green");
+      const int pb = findProperty(element, "blue");
+      if (stride == 0 || px < 0 || py < 0 || pz < 0 ||
+          data + stride * element.count > end) {
+        LOG_INFO("invalid PLY vertices : ", filename);
+        return false;
+      }
+      std::vector<size_t> prop_offset(element.props.size() + 1, 0);
+      for (size_t i = 0; i < element.props.size(); i++) {
+        prop_offset[i + 1] = prop_offset[i] + plyTypeSize(element.props[i].type);
+      }
+      auto read = [&](const char* record, const int& prop) {
+        return real(readPlyValue(record + prop_offset[size_t(prop)],
+                                 element.props[size_t(prop)].type, swap));
+      };
+      const bool has_color = pr >= 0 && pg >= 0 && pb >= 0;
+      verts.resize(element.count);
+      if (has_color) colors.resize(element.count);
+
+      const size_t n_chunk =
+          std::max<size_t>(1, stride * element.count / kPARSE_CHUNK);
+      parallelFor(0, element.count, n_chunk, [&](size_t s, size_t e, size_t) {
+        for (size_t i = s; i < e; i++) {
+          const char* record = data + i * stride;
+          verts[i] = Vec(read(record, px), read(record, py), read(record, pz));
+          if (has_color) {
+            colors[i] = Vec(read(record, pr), read(record, pg),
+                            read(record, pb)) / 255.f;
+          }
+        }
+      });
+      offset += stride * element.count;
+    } else if (element.name == "face") {
+      const int pi = std::max(findProperty(element, "vertex_indices"),
+                              findProperty(element, "vertex_index"));
+      if (pi < 0 || !element.props[size_t(pi)].is_list) {
+        LOG_INFO("invalid PLY faces : ", filename);
+        return false;
+      }
+      const PlyProperty& index_prop = element.props[size_t(pi)];
+      size_t index_offset = 0;  // from the head of record, if before lists
+      for (int i = 0; i < pi; i++) {
+        index_offset += plyTypeSize(element.props[size_t(i)].type);
+      }
+
+      // records have variable size. find heads of chunks and triangle
+      // offsets by reading only counts, then read indices in parallel.
+      struct FaceChunk {
+        size_t offset;
+        size_t face;
+        size_t tri;
+      };
+      std::vector<FaceChunk> chunks;
+      size_t pos = offset;
+      size_t n_tri = 0;
+      for (size_t f = 0; f < element.count; f++) {
+        if (f == 0 || pos - chunks.back().offset >= kPARSE_CHUNK) {
+          chunks.push_back({pos, f, n_tri});
+        }
+        const size_t size = recordSize(element, file.data() + pos, end, swap);
+        if (size == 0) {
+          LOG_INFO("invalid PLY faces : ", filename);
+          return false;
+        }
+        const size_t n = size_t(readPlyValue(file.data() + pos + index_offset,
+                                             index_prop.count_type, swap));
+        n_tri += n >= 3 ? n - 2 : 0;
+        pos += size;
+      }
+      chunks.push_back({pos, element.count, n_tri});
+
+      offset = pos;
+      // no face, no chunk to read.
+      if (chunks.size() < 2) continue;
+
+      const size_t count_size = plyTypeSize(index_prop.count_type);
+      const size_t index_size = plyTypeSize(index_prop.type);
+      polygons->resize(base + n_tri, kEMPTY_POLYGON);
+      std::atomic<bool> out_of_range(false);
+      parallelFor(
+          0, chunks.size() - 1, chunks.size() - 1,
+          [&](size_t s, size_t e, size_t) {
+            for (size_t c = s; c < e; c++) {
+              const char* p = file.data() + chunks[c].offset;
+              size_t tri = base + chunks[c].tri;
+              for (size_t f = chunks[c].face; f < chunks[c + 1].face; f++) {
+                const size_t size = recordSize(element, p, end, swap);
+                const char* list = p + index_offset;
+                const size_t n =
+                    size_t(readPlyValue(list, index_prop.count_type, swap));
+                auto index = [&](const size_t& k) {
+                  return int64_t(readPlyValue(list + count_size + k * index_size,
+                                              index_prop.type, swap));
+                };
+                for (size_t k = 1; k + 1 < n; k++) {
+                  const int64_t idx[3] = {index(0), index(k), index(k + 1)};
+                  color col = WHITE;
+                  Vec v[3];
+                  for (int j = 0; j < 3; j++) {
+                    if (idx[j] < 0 || idx[j] >= int64_t(verts.size())) {
+                      out_of_range = true;
+                      return;
+                    }
+                    v[j] = verts[size_t(idx[j])];
+                  }
+                  if (!colors.empty()) {
+                    col = (colors[size_t(idx[0])] + colors[size_t(idx[1])] +
+                           colors[size_t(idx[2])]) /
+                          3.f;
+                  }
+                  (*polygons)[tri++] = Polygon(v[0], v[1], v[2], col);
+                }
+                p += size;
+              }
+            }
+          });
+      if (out_of_range) {
+        LOG_INFO("vertex index is out of range in ", filename);
+        polygons->resize(base, kEMPTY_POLYGON);
+        return false;
+      }
+    } else {
+      // skip other elements.
+      if (stride != 0) {
+        offset += stride * element.count;
+      } else {
+        for (size_t i = 0; i < element.count; i++) {
+          const size_t size =
+              recordSize(element, file.data() + offset, end, swap);
+          if (size == 0) return false;
+          offset += size;
+        }
+      }
+    }
+    if (offset > file.size()) {
+      LOG_INFO("PLY is shorter than its header : ", filename);
+      polygons->resize(base, kEMPTY_POLYGON);
+      return false;
+    }
+  }
+
+  LOG_INFO("Load ", filename, " : ", verts.size(), " vertices, ",
+           polygons->size() - base, " triangles");
+  return true;
+}
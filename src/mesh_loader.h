@@ -0,0 +1,31 @@
+//
+//  mesh_loader.h
+//  NewGlslRenderer
+//
+
+#ifndef mesh_loader_h20261017
+#define mesh_loader_h20261017
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+
+/**
+ Load triangles of a mesh file and append them to polygons.
+ Files are memory mapped and parsed in parallel chunks on
+ ThreadPool::shared().
+
+ OBJ : polygons are triangulated as fans. Negative indices are supported.
+       Materials of "usemtl" are read from "mtllib" files, Ke (emission)
+       which is not zero makes Material::Light with color Ke, otherwise
+       Material::Normal with color Kd.
+ PLY : binary little or big endian. Vertex colors (uchar red, green, blue)
+       are averaged for the color of a triangle.
+ **/
+bool LoadMesh(const std::string& filename, std::vector<Polygon>* polygons);
+
+bool LoadOBJ(const std::string& filename, std::vector<Polygon>* polygons);
+bool LoadPLY(const std::string& filename, std::vector<Polygon>* polygons);
+
+#endif /* mesh_loader_h20261017 */
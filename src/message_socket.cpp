@@ -0,0 +1,253 @@
+//
+//  message_socket.cpp
+//  NewGlslRenderer
+//
+
+#include "message_socket.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace {
+
+constexpr uint32_t kMAGIC = 0x4d545247;  // "GRTM"
+constexpr char kUNIX_PREFIX[] = "unix:";
+
+// a closed peer must fail send(), not kill the process by SIGPIPE.
+#ifdef MSG_NOSIGNAL
+constexpr int kSEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int kSEND_FLAGS = 0;
+#endif
+
+struct MessageHeader {
+  uint32_t magic;
+  uint32_t type;
+  uint64_t size;
+};
+
+struct Address {
+  bool is_unix = false;
+  std::string path;  // of Unix domain socket
+  std::string host, port;
+};
+
+bool parseAddress(const std::string& address, Address* parsed) {
+  const size_t prefix = sizeof(kUNIX_PREFIX) - 1;
+  if (address.compare(0, prefix, kUNIX_PREFIX) == 0) {
+    parsed->is_unix = true;
+    parsed->path = address.substr(prefix);
+    return !parsed->path.empty() &&
+           parsed->path.size() < sizeof(sockaddr_un::sun_path);
+  }
+  const size_t colon = address.rfind(':');
+  if (colon == std::string::npos || colon + 1 == address.size()) return false;
+  parsed->host = address.substr(0, colon);
+  parsed->port = address.substr(colon + 1);
+  return true;
+}
+
+sockaddr_un unixAddress(const std::string& path) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return addr;
+}
+
+void configure(const int& fd, const bool& is_tcp) {
+  int on = 1;
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  // messages are sent whole, so don't wait to fill segments.
+  if (is_tcp) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+bool sendAll(const int& fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t n = ::send(fd, p, size, kSEND_FLAGS);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+bool receiveAll(const int& fd, void* data, size_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t n = ::recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    size -= size_t(n);
+  }
+  return true;
+}
+
+// socket bound to (listen) or connected to (!listen) address, or -1.
+int openSocket(const Address& address, const bool& listen) {
+  if (address.is_unix) {
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    const sockaddr_un addr = unixAddress(address.path);
+    const sockaddr* sa = reinterpret_cast<const sockaddr*>(&addr);
+    if ((listen ? ::bind(fd, sa, sizeof(addr))
+                : ::connect(fd, sa, sizeof(addr))) != 0) {
+      ::close(fd);
+      return -1;
+    }
+    configure(fd, false);
+    return fd;
+  }
+
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (listen) hints.ai_flags = AI_PASSIVE;
+  addrinfo* list = nullptr;
+  if (getaddrinfo(address.host.empty() ? nullptr : address.host.c_str(),
+                  address.port.c_str(), &hints, &list) != 0) {
+    return -1;
+  }
+  int fd = -1;
+  for (addrinfo* ai = list; ai != nullptr && fd < 0; ai = ai->ai_next) {
+    fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0) continue;
+    int on = 1;
+    if (listen) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if ((listen ? ::bind(fd, ai->ai_addr, ai->ai_addrlen)
+                : ::connect(fd, ai->ai_addr, ai->ai_addrlen)) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(list);
+  if (fd >= 0) configure(fd, true);
+  return fd;
+}
+
+}  // namespace
+
+constexpr uint64_t MessageSocket::kMAX_MESSAGE_SIZE;
+
+MessageSocket& MessageSocket::operator=(MessageSocket&& other) {
+  if (this != &other) {
+    close();
+    fd = other.fd;
+    other.fd = -1;
+  }
+  return *this;
+}
+
+bool MessageSocket::connect(const std::string& address) {
+  close();
+  Address parsed;
+  if (!parseAddress(address, &parsed)) return false;
+  fd = openSocket(parsed, false);
+  return fd >= 0;
+}
+
+void MessageSocket::close() {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+bool MessageSocket::send(const uint32_t& type, const void* head,
+                         const size_t& head_size, const void* body,
+                         const size_t& body_size) {
+  if (fd < 0) return false;
+  const MessageHeader header = {kMAGIC, type, head_size + body_size};
+  return sendAll(fd, &header, sizeof(header)) &&
+         sendAll(fd, head, head_size) && sendAll(fd, body, body_size);
+}
+
+bool MessageSocket::receive(uint32_t* type, std::vector<char>* payload,
+                            const uint64_t& max_size) {
+  if (fd < 0) return false;
+  MessageHeader header;
+  if (!receiveAll(fd, &header, sizeof(header)) || header.magic != kMAGIC ||
+      header.size > max_size || header.size > payload->max_size()) {
+    close();
+    return false;
+  }
+  try {
+    payload->resize(size_t(header.size));
+  } catch (const std::bad_alloc&) {
+    close();
+    return false;
+  } catch (const std::length_error&) {
+    close();
+    return false;
+  }
+  if (!receiveAll(fd, payload->data(), payload->size())) {
+    close();
+    return false;
+  }
+  *type = header.type;
+  return true;
+}
+
+bool MessageSocket::setReceiveTimeout(const double& seconds) {
+  if (fd < 0) return false;
+  timeval timeout;
+  timeout.tv_sec = time_t(seconds);
+  timeout.tv_usec = suseconds_t((seconds - double(timeout.tv_sec)) * 1e6);
+  return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) ==
+         0;
+}
+
+bool MessageListener::listen(const std::string& address) {
+  close();
+  Address parsed;
+  if (!parseAddress(address, &parsed)) return false;
+  // a socket file left by a killed process refuses bind.
+  if (parsed.is_unix) ::unlink(parsed.path.c_str());
+  fd = openSocket(parsed, true);
+  if (fd < 0) return false;
+  if (parsed.is_unix) unix_path = parsed.path;
+  if (::listen(fd, SOMAXCONN) != 0) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void MessageListener::close() {
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+  if (!unix_path.empty()) {
+    ::unlink(unix_path.c_str());
+    unix_path.clear();
+  }
+}
+
+bool MessageListener::accept(MessageSocket* socket) {
+  if (fd < 0) return false;
+  int peer;
+  do {
+    peer = ::accept(fd, nullptr, nullptr);
+  } while (peer < 0 && errno == EINTR);
+  if (peer < 0) return false;
+  // TCP_NODELAY fails harmlessly on Unix domain sockets.
+  configure(peer, true);
+  *socket = MessageSocket(peer);
+  return true;
+}
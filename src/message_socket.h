@@ -0,0 +1,82 @@
+//
+//  message_socket.h
+//  NewGlslRenderer
+//
+
+#ifndef message_socket_h20261017
+#define message_socket_h20261017
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ Stream socket which sends and receives framed messages : a header of the
+ type and the size of the payload, followed by the payload.
+ Addresses are "host:port" for TCP or "unix:<path>" for Unix domain sockets.
+ Integers are in the byte order of the host, so peers must share it.
+ **/
+class MessageSocket {
+public:
+  // largest payload receive() accepts by default.
+  static constexpr uint64_t kMAX_MESSAGE_SIZE = uint64_t(1) << 32;
+
+private:
+  int fd = -1;
+
+public:
+  MessageSocket() {}
+  explicit MessageSocket(const int& fd_) : fd(fd_) {}
+  ~MessageSocket() { close(); }
+
+  MessageSocket(const MessageSocket&) = delete;
+  MessageSocket& operator=(const MessageSocket&) = delete;
+  MessageSocket(MessageSocket&& other) : fd(other.fd) { other.fd = -1; }
+  MessageSocket& operator=(MessageSocket&& other);
+
+  bool connect(const std::string& address);
+  void close();
+
+  bool isOpen() const { return fd >= 0; }
+  // file descriptor to poll.
+  int handle() const { return fd; }
+
+  // payload is head followed by body, which may be empty. blocks until all
+  // is sent.
+  bool send(const uint32_t& type, const void* head, const size_t& head_size,
+            const void* body = nullptr, const size_t& body_size = 0);
+  // blocks until a whole message is received. fails on a closed or broken
+  // stream, on a payload over max_size, which is not allocated, or when the
+  // peer stops sending longer than the receive timeout. the socket is
+  // closed on failure, as the rest of the stream can't be framed.
+  bool receive(uint32_t* type, std::vector<char>* payload,
+               const uint64_t& max_size = kMAX_MESSAGE_SIZE);
+  // longest wait for more bytes in receive(), so a peer which stops in a
+  // message doesn't block the caller. 0 waits forever, as by default.
+  bool setReceiveTimeout(const double& seconds);
+};
+
+/** Listening socket of MessageSocket, removes its Unix socket file. **/
+class MessageListener {
+private:
+  int fd = -1;
+  std::string unix_path;
+
+public:
+  MessageListener() {}
+  ~MessageListener() { close(); }
+
+  MessageListener(const MessageListener&) = delete;
+  MessageListener& operator=(const MessageListener&) = delete;
+
+  // host of TCP may be empty for all interfaces, like ":7000".
+  bool listen(const std::string& address);
+  void close();
+
+  int handle() const { return fd; }
+  // blocks until a peer connects.
+  bool accept(MessageSocket* socket);
+};
+
+#endif /* message_socket_h20261017 */
@@ -0,0 +1,85 @@
+//
+//  render_config.h
+//  NewGlslRenderer
+//
+
+#ifndef render_config_h20261017
+#define render_config_h20261017
+
+#include <cstddef>
+#include <string>
+
+#include "image_io.h"
+#include "sampler.h"
+
+struct WindowConfig {
+  std::string title;
+  bool is_retina;
+};
+
+struct RenderConfig {
+  bool display;
+  int width;
+  int height;
+  float gamma = 1.f;
+  int n_sample_frame;
+  size_t max_sample;
+
+  // pinhole camera looking along camera_dir, with z up.
+  Vec camera_pos = Vec(-3, 0, 0);
+  Vec camera_dir = Vec(1, 0, 0);
+
+  // sequence of random numbers, see PixelSampler. samples of the same seed
+  // and index are the same in every run.
+  SamplerType sampler = SamplerType::Sobol;
+  uint32_t sampler_seed = 0;
+
+  // paths end after max_depth bounces, and continue at bounce n with the
+  // probability roulette^(n-1). the shader is compiled for these values.
+  int max_depth = 5;
+  float roulette = 0.6f;
+
+  // target GPU time of one draw in milliseconds. frames are split into tiles
+  // and sample batches to keep each draw near it (see TileScheduler).
+  // 0 draws each frame at once.
+  double dispatch_time = 8.0;
+
+  // adaptive sampling. blocks of 16x16 pixels are not sampled any more when
+  // the relative error of every pixel is under adaptive_threshold, after
+  // adaptive_min_sample samples. rendering stops when the mean error of all
+  // pixels is under noise_threshold. 0 disables each.
+  float adaptive_threshold = 0.f;
+  size_t adaptive_min_sample = 64;
+  float noise_threshold = 0.f;
+
+  // passes of the edge-aware a-trous denoiser guided by normal, depth and
+  // albedo of first hits, applied to the display and saved images. pass i
+  // filters with a step of 2^i pixels. 0 disables.
+  int denoise_pass = 0;
+
+  // render without window and display server, then save output_path and exit
+  // at max_sample or after time_budget seconds (0 means no limit).
+  bool headless = false;
+  double time_budget = 0.0;
+  std::string output_path = "out.ppm";
+  ImageFormat output_format = ImageFormat::Auto;
+
+  // save output_path in background every snapshot_sample samples or
+  // snapshot_interval seconds while rendering. 0 disables each.
+  size_t snapshot_sample = 0;
+  double snapshot_interval = 0.0;
+
+  // resume from checkpoint_path if it matches, and save it every
+  // checkpoint_interval seconds and at the end. empty path disables.
+  std::string checkpoint_path;
+  double checkpoint_interval = 0.0;
+
+  // directory of scene caches, which are reused when the same polygons are
+  // set again. empty disables.
+  std::string scene_cache_dir;
+  // directory of linked shader programs (see ProgramBinaryCache). empty
+  // disables.
+  std::string program_cache_dir;
+};
+
+#endif /* render_config_h20261017 */
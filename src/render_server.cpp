@@ -0,0 +1,303 @@
+//
+//  render_server.cpp
+//  NewGlslRenderer
+//
+
+#include "render_server.h"
+
+#include <poll.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <memory>
+
+#include "logger.h"
+#include "lru_cache.h"
+#include "mesh_loader.h"
+#include "message_socket.h"
+#include "renderer.hpp"
+
+namespace {
+
+// largest side of images of jobs.
+constexpr int kMAX_SIZE = 16384;
+// largest request, of the paths of a job.
+constexpr uint64_t kMAX_REQUEST_SIZE = 1 << 16;
+// seconds a client may stop in the middle of a request before it is
+// dropped, so it doesn't hold up the others.
+constexpr double kRECEIVE_TIMEOUT = 5.0;
+
+enum class Message : uint32_t { Job = 1, Reply = 2 };
+
+// followed by the scene path and the output path.
+struct JobRequest {
+  uint32_t width, height;
+  uint64_t max_sample;
+  float camera_pos[3], camera_dir[3];
+  uint32_t scene_size, output_size;
+};
+
+struct JobReply {
+  int32_t status;         // of GlslRayTraceRenderer::start()
+  uint32_t scene_cached;  // the scene was on the GPU
+  double wait_time;       // seconds in the queue
+  double render_time;     // seconds to load, render and save
+};
+
+bool parseJob(const std::vector<char>& payload, ServerJob* job) {
+  JobRequest request;
+  if (payload.size() < sizeof(request)) return false;
+  std::memcpy(&request, payload.data(), sizeof(request));
+  if (payload.size() !=
+      sizeof(request) + size_t(request.scene_size) + request.output_size) {
+    return false;
+  }
+  const char* text = payload.data() + sizeof(request);
+  job->scene.assign(text, request.scene_size);
+  job->output_path.assign(text + request.scene_size, request.output_size);
+  job->width = int(std::min<uint32_t>(request.width, kMAX_SIZE + 1));
+  job->height = int(std::min<uint32_t>(request.height, kMAX_SIZE + 1));
+  job->max_sample = size_t(request.max_sample);
+  job->camera_pos = Vec(request.camera_pos[0], request.camera_pos[1],
+                        request.camera_pos[2]);
+  job->camera_dir = Vec(request.camera_dir[0], request.camera_dir[1],
+                        request.camera_dir[2]);
+  return true;
+}
+
+// scenes of files are cached by modification time and size too, so edited
+// files are loaded again.
+std::string sceneKey(const std::string& path) {
+  if (path.empty()) return path;
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return path;
+  return path + "\n" + std::to_string(int64_t(st.st_mtime)) + "\n" +
+         std::to_string(int64_t(st.st_size));
+}
+
+}  // namespace
+
+int RenderServer::start() {
+  RenderConfig base = r_config;
+  base.display = false;
+  base.headless = true;
+  WindowConfig window;
+  window.title = "server";
+  window.is_retina = false;
+  GlslRayTraceRenderer renderer(base, window);
+
+  // declared after the renderer, so GL objects of scenes are deleted before
+  // the context.
+  using ScenePtr = std::shared_ptr<GlslRayTraceRenderer::GpuScene>;
+  LruCache<std::string, ScenePtr> scenes(s_config.scene_cache_bytes);
+
+  MessageListener listener;
+  if (!listener.listen(s_config.address)) {
+    std::cerr << "RenderServer : can't listen on " << s_config.address
+              << std::endl;
+    return -1;
+  }
+  LOG_INFO("Server listens on ", s_config.address);
+
+  struct Request {
+    ServerJob job;
+    std::chrono::steady_clock::time_point received;
+  };
+  struct Client {
+    MessageSocket socket;
+    size_t id;
+    std::deque<Request> jobs;
+  };
+  std::vector<Client> clients;  // in order of id
+  size_t n_joined = 0;
+  size_t last_served = 0;
+
+  auto load_scene = [&](const std::string& path, bool* cached) -> ScenePtr {
+    const std::string key = sceneKey(path);
+    if (ScenePtr* scene = scenes.get(key)) {
+      *cached = true;
+      return *scene;
+    }
+    *cached = false;
+    std::vector<Polygon> mesh;
+    if (!path.empty() && !LoadMesh(path, &mesh)) return nullptr;
+    if (!renderer.setPolygons(path.empty() ? polygons : mesh)) return nullptr;
+    const ScenePtr& scene = renderer.getScene();
+    const size_t n_evicted = scenes.put(key, scene, scene->bytes());
+    LOG_INFO("Load scene ", path.empty() ? "of the server" : path, ", ",
+             scenes.size(), " scenes of ", scenes.cost(), " bytes are kept, ",
+             n_evicted, " evicted");
+    return scene;
+  };
+
+  auto serve = [&](Client& client) {
+    const Request request = client.jobs.front();
+    client.jobs.pop_front();
+    const ServerJob& job = request.job;
+    const auto start_time = std::chrono::steady_clock::now();
+
+    JobReply reply = JobReply();
+    reply.status = -1;
+    bool cached = false;
+    const bool valid = job.width > 0 && job.width <= kMAX_SIZE &&
+                       job.height > 0 && job.height <= kMAX_SIZE &&
+                       job.max_sample > 0 && !job.output_path.empty();
+    const ScenePtr scene = valid ? load_scene(job.scene, &cached) : nullptr;
+    if (scene != nullptr) {
+      RenderConfig config = base;
+      config.width = job.width;
+      config.height = job.height;
+      config.max_sample = job.max_sample;
+      config.camera_pos = job.camera_pos;
+      config.camera_dir = job.camera_dir;
+      config.output_path = job.output_path;
+      config.output_format = ImageFormat::Auto;
+      config.time_budget = 0.0;
+      config.snapshot_sample = 0;
+      config.snapshot_interval = 0.0;
+      config.checkpoint_path.clear();
+      renderer.setScene(scene);
+      reply.status = renderer.start(config);
+    }
+
+    const auto end_time = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> wait = start_time - request.received;
+    const std::chrono::duration<double> render = end_time - start_time;
+    reply.scene_cached = cached ? 1 : 0;
+    reply.wait_time = wait.count();
+    reply.render_time = render.count();
+    LOG_INFO("Job of client ", client.id, " : ", job.output_path, " ",
+             reply.status == 0 ? "is saved" : "failed", " in ",
+             reply.render_time, " sec after ", reply.wait_time,
+             " sec in the queue");
+    if (!client.socket.send(uint32_t(Message::Reply), &reply, sizeof(reply))) {
+      client.socket.close();
+    }
+  };
+
+  while (true) {
+    const bool pending =
+        std::any_of(clients.begin(), clients.end(),
+                    [](const Client& client) { return !client.jobs.empty(); });
+
+    // between jobs, take all requests which came while rendering.
+    std::vector<pollfd> fds(clients.size() + 1);
+    fds[0].fd = listener.handle();
+    fds[0].events = POLLIN;
+    for (size_t i = 0; i < clients.size(); i++) {
+      fds[i + 1].fd = clients[i].socket.handle();
+      fds[i + 1].events = POLLIN;
+    }
+    if (poll(fds.data(), nfds_t(fds.size()), pending ? 0 : -1) < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "RenderServer : poll failed" << std::endl;
+      return -1;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < clients.size(); i++) {
+      if (fds[i + 1].revents == 0) continue;
+      uint32_t type;
+      std::vector<char> payload;
+      Request request;
+      request.received = now;
+      bool received = false;
+      try {
+        received = clients[i].socket.receive(&type, &payload,
+                                             kMAX_REQUEST_SIZE) &&
+                   type == uint32_t(Message::Job) &&
+                   parseJob(payload, &request.job);
+        if (received) clients[i].jobs.push_back(request);
+      } catch (const std::exception& e) {
+        LOG_INFO("Request of client ", clients[i].id, " failed : ", e.what());
+        received = false;
+      }
+      if (!received) {
+        // nobody waits for its jobs any more.
+        clients[i].socket.close();
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      Client client;
+      if (listener.accept(&client.socket) &&
+          client.socket.setReceiveTimeout(kRECEIVE_TIMEOUT)) {
+        client.id = n_joined++;
+        clients.push_back(std::move(client));
+      }
+    } else if (fds[0].revents != 0) {
+      std::cerr << "RenderServer : listening failed" << std::endl;
+      return -1;
+    }
+    clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                 [](const Client& client) {
+                                   return !client.socket.isOpen();
+                                 }),
+                  clients.end());
+
+    // round robin over clients with jobs, from the one after the last.
+    auto has_job = [](const Client& client) { return !client.jobs.empty(); };
+    auto next = std::find_if(clients.begin(), clients.end(),
+                             [&](const Client& client) {
+                               return client.id > last_served &&
+                                      has_job(client);
+                             });
+    if (next == clients.end()) {
+      next = std::find_if(clients.begin(), clients.end(), has_job);
+    }
+    if (next == clients.end()) continue;
+    last_served = next->id;
+    try {
+      serve(*next);
+    } catch (const std::exception& e) {
+      // the job fails, the server keeps serving the others.
+      LOG_INFO("Job of client ", next->id, " failed : ", e.what());
+      next->socket.close();
+    }
+  }
+}
+
+int submitJob(const std::string& address, const ServerJob& job) {
+  MessageSocket socket;
+  if (!socket.connect(address)) {
+    std::cerr << "submitJob : can't connect to " << address << std::endl;
+    return -1;
+  }
+
+  JobRequest request = JobRequest();
+  request.width = uint32_t(job.width);
+  request.height = uint32_t(job.height);
+  request.max_sample = job.max_sample;
+  const Vec& pos = job.camera_pos;
+  const Vec& dir = job.camera_dir;
+  const float camera[6] = {pos.x, pos.y, pos.z, dir.x, dir.y, dir.z};
+  std::copy(camera, camera + 3, request.camera_pos);
+  std::copy(camera + 3, camera + 6, request.camera_dir);
+  request.scene_size = uint32_t(job.scene.size());
+  request.output_size = uint32_t(job.output_path.size());
+  const std::string text = job.scene + job.output_path;
+  if (!socket.send(uint32_t(Message::Job), &request, sizeof(request),
+                   text.data(), text.size())) {
+    std::cerr << "submitJob : can't send the job" << std::endl;
+    return -1;
+  }
+
+  uint32_t type;
+  std::vector<char> payload;
+  JobReply reply;
+  if (!socket.receive(&type, &payload, sizeof(reply)) ||
+      type != uint32_t(Message::Reply) ||
+      payload.size() != sizeof(reply)) {
+    std::cerr << "submitJob : no reply from " << address << std::endl;
+    return -1;
+  }
+  std::memcpy(&reply, payload.data(), sizeof(reply));
+  LOG_INFO(job.output_path, reply.status == 0 ? " is saved" : " failed",
+           " in ", reply.render_time, " sec after ", reply.wait_time,
+           " sec in the queue", reply.scene_cached ? ", scene was cached" : "");
+  return reply.status == 0 ? 0 : -1;
+}
@@ -0,0 +1,68 @@
+//
+//  render_server.h
+//  NewGlslRenderer
+//
+
+#ifndef render_server_h20261017
+#define render_server_h20261017
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "render_config.h"
+
+struct ServerConfig {
+  // "unix:<path>" or "host:port" to listen on.
+  std::string address;
+  // bytes of texture buffers of the scenes kept on the GPU.
+  size_t scene_cache_bytes = size_t(1) << 30;
+};
+
+// render job of RenderServer.
+struct ServerJob {
+  // OBJ or PLY file, reloaded when it changes. empty for the scene of the
+  // server.
+  std::string scene;
+  std::string output_path;
+  int width = 0, height = 0;
+  size_t max_sample = 0;
+  Vec camera_pos, camera_dir;
+};
+
+/**
+ Daemon around a headless GlslRayTraceRenderer, which keeps the GL context,
+ the compiled programs and the uploaded scenes between jobs, so small jobs
+ don't pay for start up, shader compile, BVH build and upload each time.
+ Scenes are kept in an LRU cache of scene_cache_bytes.
+ Jobs are queued per client and rendered one of each client in turn, so a
+ client of many jobs doesn't hold back the others. Each job is answered
+ when its output is saved.
+ **/
+class RenderServer {
+public:
+  // settings of jobs other than ServerJob, like n_sample_frame and sampler.
+  const RenderConfig r_config;
+  const ServerConfig s_config;
+
+private:
+  std::vector<Polygon> polygons;
+
+public:
+  RenderServer(const RenderConfig& r_config_, const ServerConfig& s_config_)
+      : r_config(r_config_), s_config(s_config_) {}
+
+  // scene of jobs without their own.
+  void setPolygons(const std::vector<Polygon>& polygons_) {
+    polygons = polygons_;
+  }
+
+  // serve until listening fails.
+  int start();
+};
+
+// send job to the server at address and wait until it is saved. 0 on
+// success.
+int submitJob(const std::string& address, const ServerJob& job);
+
+#endif /* render_server_h20261017 */
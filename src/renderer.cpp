@@ -8,129 +8,338 @@
 
 #include "renderer.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <memory>
 
+#include "../gl_src/async_readback.h"
 #include "../gl_src/glsl_utility.h"
+#include "../gl_src/tile_scheduler.h"
+#include "camera_controller.h"
+#include "checkpoint.h"
 #include "fps.h"
+#include "light_sampler.h"
 #include "logger.h"
-#include "ppm.h"
+#include "sampler.h"
+#include "scene_cache.h"
+#include "snapshot_writer.h"
+#include "thread_pool.h"
 
 namespace {
 
 constexpr real kPI = 3.1415926535;
+// kSTACK_SIZE in test.frag
+constexpr size_t kBVH_STACK_SIZE = 32;
+// seconds of draws between swaps of the window.
+constexpr double kDRAW_PERIOD = 1.0 / 60.0;
+// kBLOCK_SIZE in test.frag
+constexpr int kBLOCK_SIZE = 16;
+static_assert(TileScheduler::kTILE_ALIGN % kBLOCK_SIZE == 0,
+              "tiles cover whole blocks");
+// divisors of the resolution of previews drawn after the camera moves, in
+// order.
+constexpr int kPREVIEW_SCALE[] = {8, 4};
+constexpr size_t kNUM_PREVIEW = sizeof(kPREVIEW_SCALE) / sizeof(int);
+// moves of the camera per second, relative to the diagonal of the scene.
+constexpr real kCAMERA_SPEED = 0.25f;
+// updateVertices() builds the BVH again instead of refitting it when its
+// SAH cost grows over this ratio to the cost of the built one.
+constexpr real kMAX_REFIT_COST = 1.5f;
+// moved elements closer than this are uploaded in one range, since small
+// gaps cost less than more calls.
+constexpr size_t kUPLOAD_GAP = 64;
 
-float computeBrightMagnification(std::vector<Polygon>* polygons) {
-  float max_v = 0.f;
+// texture units of render(). they are fixed rather than following names of
+// textures, which some drivers don't reuse soon when render() runs again.
+enum TextureUnit {
+  kTRI_UNIT = 0,
+  kMAT_UNIT,
+  kBVH_UNIT,
+  kBVH_INFO_UNIT,
+  kLIGHT_UNIT,
+  kBLUE_NOISE_UNIT,
+  kLAYER_UNIT,  // kLAYER attachments of the accumulator
+  kBLOCK_ERROR_UNIT = kLAYER_UNIT + CheckpointHeader::kLAYER,
+  kMASK_UNIT,
+  kDENOISED_UNIT,  // 2 textures
+  kDENOISE_INPUT_UNIT = kDENOISED_UNIT + 2,  // previous a-trous pass
+  kDISPLAY_UNIT,
+};
 
-  for (auto& pol : *polygons) {
-    if (pol.material != Material::Light && pol.material != Material::DirLight) {
-      continue;
-    }
-    max_v = std::max(std::abs(pol.col[0]), max_v);
-    max_v = std::max(std::abs(pol.col[1]), max_v);
-    max_v = std::max(std::abs(pol.col[2]), max_v);
-  }
+// samplers of test.frag read fixed units, set once per program.
+const struct {
+  const char* name;
+  GLint unit;
+} kSAMPLER_UNITS[] = {
+    {"tri_tex", kTRI_UNIT},
+    {"mat_tex", kMAT_UNIT},
+    {"bvh_tex", kBVH_UNIT},
+    {"bvh_info_tex", kBVH_INFO_UNIT},
+    {"light_tex", kLIGHT_UNIT},
+    {"blue_noise_tex", kBLUE_NOISE_UNIT},
+    {"d_tex", kLAYER_UNIT},
+    {"moment_tex", kLAYER_UNIT + 1},
+    {"normal_tex", kLAYER_UNIT + 2},
+    {"albedo_tex", kLAYER_UNIT + 3},
+    {"mask_tex", kMASK_UNIT},
+    {"denoise_tex", kDENOISE_INPUT_UNIT},
+    {"display_tex", kDISPLAY_UNIT},
+};
 
-  for (auto& pol : *polygons) {
-    if (pol.material != Material::Light && pol.material != Material::DirLight) {
-      continue;
-    }
-    pol.col /= max_v;
-  }
+// binding points of the uniform blocks of test.frag.
+enum UniformBinding { kRENDER_BINDING = 0, kSCENE_BINDING };
 
-  return max_v;
-}
+// std140 layouts of the uniform blocks.
+struct RenderParams {
+  GLfloat camera_pos[3];
+  GLfloat aspect_ratio;
+  GLfloat camera_dir[3];
+  GLint sampler_type;
+  GLuint sampler_seed;
+  GLfloat brightness;
+  GLfloat gamma;
+  GLfloat pad;
+  GLuint sobol_dir[PixelSampler::kSOBOL_DIM * PixelSampler::kSOBOL_BITS];
+};
+static_assert(sizeof(RenderParams) == 48 + 128 * sizeof(GLuint),
+              "sobol_dir is uvec4[32] at offset 48");
 
-PTexture2Df setupTriangleTexture(const int& side_len,
-                                 const std::vector<Polygon>& pols) {
-  if (pols.size() > std::pow(side_len, 2) / 4) {
-    return nullptr;
+struct SceneParams {
+  GLint bvh_size;
+  GLint num_light;
+  GLfloat light_power;
+  GLfloat pad;
+};
+
+// 3 RGBA texels per triangle : (vertex 0, normal.x), (edge 0, normal.y),
+// (edge 1, normal.z).
+struct TriangleData {
+  Vec ver0;
+  real normal_x;
+  Vec edge0;
+  real normal_y;
+  Vec edge1;
+  real normal_z;
+
+  TriangleData(const Polygon& pol)
+      : ver0(pol.vert[0]),
+        edge0(pol.vert[1] - pol.vert[0]),
+        edge1(pol.vert[2] - pol.vert[0]) {
+    const Vec n = cross(edge0, edge1);
+    const real len = n.length();
+    // degenerate triangles are never hit, so their normal is not used.
+    const Vec normal = len > 0 ? n * (real(1) / len) : Vec(0);
+    normal_x = normal.x;
+    normal_y = normal.y;
+    normal_z = normal.z;
   }
+};
+static_assert(sizeof(TriangleData) == 12 * sizeof(float),
+              "3 texels per triangle");
 
-  struct PolygonData {
-    Vec ver0;
-    real pad0;
-    Vec ver1;
-    real pad1;
-    Vec ver2;
-    real pad2;
+// 2 RGBA texels of bounds per node.
+struct BBox {
+  Vec start;
+  real pad0;
+  Vec end;
+  real pad1;
+  BBox(const BVH::Node& node)
+      : start(node.start), pad0(0), end(node.end), pad1(0) {}
+};
+static_assert(sizeof(BBox) == 8 * sizeof(float), "2 texels per node");
+
+// triangle texels and 1 RGBA texel of (color, material) per polygon.
+void packTriangleTexels(const std::vector<Polygon>& pols,
+                        std::vector<float>* pixels,
+                        std::vector<float>* mat_pixels) {
+  struct MaterialData {
     Vec color;
     real info;
 
-    PolygonData(const Polygon& pol)
-        : ver0(pol.vert[0]),
-          ver1(pol.vert[1]),
-          ver2(pol.vert[2]),
-          color(pol.col) {
-      info = GLfloat(pol.material);
-    }
+    MaterialData(const Polygon& pol)
+        : color(pol.col), info(GLfloat(pol.material)) {}
   };
 
-  std::vector<GLfloat> pixels(size_t(std::pow(side_len, 2)) * 4);
+  pixels->resize(pols.size() * 12);
+  mat_pixels->resize(pols.size() * 4);
+  parallelFor(0, pols.size(), std::max<size_t>(1, pols.size() >> 16),
+              [&](size_t s, size_t e, size_t) {
+                for (size_t i = s; i < e; i++) {
+                  reinterpret_cast<TriangleData*>(pixels->data())[i] =
+                      TriangleData(pols[i]);
+                  reinterpret_cast<MaterialData*>(mat_pixels->data())[i] =
+                      MaterialData(pols[i]);
+                }
+              });
+}
 
-  for (size_t i = 0; i < pols.size(); i++) {
-    reinterpret_cast<PolygonData*>(pixels.data())[i] = PolygonData(pols[i]);
+// bounds and 1 RGBA integer texel of links per node.
+void packBVHTexels(const BVH& bvh, std::vector<float>* pixels,
+                   std::vector<int32_t>* ipixels) {
+  pixels->resize(bvh.nodes.size() * 8);
+  ipixels->resize(bvh.nodes.size() * 4);
+  for (size_t i = 0; i < bvh.nodes.size(); i++) {
+    reinterpret_cast<BBox*>(pixels->data())[i] = BBox(bvh.nodes[i]);
+    if (bvh.nodes[i].leaf) {
+      (*ipixels)[4 * i + 0] = int32_t(bvh.nodes[i].s_idx);
+      (*ipixels)[4 * i + 1] = int32_t(bvh.nodes[i].e_idx);
+    } else {
+      // right child is the brother of the left child, which is next node.
+      (*ipixels)[4 * i + 0] = -1;
+      (*ipixels)[4 * i + 1] = int32_t(bvh.nodes[i + 1].brother);
+    }
+    if (bvh.nodes[i].brother != size_t(-1)) {
+      (*ipixels)[4 * i + 2] = int32_t(bvh.nodes[i].brother);
+    } else {
+      (*ipixels)[4 * i + 2] = -1;
+    }
+    (*ipixels)[4 * i + 3] = 0;
   }
+}
 
-  std::array<int, 2> tex_size = {{side_len, side_len}};
+// alias table of emitters for next event estimation, 1 RGBA integer texel
+// per emitter.
+void packLightTexels(const std::vector<Polygon>& pols,
+                     std::vector<int32_t>* ipixels, float* light_power) {
+  LightSampler sampler;
+  sampler.init(pols);
+  static_assert(sizeof(LightSampler::Entry) == 4 * sizeof(int32_t),
+                "entry is one texel");
+  ipixels->resize(sampler.entries.size() * 4);
+  std::memcpy(ipixels->data(), sampler.entries.data(),
+              sampler.entries.size() * sizeof(LightSampler::Entry));
+  *light_power = sampler.total_power;
+}
 
-  return std::make_shared<OpenGLTexture<GL_TEXTURE_2D, GLfloat>>(
-      tex_size, -1, GL_RGBA16F, GL_RGBA, &pixels[0], GL_NEAREST);
+// depth of the deepest node, root is 1. parents precede their children.
+size_t bvhDepth(const BVH& bvh) {
+  std::vector<size_t> depth(bvh.nodes.size(), 1);
+  size_t max_depth = 0;
+  for (size_t i = 0; i < bvh.nodes.size(); i++) {
+    if (bvh.nodes[i].parent != size_t(-1)) {
+      depth[i] = depth[bvh.nodes[i].parent] + 1;
+    }
+    max_depth = std::max(max_depth, depth[i]);
+  }
+  return max_depth;
 }
 
-bool setupBVHTexture(const int& side_len, const BVH& bvh, PTexture2Df coord_tex,
-                     TextureP<GL_TEXTURE_1D, GLint>& info_tex) {
-  if (bvh.nodes.size() > std::pow(side_len, 2) / 2) {
+// texels of the BVH of scene, except bright_mag which is kept.
+bool packSceneTexels(const BVH& bvh, SceneTexels* texels) {
+  // texels are addressed by 32 bit int in the shader.
+  if (bvh.polygons.size() > size_t(INT32_MAX) / 3) {
+    std::cerr << "GlslRayTraceRenderer : size of polygons is too big !"
+              << std::endl;
     return false;
   }
+  packTriangleTexels(bvh.polygons, &texels->triangle_storage,
+                     &texels->material_storage);
+  packBVHTexels(bvh, &texels->bound_storage, &texels->info_storage);
+  packLightTexels(bvh.polygons, &texels->light_storage, &texels->light_power);
+  texels->useStorage();
+  return true;
+}
 
-  struct BBox {
-    Vec start;
-    Vec end;
-    BBox(const BVH::Node& node) : start(node.start), end(node.end) {}
-  };
+// upload texels of scene, and set what the shader variant depends on.
+bool uploadScene(GlslRayTraceRenderer::GpuScene* scene) {
+  const BVH& bvh = scene->bvh;
+  const SceneTexels& texels = scene->texels;
 
-  std::vector<GLfloat> pixels(size_t(std::pow(side_len, 2)) * 3);
-  for (size_t i = 0; i < bvh.nodes.size(); i++) {
-    reinterpret_cast<BBox*>(pixels.data())[i] = BBox(bvh.nodes[i]);
+  // ordered traversal pushes at most one node per level.
+  const size_t bvh_depth = bvhDepth(bvh);
+  scene->bvh_stack = bvh_depth <= kBVH_STACK_SIZE + 1;
+  if (!scene->bvh_stack) {
+    LOG_INFO("BVH depth ", bvh_depth, " exceeds the shader stack, ",
+             "use stackless traversal");
   }
+  scene->materials = 0;
+  for (const Polygon& pol : bvh.polygons) {
+    scene->materials |= 1u << pol.material;
+  }
+  scene->sah_cost = bvh.sahCost();
 
-  std::vector<GLint> ipixels(size_t(side_len * 3));
-  for (size_t i = 0; i < bvh.nodes.size(); i++) {
-    if (bvh.nodes[i].leaf) {
-      ipixels[3 * i + 0] = GLint(bvh.nodes[i].s_idx);
-      ipixels[3 * i + 1] = GLint(bvh.nodes[i].e_idx);
-    } else {
-      ipixels[3 * i + 0] = -1;
-      ipixels[3 * i + 1] = -1;
-    }
-    if (bvh.nodes[i].brother != size_t(-1)) {
-      ipixels[3 * i + 2] = GLint(bvh.nodes[i].brother);
-    } else {
-      ipixels[3 * i + 2] = -1;
+  // setup texture buffers for sending polygon data.
+  if (!scene->tri_tex.init(texels.triangles.size / 4, kTRI_UNIT, GL_RGBA32F,
+                           texels.triangles.data) ||
+      !scene->mat_tex.init(texels.materials.size / 4, kMAT_UNIT, GL_RGBA32F,
+                           texels.materials.data) ||
+      !scene->bvh_tex.init(texels.bounds.size / 4, kBVH_UNIT, GL_RGBA32F,
+                           texels.bounds.data) ||
+      !scene->bvh_info_tex.init(texels.info.size / 4, kBVH_INFO_UNIT,
+                                GL_RGBA32I, texels.info.data) ||
+      !scene->light_tex.init(texels.lights.size / 4, kLIGHT_UNIT, GL_RGBA32I,
+                             texels.lights.data)) {
+    std::cerr << "GlslRayTraceRenderer : scene is too big for this GPU !"
+              << std::endl;
+    return false;
+  }
+  SceneParams params = SceneParams();
+  params.bvh_size = GLint(bvh.nodes.size());
+  params.num_light = GLint(texels.lights.size / 4);
+  params.light_power = texels.light_power;
+  scene->params.init(kSCENE_BINDING, sizeof(params), &params);
+  return true;
+}
+
+// call upload(s, e) for ranges [s, e) which cover sorted indices, joining
+// indices closer than kUPLOAD_GAP.
+template <class F>
+void forEachRange(const std::vector<size_t>& indices, const F& upload) {
+  size_t i = 0;
+  while (i < indices.size()) {
+    size_t j = i + 1;
+    while (j < indices.size() && indices[j] - indices[j - 1] <= kUPLOAD_GAP) {
+      j++;
     }
+    upload(indices[i], indices[j - 1] + 1);
+    i = j;
   }
+}
 
-  coord_tex->init({{side_len, side_len}}, -1, GL_RGB16F, GL_RGB, &pixels[0],
-                  GL_NEAREST);
-  info_tex->init({{side_len}}, -1, GL_RGB16I, GL_RGB_INTEGER, &ipixels[0],
-                 GL_NEAREST);
+const std::string& vertexShaderSource() {
+  static const std::string src =
+#include "test.vert"
+      ;
+  return src;
+}
 
-  return true;
+const std::string& fragmentShaderSource() {
+  static const std::string src =
+#include "test.frag"
+      ;
+  return src;
 }
 
-void imageProcessing(const float& brightness, const float& gamma,
-                     const size_t& num_sample, std::vector<GLfloat>* pixels) {
-  for (auto& pixel : *pixels) {
-    pixel = std::max(0.f, std::min(1.f, brightness * pixel / num_sample));
-    pixel = std::pow(pixel, gamma);
+// defines of the shader variant for scene and config, which compile out
+// branches of absent materials and bound loops by constants.
+std::string shaderDefines(const GlslRayTraceRenderer::GpuScene& scene,
+                          const RenderConfig& config) {
+  // always has a decimal point, so it is a float literal.
+  char roulette[32];
+  std::snprintf(roulette, sizeof(roulette), "%#.9g", double(config.roulette));
+  std::string defines = "#define SCENE_FEATURES\n";
+  defines += "#define kMAX_DEPTH " + std::to_string(config.max_depth) + "\n";
+  defines += "#define kROULETTE " + std::string(roulette) + "\n";
+  if (scene.materials & (1u << Material::Light)) {
+    defines += "#define HAS_LIGHT\n";
+  }
+  if (scene.materials & (1u << Material::DirLight)) {
+    defines += "#define HAS_DIR_LIGHT\n";
   }
+  if (scene.texels.lights.size > 0) defines += "#define USE_NEE\n";
+  if (!scene.bvh_stack) defines += "#define BVH_STACKLESS\n";
+  return defines;
 }
 
 }  // namespace
 
-bool GlslRayTraceRenderer::init() {
+bool GlslRayTraceRenderer::initWindow() {
   if (!glfwInit()) {
     return false;
   }  // glfw3
@@ -159,6 +368,33 @@ bool GlslRayTraceRenderer::init() {
     printf("Error: %s\n", glewGetErrorString(glew_status));
     glfwDestroyWindow(window);
     glfwTerminate();
+    window = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool GlslRayTraceRenderer::initHeadless() {
+  if (!headless_context.init(3, 3)) {
+    return false;
+  }
+
+  // glewInit also loads GLX functions and fails without X display,
+  // so load only the core functions.
+  glewExperimental = GL_TRUE;
+  GLenum glew_status = glewContextInit();
+  if (glew_status != GLEW_OK) {
+    printf("Error: %s\n", glewGetErrorString(glew_status));
+    headless_context.destroy();
+    return false;
+  }
+  // glew may leave GL_INVALID_ENUM of glGetString(GL_EXTENSIONS).
+  glGetError();
+  return true;
+}
+
+bool GlslRayTraceRenderer::init() {
+  if (!(r_config.headless ? initHeadless() : initWindow())) {
     return false;
   }
   CHECK_GL_ERROR();
@@ -167,34 +403,221 @@ bool GlslRayTraceRenderer::init() {
   DEBUG_LOG("OpenGL vender : ", getGLVendor());
   DEBUG_LOG("OpenGL renderer : ", getGLRenderer());
 
-  // setup vertex shader and fragment shader
-  GLint link_ok = GL_FALSE;
-  std::string vs_string =
-#include "test.vert"
-      ;
-  std::string fs_string =
-#include "test.frag"
-      ;
-  vs_id = create_shader_from_src(vs_string.c_str(), GL_VERTEX_SHADER);
-  fs_id = create_shader_from_src(fs_string.c_str(), GL_FRAGMENT_SHADER);
-
-  gl_program_id = glCreateProgram();
-  glAttachShader(gl_program_id, vs_id);
-  glAttachShader(gl_program_id, fs_id);
-  glLinkProgram(gl_program_id);
-  glGetProgramiv(gl_program_id, GL_LINK_STATUS, &link_ok);
-  if (!link_ok) {
-    fprintf(stderr, "glLinkProgram:");
-    return false;
+  // shaders are compiled for each scene at render().
+  program_cache.reset(new ProgramBinaryCache(r_config.program_cache_dir));
+  CHECK_GL_ERROR();
+
+  return true;
+}
+
+std::shared_ptr<LinkedProgram> GlslRayTraceRenderer::getProgram(
+    const GpuScene& gpu_scene, const RenderConfig& config) {
+  const std::string defines = shaderDefines(gpu_scene, config);
+  if (std::shared_ptr<LinkedProgram>* program = programs.get(defines)) {
+    return *program;
   }
 
-  glUseProgram(gl_program_id);
+  // defines follow the #version line.
+  std::string fs_src = fragmentShaderSource();
+  const size_t version = fs_src.find("#version");
+  const size_t line_end = fs_src.find('\n', version);
+  assert(version != std::string::npos && line_end != std::string::npos);
+  fs_src.insert(line_end + 1, defines);
+
+  const auto start_time = std::chrono::steady_clock::now();
+  bool loaded = false;
+  const GLuint id =
+      program_cache->link(vertexShaderSource(), fs_src, &loaded);
+  if (id == 0) return nullptr;
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start_time;
+  LOG_INFO(loaded ? "Load" : "Compile", " shader variant in ",
+           elapsed.count(), " sec");
+  DEBUG_LOG("Shader defines :\n", defines);
+
+  // samplers and blocks never move, so draws only bind textures and buffers.
+  glUseProgram(id);
+  for (const auto& sampler : kSAMPLER_UNITS) {
+    const GLint loc = glGetUniformLocation(id, sampler.name);
+    if (loc != -1) glUniform1i(loc, sampler.unit);
+  }
+  UniformBuffer::bindBlock(id, "RenderParams", kRENDER_BINDING);
+  UniformBuffer::bindBlock(id, "SceneParams", kSCENE_BINDING);
   CHECK_GL_ERROR();
+  auto program = std::make_shared<LinkedProgram>(id);
+  programs.put(defines, program, 1);
+  return program;
+}
+size_t GlslRayTraceRenderer::GpuScene::bytes() const {
+  return tri_tex.getByteSize() + mat_tex.getByteSize() + bvh_tex.getByteSize() +
+         bvh_info_tex.getByteSize() + light_tex.getByteSize() +
+         params.getByteSize();
+}
 
+bool GlslRayTraceRenderer::setPolygons(const std::vector<Polygon>& polygons_,
+                                       const BVH::Config& bvh_config) {
+  auto loaded = std::make_shared<GpuScene>();
+  BVH& bvh = loaded->bvh;
+  SceneTexels& texels = loaded->texels;
+  loaded->hash = hashScene(polygons_);
+  bvh.config = bvh_config;
+
+  // reuse BVH and texels built by a previous run.
+  const uint64_t cache_key = SceneCache::key(loaded->hash, bvh_config);
+  const std::string cache_path =
+      r_config.scene_cache_dir.empty()
+          ? ""
+          : SceneCache::path(r_config.scene_cache_dir, cache_key);
+  if (!cache_path.empty() &&
+      SceneCache::load(cache_path, cache_key, &bvh, &texels)) {
+    LOG_INFO("Load scene cache : ", cache_path);
+  } else {
+    // make BVH
+    if (!bvh.init(polygons_)) {
+      return false;
+    }
+    // pack texels of the textures.
+    texels.bright_mag = computeBrightMagnification(&bvh.polygons);
+    if (!packSceneTexels(bvh, &texels)) {
+      return false;
+    }
+
+    if (!cache_path.empty() &&
+        SceneCache::save(cache_path, cache_key, bvh, texels)) {
+      LOG_INFO("Save scene cache : ", cache_path);
+    }
+  }
+
+  if (!uploadScene(loaded.get())) {
+    return false;
+  }
+  scene = loaded;
   return true;
 }
+
+bool GlslRayTraceRenderer::updateVertices(const std::vector<Vec>& vertices) {
+  if (scene == nullptr) return false;
+  GpuScene& gpu_scene = *scene;
+  BVH& bvh = gpu_scene.bvh;
+  SceneTexels& texels = gpu_scene.texels;
+
+  std::vector<size_t> moved_polygons, moved_nodes;
+  if (!bvh.refit(vertices, &moved_polygons, &moved_nodes)) return false;
+  if (moved_polygons.empty()) return true;
+
+  const real cost = bvh.sahCost();
+  if (cost > gpu_scene.sah_cost * kMAX_REFIT_COST) {
+    LOG_INFO("SAH cost of BVH grows from ", gpu_scene.sah_cost, " to ", cost,
+             " by refit, build it again");
+    // in the order of the polygons of setPolygons(), so order of the new
+    // BVH refers to them too. colors of emitters are normalized already.
+    std::vector<Polygon> pols(bvh.polygons.size(), bvh.polygons[0]);
+    for (size_t i = 0; i < bvh.polygons.size(); i++) {
+      pols[bvh.order[i]] = bvh.polygons[i];
+    }
+    if (!bvh.init(pols) || !packSceneTexels(bvh, &texels) ||
+        !uploadScene(&gpu_scene)) {
+      return false;
+    }
+    gpu_scene.hash = hashScene(bvh.polygons);
+    return true;
+  }
+
+  // links of nodes and materials don't change, only moved triangles and
+  // bounds of nodes are uploaded.
+  std::vector<TriangleData> triangles;
+  forEachRange(moved_polygons, [&](const size_t& s, const size_t& e) {
+    triangles.assign(bvh.polygons.begin() + long(s),
+                     bvh.polygons.begin() + long(e));
+    gpu_scene.tri_tex.subData(s * sizeof(TriangleData),
+                              triangles.size() * sizeof(TriangleData),
+                              triangles.data());
+  });
+  std::vector<BBox> bounds;
+  forEachRange(moved_nodes, [&](const size_t& s, const size_t& e) {
+    bounds.assign(bvh.nodes.begin() + long(s), bvh.nodes.begin() + long(e));
+    gpu_scene.bvh_tex.subData(s * sizeof(BBox), bounds.size() * sizeof(BBox),
+                              bounds.data());
+  });
+
+  // the alias table depends on areas of all emitters, so it is packed again
+  // as a whole when one of them moves. it is small beside the triangles.
+  const bool light_moved =
+      std::any_of(moved_polygons.begin(), moved_polygons.end(),
+                  [&](const size_t& i) {
+                    return bvh.polygons[i].material == Material::Light;
+                  });
+  if (light_moved) {
+    packLightTexels(bvh.polygons, &texels.light_storage, &texels.light_power);
+    texels.lights = texels.light_storage;
+    if (!gpu_scene.light_tex.init(texels.lights.size / 4, kLIGHT_UNIT,
+                                  GL_RGBA32I, texels.lights.data)) {
+      return false;
+    }
+    SceneParams params = SceneParams();
+    params.bvh_size = GLint(bvh.nodes.size());
+    params.num_light = GLint(texels.lights.size / 4);
+    params.light_power = texels.light_power;
+    gpu_scene.params.subData(0, sizeof(params), &params);
+  }
+  gpu_scene.hash = hashScene(bvh.polygons);
+  return true;
+}
+
 int GlslRayTraceRenderer::start() {
-  if (window == nullptr) return -1;
+  Job job;
+  job.width = r_config.width;
+  job.height = r_config.height;
+  job.n_sample = r_config.max_sample;
+  const int result = render(r_config, job, nullptr);
+  // GL objects of render() are gone, then programs and the scene are
+  // deleted before the context.
+  programs.clear();
+  scene.reset();
+  if (r_config.headless) {
+    headless_context.destroy();
+  } else {
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    window = nullptr;
+  }
+  return result;
+}
+
+int GlslRayTraceRenderer::start(const RenderConfig& config) {
+  if (!headless_context.isValid() || !config.headless) return -1;
+  Job job;
+  job.width = config.width;
+  job.height = config.height;
+  job.n_sample = config.max_sample;
+  return render(config, job, nullptr);
+}
+
+bool GlslRayTraceRenderer::renderJob(const Job& job,
+                                     std::vector<float>* pixels) {
+  if (!headless_context.isValid() || pixels == nullptr || job.x < 0 ||
+      job.y < 0 || job.width <= 0 || job.height <= 0 ||
+      job.x + job.width > r_config.width ||
+      job.y + job.height > r_config.height) {
+    return false;
+  }
+  return render(r_config, job, pixels) == 0;
+}
+
+int GlslRayTraceRenderer::render(const RenderConfig& config, const Job& job,
+                                 std::vector<float>* pixels) {
+  if (window == nullptr && !headless_context.isValid()) return -1;
+  if (scene == nullptr) return -1;
+  const GpuScene& gpu_scene = *scene;
+  const SceneTexels& texels = gpu_scene.texels;
+  // jobs only sample, everything else is done by whoever merges them.
+  const bool is_job = pixels != nullptr;
+
+  // kept even if evicted by another render.
+  const std::shared_ptr<LinkedProgram> program = getProgram(gpu_scene, config);
+  if (program == nullptr) return -1;
+  const GLuint gl_program_id = program->id;
+  glUseProgram(gl_program_id);
 
   // attribute
   std::vector<GLfloat> triangle_attribute{
@@ -202,128 +625,578 @@ int GlslRayTraceRenderer::start() {
   };
   QuadDrawer quad("coord2d", gl_program_id, triangle_attribute);
 
-  // setup texture for sending polygon data.
-  const float bright_mag = computeBrightMagnification(&bvh.polygons);
+  const float bright_mag = texels.bright_mag;
 
-  auto tri_tex = setupTriangleTexture(tex_side_len, bvh.polygons);
-  if (tri_tex == nullptr) {
-    std::cerr << "GlslRayTraceRenderer : size of polygons is too big !"
-              << std::endl;
-    std::cerr << "GlslRayTraceRenderer : "
-                 "please edit tex_side_len in constructor."
-              << std::endl;
-    return -1;
+  // tables of the sampler, same for all frames.
+  TextureBuffer blue_noise_tex;
+  blue_noise_tex.init(PixelSampler::blueNoise().size(), kBLUE_NOISE_UNIT,
+                      GL_R32F,
+                      PixelSampler::blueNoise().data());
+
+  // for off screen rendering, setup the accumulator (and framebuffer).
+  // draws add sums of samples to rgb and their counts to a by blending, so
+  // tiles of a frame can be drawn in pieces. second moments of samples and
+  // AOVs of first hits are added to the other attachments at the same time.
+  OpenGLTexture<GL_TEXTURE_2D, GLfloat> accumulator, moments, aov_normal,
+      aov_albedo;
+  OpenGLTexture<GL_TEXTURE_2D, GLfloat>* const layers[] = {
+      &accumulator, &moments, &aov_normal, &aov_albedo};
+  static_assert(sizeof(layers) / sizeof(layers[0]) == CheckpointHeader::kLAYER,
+                "checkpoint saves all attachments");
+  for (size_t i = 0; i < CheckpointHeader::kLAYER; i++) {
+    layers[i]->init({{config.width, config.height}}, int(kLAYER_UNIT + i),
+                    GL_RGBA32F, GL_RGBA, nullptr, GL_NEAREST);
+    layers[i]->initFrameBuffer();
+    if (i > 0) accumulator.attachColorBuffer(*layers[i], GLuint(i));
   }
+  accumulator.bindFB();
+  glClearColor(0.f, 0.f, 0.f, 0.f);
+  glClear(GL_COLOR_BUFFER_BIT);
+  accumulator.resetFB();
 
-  auto bvh_info_tex = std::make_shared<OpenGLTexture<GL_TEXTURE_1D, GLint>>();
-  auto bvh_tex = std::make_shared<OpenGLTexture<GL_TEXTURE_2D, GLfloat>>();
-  if (!setupBVHTexture(tex_side_len, bvh, bvh_tex, bvh_info_tex)) {
-    std::cerr << "GlslRayTraceRenderer : size of bvh is too big !" << std::endl;
-    std::cerr << "GlslRayTraceRenderer : "
-                 "please edit tex_side_len in constructor."
-              << std::endl;
-    return -1;
+  // errors of blocks of kBLOCK_SIZE pixels, and the mask of converged ones.
+  const int n_block_x = (config.width + kBLOCK_SIZE - 1) / kBLOCK_SIZE;
+  const int n_block_y = (config.height + kBLOCK_SIZE - 1) / kBLOCK_SIZE;
+  const size_t n_block = size_t(n_block_x) * size_t(n_block_y);
+  OpenGLTexture<GL_TEXTURE_2D, GLfloat> block_error;
+  block_error.init({{n_block_x, n_block_y}}, kBLOCK_ERROR_UNIT, GL_RGBA32F,
+                   GL_RGBA, nullptr, GL_NEAREST);
+  block_error.initFrameBuffer();
+  std::vector<GLubyte> no_mask(n_block, 0);
+  OpenGLTexture<GL_TEXTURE_2D, GLubyte> mask_tex;
+  mask_tex.init({{n_block_x, n_block_y}}, kMASK_UNIT, GL_R8, GL_RED,
+                no_mask.data(), GL_NEAREST);
+
+  // constants of the render and the scene are read from uniform blocks.
+  RenderParams params = RenderParams();
+  auto set_camera = [&](const Vec& pos, const Vec& dir) {
+    const Vec d = normalize(dir);
+    const float camera[6] = {pos.x, pos.y, pos.z, d.x, d.y, d.z};
+    std::copy(camera, camera + 3, params.camera_pos);
+    std::copy(camera + 3, camera + 6, params.camera_dir);
+  };
+  set_camera(config.camera_pos, config.camera_dir);
+  params.aspect_ratio = float(config.width) / float(config.height);
+  params.sampler_type = GLint(config.sampler);
+  params.sampler_seed = config.sampler_seed;
+  params.brightness = bright_mag;
+  params.gamma = config.gamma;
+  std::memcpy(params.sobol_dir, PixelSampler::sobolDirections(),
+              sizeof(params.sobol_dir));
+  UniformBuffer render_params;
+  render_params.init(kRENDER_BINDING, sizeof(params), &params);
+  render_params.bind();
+  gpu_scene.params.bind();
+
+  // uniforms of draws and passes. others are set once.
+  auto uniform_loc = [&](const char* name) {
+    GLint loc = -1;
+    getUniLoc(name, loc, gl_program_id);
+    return loc;
+  };
+  const GLint num_sample_loc = uniform_loc("num_sample");
+  const GLint sample_index_loc = uniform_loc("sample_index");
+  const GLint only_draw_loc = uniform_loc("onlyDraw");
+  const GLint estimate_error_loc = uniform_loc("estimateError");
+  const GLint atrous_step_loc = uniform_loc("atrous_step");
+  const GLint atrous_last_loc = uniform_loc("atrous_last");
+
+  // denoise passes alternate between two textures, and the last one writes
+  // (radiance, 1) so it is displayed and saved as an accumulator.
+  const bool use_denoise = !is_job && config.denoise_pass > 0;
+  OpenGLTexture<GL_TEXTURE_2D, GLfloat> denoised[2];
+  for (int i = 0; i < 2; i++) {
+    denoised[i].init({{config.width, config.height}}, kDENOISED_UNIT + i,
+                     GL_RGBA32F, GL_RGBA, nullptr, GL_NEAREST);
+    denoised[i].initFrameBuffer();
   }
 
-  // for off screen rendering, setup two textures (and framebuffer).
-  OpenGLTexture<GL_TEXTURE_2D, GLfloat> accumulator[2];
-  accumulator[0].init({{r_config.width, r_config.height}}, -1, GL_RGBA32F,
-                      GL_RGBA, nullptr, GL_NEAREST);
-  accumulator[1].init({{r_config.width, r_config.height}}, -1, GL_RGBA32F,
-                      GL_RGBA, nullptr, GL_NEAREST);
-  accumulator[0].initFrameBuffer();
-  accumulator[1].initFrameBuffer();
-
-  UniformLocContainer uni_locs;
-
-  uni_locs.add("brightness", gl_program_id);
-  uni_locs.add("TRI_TEX_COL", gl_program_id);
-  uni_locs.add("num_tri", gl_program_id);
-  uni_locs.add("aspect_ratio", gl_program_id);
-  uni_locs.add("rand_seed", gl_program_id);
-  uni_locs.add("num_sample", gl_program_id);
-  uni_locs.add("gamma", gl_program_id);
-  uni_locs.add("onlyDraw", gl_program_id);
-  uni_locs.add("bvh_size", gl_program_id);
+  // the window moves the camera. then the accumulator starts again, and
+  // previews of low resolution are shown until its first frame is drawn.
+  const bool use_camera = !config.headless;
+  OpenGLTexture<GL_TEXTURE_2D, GLfloat> previews[kNUM_PREVIEW];
+  for (size_t i = 0; use_camera && i < kNUM_PREVIEW; i++) {
+    const int scale = kPREVIEW_SCALE[i];
+    previews[i].init({{std::max(1, (config.width + scale - 1) / scale),
+                       std::max(1, (config.height + scale - 1) / scale)}},
+                     kDISPLAY_UNIT, GL_RGBA32F, GL_RGBA, nullptr,
+                     GL_NEAREST);
+    previews[i].initFrameBuffer();
+  }
 
-  FpsCounter fps;
-  fps.init();
+  // textures of the samplers. after the first draw, binding them again
+  // makes no GL call.
+  TextureBindingCache bindings;
+  auto bind_textures = [&]() {
+    bindings.bind(kTRI_UNIT, gpu_scene.tri_tex);
+    bindings.bind(kMAT_UNIT, gpu_scene.mat_tex);
+    bindings.bind(kBVH_UNIT, gpu_scene.bvh_tex);
+    bindings.bind(kBVH_INFO_UNIT, gpu_scene.bvh_info_tex);
+    bindings.bind(kLIGHT_UNIT, gpu_scene.light_tex);
+    bindings.bind(kBLUE_NOISE_UNIT, blue_noise_tex);
+    for (size_t i = 0; i < CheckpointHeader::kLAYER; i++) {
+      bindings.bind(GLuint(kLAYER_UNIT + i), *layers[i]);
+    }
+    bindings.bind(kMASK_UNIT, mask_tex);
+  };
 
-  // Main Loop
-  size_t n = 1;
-  while (!glfwWindowShouldClose(window)) {
-    // if number sampled greater than r_config.max_sample, don't render.
-    if (size_t(n - 1) * size_t(r_config.n_sample_frame) < r_config.max_sample) {
-      tri_tex->uniform(gl_program_id, "tri_tex");
-      bvh_tex->uniform(gl_program_id, "bvh_tex");
-      bvh_info_tex->uniform(gl_program_id, "bvh_info_tex");
-      accumulator[(n + 1) % 2].uniform(gl_program_id, "d_tex");
-      glUniform1i(uni_locs["TRI_TEX_COL"], tex_side_len);
-      glUniform1i(uni_locs["num_tri"], GLint(bvh.polygons.size()));
-      glUniform1i(uni_locs["bvh_size"], GLint(bvh.nodes.size()));
-      glUniform1f(uni_locs["aspect_ratio"],
-                  float(r_config.width) / float(r_config.height));
-      glUniform4f(uni_locs["rand_seed"], rand_(), rand_(), rand_(), rand_());
-      glUniform1i(uni_locs["onlyDraw"], false);
-      glUniform1i(uni_locs["num_sample"], r_config.n_sample_frame);
-
-      glViewport(0, 0, r_config.width, r_config.height);
-
-      accumulator[n % 2].bindFB();
+  // 1 sample per pixel of the whole image, without blending.
+  auto draw_preview = [&](const OpenGLTexture<GL_TEXTURE_2D, GLfloat>& tex) {
+    bind_textures();
+    tex.bindFB();
+    glViewport(0, 0, tex.getSize()[0], tex.getSize()[1]);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glUniform1ui(sample_index_loc, 0);
+    glUniform1i(num_sample_loc, 1);
+    quad.draw();
+    tex.resetFB();
+  };
+
+  auto denoise = [&]() -> const OpenGLTexture<GL_TEXTURE_2D, GLfloat>& {
+    bind_textures();
+    glViewport(0, 0, config.width, config.height);
+    for (int i = 0; i < config.denoise_pass; i++) {
+      bindings.bind(kDENOISE_INPUT_UNIT, denoised[(i + 1) % 2]);
+      glUniform1i(atrous_step_loc, 1 << i);
+      glUniform1i(atrous_last_loc, i + 1 == config.denoise_pass);
+      denoised[i % 2].bindFB();
       quad.draw();
-      glFlush();
-      accumulator[0].resetFB();
+    }
+    glUniform1i(atrous_step_loc, 0);
+    denoised[0].resetFB();
+    return denoised[(config.denoise_pass - 1) % 2];
+  };
+  // image to display and to save.
+  auto result_texture = [&]() -> const OpenGLTexture<GL_TEXTURE_2D, GLfloat>& {
+    return use_denoise ? denoise() : accumulator;
+  };
 
-      n++;
+  // snapshots are read back by pixel buffer objects, then tone mapped and
+  // saved on a worker thread.
+  AsyncPixelReader pixel_reader;
+  SnapshotWriter snapshot_writer(bright_mag, config.gamma);
+  // the last snapshots wait for the writer instead of being skipped, so the
+  // final image is always saved.
+  bool last_snapshot = false;
+  auto on_readback = [&](std::vector<GLfloat>&& pixels, const size_t&) {
+    Snapshot snapshot;
+    snapshot.pixels = std::move(pixels);
+    snapshot.width = config.width;
+    snapshot.height = config.height;
+    snapshot.filename = config.output_path;
+    snapshot.format = config.output_format;
+    if (!snapshot_writer.push(std::move(snapshot), last_snapshot)) {
+      LOG_INFO("Snapshot is skipped, previous ones are still being saved.");
+    }
+  };
+  auto request_snapshot = [&](const size_t& frame) {
+    if (frame == 0) return;
+    if (!pixel_reader.request(result_texture(), frame)) {
+      LOG_INFO("Snapshot is skipped, too many readbacks in flight.");
     }
+  };
 
-    // display result.
-    if (r_config.display) {
-      if (w_config.is_retina) {
-        glViewport(0, 0, r_config.width * 2, r_config.height * 2);
+  // checkpoints are read back like snapshots and saved by a pool task.
+  // headers wait in request order.
+  // layers are tagged by their index and wait for the last one.
+  AsyncPixelReader checkpoint_reader(CheckpointHeader::kLAYER);
+  std::deque<CheckpointHeader> checkpoint_headers;
+  std::vector<std::vector<GLfloat>> checkpoint_layers;
+  // stops when the camera moves, as checkpoints are of config_camera.
+  const float config_camera[6] = {
+      config.camera_pos.x, config.camera_pos.y, config.camera_pos.z,
+      config.camera_dir.x, config.camera_dir.y, config.camera_dir.z};
+  bool use_checkpoint = !is_job && !config.checkpoint_path.empty();
+  // saves run on a thread of their own. in the shared pool, they wait for
+  // other tasks, or until wait() if it has no worker, and skip checkpoints
+  // meanwhile.
+  ThreadPool checkpoint_pool(use_checkpoint ? 2 : 1);
+  TaskGroup checkpoint_task(checkpoint_pool);
+  auto on_checkpoint = [&](std::vector<GLfloat>&& pixels, const size_t& tag) {
+    checkpoint_layers.emplace_back(std::move(pixels));
+    if (tag + 1 < CheckpointHeader::kLAYER) return;
+    const CheckpointHeader header = checkpoint_headers.front();
+    checkpoint_headers.pop_front();
+    auto data = std::make_shared<std::vector<std::vector<GLfloat>>>(
+        std::move(checkpoint_layers));
+    checkpoint_layers.clear();
+    const std::string path = config.checkpoint_path;
+    checkpoint_task.run([header, data, path]() {
+      const float* pixels[CheckpointHeader::kLAYER];
+      for (size_t i = 0; i < CheckpointHeader::kLAYER; i++) {
+        pixels[i] = (*data)[i].data();
       }
-      accumulator[n % 2].uniform(gl_program_id, "d_tex");
-      glUniform1i(uni_locs["onlyDraw"], true);
-      glUniform1f(uni_locs["brightness"], bright_mag);
-      glUniform1f(uni_locs["gamma"], r_config.gamma);
-      glUniform1i(uni_locs["num_sample"], int(n));
-      glUseProgram(gl_program_id);
+      if (Checkpoint::save(path, header, pixels)) {
+        LOG_INFO("Save Checkpoint : ", path, " (", header.num_frame,
+                 " frames)");
+      }
+    });
+  };
+  // only at frame boundaries, as resume starts from a whole frame.
+  auto request_checkpoint = [&](const size_t& frame) {
+    if (frame == 0 || checkpoint_task.isRunning() ||
+        checkpoint_reader.numPending() != 0) {
+      return false;
+    }
+    for (size_t i = 0; i < CheckpointHeader::kLAYER; i++) {
+      checkpoint_reader.request(*layers[i], i);
+    }
+    CheckpointHeader header;
+    header.width = uint32_t(config.width);
+    header.height = uint32_t(config.height);
+    header.n_sample_frame = uint32_t(config.n_sample_frame);
+    header.num_frame = frame;
+    header.sampler_type = uint32_t(config.sampler);
+    header.sampler_seed = config.sampler_seed;
+    header.scene_hash = gpu_scene.hash;
+    header.max_depth = uint32_t(config.max_depth);
+    header.roulette = config.roulette;
+    std::copy(config_camera, config_camera + 3, header.camera_pos);
+    std::copy(config_camera + 3, config_camera + 6, header.camera_dir);
+    checkpoint_headers.emplace_back(header);
+    return true;
+  };
+  auto save_last_checkpoint = [&](const size_t& frame) {
+    if (!use_checkpoint) return;
+    checkpoint_reader.finish(on_checkpoint);
+    checkpoint_task.wait();
+    request_checkpoint(frame);
+    checkpoint_reader.finish(on_checkpoint);
+    checkpoint_task.wait();
+  };
+
+  auto same_camera = [&](const CheckpointHeader& header) {
+    return std::equal(config_camera, config_camera + 3, header.camera_pos) &&
+           std::equal(config_camera + 3, config_camera + 6, header.camera_dir);
+  };
+
+  // resume from checkpoint of the same scene, camera and settings.
+  size_t n = 1;
+  if (use_checkpoint) {
+    Checkpoint checkpoint;
+    if (checkpoint.open(config.checkpoint_path)) {
+      const CheckpointHeader& header = checkpoint.header();
+      if (header.width == uint32_t(config.width) &&
+          header.height == uint32_t(config.height) &&
+          header.n_sample_frame == uint32_t(config.n_sample_frame) &&
+          header.sampler_type == uint32_t(config.sampler) &&
+          header.sampler_seed == config.sampler_seed &&
+          header.scene_hash == gpu_scene.hash &&
+          header.max_depth == uint32_t(config.max_depth) &&
+          header.roulette == config.roulette &&
+          same_camera(header)) {
+        for (size_t i = 0; i < CheckpointHeader::kLAYER; i++) {
+          layers[i]->subImage({{0, 0}}, {{config.width, config.height}},
+                              GL_RGBA,
+                              const_cast<GLfloat*>(checkpoint.layer(i)));
+        }
+        n = size_t(header.num_frame) + 1;
+        LOG_INFO("Resume from ", config.checkpoint_path, " (",
+                 header.num_frame, " frames)");
+      } else {
+        LOG_INFO("Checkpoint is of another scene, camera or setting : ",
+                 config.checkpoint_path);
+      }
+    }
+  }
+
+  // frame n of the job rect is drawn by tiles of about dispatch_time each.
+  TileScheduler scheduler(job.width, job.height, config.n_sample_frame,
+                          config.dispatch_time);
+  scheduler.setEstimate(gpu_scene.ns_per_sample);
+
+  // draw dispatches until the frame ends, or for about a display refresh
+  // unless until_frame_end. returns true if frame n is completed.
+  auto draw_frame = [&](const bool& until_frame_end) {
+    bind_textures();
+
+    glViewport(0, 0, config.width, config.height);
+
+    accumulator.bindFB();
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    glEnable(GL_SCISSOR_TEST);
+
+    const auto draw_start = std::chrono::steady_clock::now();
+    bool frame_end = false;
+    while (!frame_end) {
+      const TileScheduler::Dispatch d = scheduler.next();
+      glUniform1ui(sample_index_loc,
+                   GLuint(job.first_sample +
+                          size_t(n - 1) * size_t(config.n_sample_frame) +
+                          size_t(d.sample_offset)));
+      glUniform1i(num_sample_loc, d.n_sample);
+      glScissor(job.x + d.x, job.y + d.y, d.width, d.height);
 
+      scheduler.begin(d);
       quad.draw();
-      CHECK_GL_ERROR();
+      scheduler.end(d);
+      glFlush();
+
+      frame_end = d.end_of_frame;
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - draw_start;
+      if (!until_frame_end && elapsed.count() >= kDRAW_PERIOD) break;
     }
 
-    glfwSwapBuffers(window);
-    glfwPollEvents();
-    CHECK_GL_ERROR();
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_BLEND);
+    accumulator.resetFB();
 
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE)) {
-      glfwSetWindowShouldClose(window, 1);
+    if (frame_end) {
+      n++;
+      scene->ns_per_sample = scheduler.nsPerSample();
+    }
+    return frame_end;
+  };
+
+  // errors of blocks are drawn and read back after frames. blocks under
+  // adaptive_threshold are masked from the next frame boundary.
+  const bool use_adaptive = !is_job && config.adaptive_threshold > 0.f;
+  const bool use_error =
+      use_adaptive || (!is_job && config.noise_threshold > 0.f);
+  AsyncPixelReader error_reader(2);
+  std::vector<GLubyte> next_mask;
+  bool noise_reached = false;
+  // requested before the camera moved, then dropped.
+  size_t n_stale_error = 0;
+  auto request_error = [&](const size_t& frame) {
+    if (error_reader.isFull()) return;
+    block_error.bindFB();
+    glViewport(0, 0, n_block_x, n_block_y);
+    bind_textures();
+    glUniform1i(estimate_error_loc, true);
+    quad.draw();
+    glUniform1i(estimate_error_loc, false);
+    block_error.resetFB();
+    error_reader.request(block_error, frame);
+  };
+  auto on_error = [&](std::vector<GLfloat>&& errors, const size_t& frame) {
+    if (n_stale_error > 0) {
+      n_stale_error--;
+      return;
+    }
+    next_mask.assign(n_block, 0);
+    double sum = 0.0, n_pixel = 0.0;
+    size_t n_converged = 0;
+    for (size_t i = 0; i < n_block; i++) {
+      // (max error, sum of errors, pixels, min samples)
+      const GLfloat* error = &errors[i * 4];
+      sum += double(error[1]);
+      n_pixel += double(error[2]);
+      if (use_adaptive && error[0] <= config.adaptive_threshold &&
+          error[3] >= float(config.adaptive_min_sample)) {
+        next_mask[i] = 255;
+        n_converged++;
+      }
+    }
+    const double mean_error = sum / std::max(1.0, n_pixel);
+    DEBUG_LOG("Frame ", frame, " : error ", mean_error, ", ", n_converged,
+              " / ", n_block, " blocks converged");
+    if (config.noise_threshold > 0.f &&
+        mean_error <= double(config.noise_threshold) && !noise_reached) {
+      LOG_INFO("Noise ", mean_error, " is under the threshold at frame ",
+               frame);
+      noise_reached = true;
     }
+    if (!use_adaptive) next_mask.clear();
+  };
+
+  // no more samples are needed. changes only at frame boundaries.
+  auto is_finished = [&]() {
+    return size_t(n - 1) * size_t(config.n_sample_frame) >= job.n_sample ||
+           scheduler.isConverged() || noise_reached;
+  };
+
+  FpsCounter fps;
+  fps.init();
 
-    if (glfwGetKey(window, GLFW_KEY_W)) {
-      std::vector<GLfloat> pixels(r_config.width * r_config.height * 3);
-      accumulator[n % 2].getPixelData(GL_RGB, &pixels[0]);
+  const auto start_time = std::chrono::steady_clock::now();
+  auto last_snapshot_time = start_time;
+  size_t last_snapshot_frame = n - 1;
+  auto last_checkpoint_time = start_time;
+  bool key_w_pressed = false;
+  const OpenGLTexture<GL_TEXTURE_2D, GLfloat>* display_tex = &accumulator;
 
-      imageProcessing(bright_mag, r_config.gamma, n - 1, &pixels);
+  const BVH& bvh = gpu_scene.bvh;
+  const real scene_size =
+      bvh.nodes.empty() ? 1 : length(bvh.nodes[0].end - bvh.nodes[0].start);
+  CameraController camera(config.camera_pos, config.camera_dir,
+                          scene_size * kCAMERA_SPEED);
+  // previews are shown instead of display_tex until a frame of the new view
+  // is drawn.
+  PreviewSchedule preview(static_cast<int>(kNUM_PREVIEW));
+  auto move_camera = [&]() {
+    set_camera(camera.pos, camera.dir);
+    render_params.subData(0, sizeof(params), &params);
+    accumulator.bindFB();
+    glClear(GL_COLOR_BUFFER_BIT);
+    accumulator.resetFB();
+    n = 1;
+    scheduler.restart();
+    mask_tex.subImage({{0, 0}}, {{n_block_x, n_block_y}}, GL_RED,
+                      no_mask.data());
+    next_mask.clear();
+    n_stale_error = error_reader.numPending();
+    noise_reached = false;
+    last_snapshot_frame = 0;
+    display_tex = &accumulator;
+    preview.restart();
+    if (use_checkpoint) {
+      LOG_INFO("Checkpoints stop, as the camera moved.");
+      use_checkpoint = false;
+    }
+  };
 
-      if (SaveImageAsPPM("out.ppm", pixels, r_config.width, r_config.height)) {
-        LOG_INFO("Save Image : ", "out.ppm");
+  // Main Loop
+  while (config.headless || !glfwWindowShouldClose(window)) {
+    // if number sampled greater than config.max_sample or converged,
+    // don't render. previews of a new view are drawn first, one a loop.
+    bool frame_end = false;
+    const int preview_idx = preview.next();
+    if (preview_idx >= 0) {
+      draw_preview(previews[preview_idx]);
+    } else if (!scheduler.atFrameStart() || !is_finished()) {
+      frame_end = draw_frame(false);
+      if (frame_end) preview.frameEnd();
+    }
+
+    // the mask changes only between frames, as each pixel of a frame has
+    // n_sample_frame samples or none.
+    if (use_error) {
+      if (frame_end) request_error(n - 1);
+      error_reader.poll(on_error);
+      if (!next_mask.empty() && scheduler.atFrameStart()) {
+        mask_tex.subImage({{0, 0}}, {{n_block_x, n_block_y}}, GL_RED,
+                          next_mask.data());
+        scheduler.setMask(next_mask, kBLOCK_SIZE);
+        next_mask.clear();
       }
     }
 
     // log fps avarage. and compute ray/sec.
-    if (-1 != fps.update()) {
+    if (frame_end && -1 != fps.update()) {
       size_t rps =
-          size_t(double(fps.ave_fps) * double(r_config.width) *
-                 double(r_config.height) * double(r_config.n_sample_frame));
+          size_t(double(fps.ave_fps) * double(job.width) *
+                 double(job.height) * double(config.n_sample_frame));
       std::clog << "fps : " << fps.fps << "  rps average : " << rps
                 << std::endl;
     }
+
+    // periodic snapshot of the latest complete frame.
+    const size_t latest_frame = n - 1;
+    if (!is_job && latest_frame != last_snapshot_frame &&
+        scheduler.atFrameStart()) {
+      const auto now = std::chrono::steady_clock::now();
+      const std::chrono::duration<double> since_snapshot =
+          now - last_snapshot_time;
+      if ((config.snapshot_sample > 0 &&
+           (latest_frame - last_snapshot_frame) *
+                   size_t(config.n_sample_frame) >=
+               config.snapshot_sample) ||
+          (config.snapshot_interval > 0.0 &&
+           since_snapshot.count() >= config.snapshot_interval)) {
+        request_snapshot(latest_frame);
+        last_snapshot_frame = latest_frame;
+        last_snapshot_time = now;
+      }
+    }
+    pixel_reader.poll(on_readback);
+
+    // periodic checkpoint.
+    if (use_checkpoint && config.checkpoint_interval > 0.0 &&
+        scheduler.atFrameStart()) {
+      const auto now = std::chrono::steady_clock::now();
+      const std::chrono::duration<double> since_checkpoint =
+          now - last_checkpoint_time;
+      if (since_checkpoint.count() >= config.checkpoint_interval &&
+          request_checkpoint(latest_frame)) {
+        last_checkpoint_time = now;
+      }
+    }
+    checkpoint_reader.poll(on_checkpoint);
+
+    // batch mode ends at max_sample or time budget, checked at frame
+    // boundaries.
+    if (config.headless) {
+      if (!scheduler.atFrameStart()) continue;
+      glFinish();  // without swap, wait for GPU here to measure time.
+      const size_t num_frame = n - 1;
+      // jobs are merged by sample counts, so they are never cut short.
+      if (is_job) {
+        if (!is_finished()) continue;
+        pixels->resize(size_t(job.width) * size_t(job.height) * 4);
+        accumulator.bindFB();
+        glReadPixels(job.x, job.y, job.width, job.height, GL_RGBA, GL_FLOAT,
+                     pixels->data());
+        accumulator.resetFB();
+        CHECK_GL_ERROR();
+        return 0;
+      }
+      const std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start_time;
+      const bool budget_over =
+          config.time_budget > 0.0 && elapsed.count() >= config.time_budget;
+      if (is_finished() || budget_over) {
+        LOG_INFO("Rendered ", num_frame * size_t(config.n_sample_frame),
+                 " samples in ", elapsed.count(), " sec");
+        // snapshot requests are saved in order, so the last one wins.
+        last_snapshot = true;
+        if (pixel_reader.isFull()) pixel_reader.finish(on_readback);
+        request_snapshot(num_frame);
+        pixel_reader.finish(on_readback);
+        save_last_checkpoint(num_frame);
+        snapshot_writer.wait();
+        return snapshot_writer.numFailed() == 0 ? 0 : -1;
+      }
+      continue;
+    }
+
+    // display result. pixels of a frame in progress have more samples than
+    // others, which is fine as each is divided by its own count.
+    // the denoised image is updated once per frame.
+    if (config.display) {
+      const int shown = preview.showing();
+      if (use_denoise && shown < 0 &&
+          (frame_end || display_tex == &accumulator)) {
+        display_tex = &denoise();
+      }
+      const int scale = w_config.is_retina ? 2 : 1;
+      glViewport(0, 0, config.width * scale, config.height * scale);
+      bindings.bind(kDISPLAY_UNIT,
+                    shown >= 0 ? previews[shown] : *display_tex);
+      glUniform1i(only_draw_loc, true);
+      quad.draw();
+      glUniform1i(only_draw_loc, false);
+      CHECK_GL_ERROR();
+    }
+
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+    CHECK_GL_ERROR();
+
+    if (use_camera && camera.update(window)) move_camera();
+
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE)) {
+      glfwSetWindowShouldClose(window, 1);
+    }
+
+    // save once per press.
+    const bool key_w = glfwGetKey(window, GLFW_KEY_W);
+    if (key_w && !key_w_pressed) {
+      request_snapshot(n - 1);
+    }
+    key_w_pressed = key_w;
   }  // Main Loop
 
-  glfwDestroyWindow(window);
-  glfwTerminate();
+  // the checkpoint needs a whole frame.
+  if (use_checkpoint && !scheduler.atFrameStart()) {
+    draw_frame(true);
+  }
+  last_snapshot = true;
+  pixel_reader.finish(on_readback);
+  save_last_checkpoint(n - 1);
+  snapshot_writer.wait();
 
   return 0;
 }
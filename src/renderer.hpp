@@ -9,65 +9,117 @@
 #ifndef renderer_hpp20180224
 #define renderer_hpp20180224
 
+#include <memory>
 #include <string>
+#include <vector>
 
+#include "../gl_src/egl_context.h"
 #include "../gl_src/glsl.h"
+#include "../gl_src/glsl_utility.h"
+#include "../gl_src/program_cache.h"
 #include "common.h"
-
-struct WindowConfig {
-  std::string title;
-  bool is_retina;
-};
-
-struct RenderConfig {
-  bool display;
-  int width;
-  int height;
-  float gamma = 1.f;
-  int n_sample_frame;
-  size_t max_sample;
-};
+#include "lru_cache.h"
+#include "render_config.h"
+#include "scene_cache.h"
 
 class GlslRayTraceRenderer {
 public:
   const RenderConfig r_config;
   const WindowConfig w_config;
-  const int tex_side_len;
+
+  // samples [first_sample, first_sample + n_sample) of pixels in the rect
+  // (x, y, width, height), rows from the bottom. n_sample is rounded up to
+  // whole frames of n_sample_frame.
+  struct Job {
+    int x = 0, y = 0, width = 0, height = 0;
+    size_t first_sample = 0;
+    size_t n_sample = 0;
+  };
+
+  // polygons uploaded to the GPU by setPolygons(). scenes are shared, so
+  // callers can keep several and switch them by setScene() without building
+  // and uploading again.
+  struct GpuScene {
+    BVH bvh;
+    // as packed by setPolygons(). updateVertices() uploads moved triangles
+    // and bounds without packing them here, only lights are packed again.
+    SceneTexels texels;
+    // hashScene() of the input polygons, or of bvh.polygons after
+    // updateVertices().
+    uint64_t hash = 0;
+    TextureBuffer tri_tex, mat_tex, bvh_tex, bvh_info_tex, light_tex;
+    UniformBuffer params;  // SceneParams block of the shader
+    bool bvh_stack = true;  // false for stackless traversal
+    uint32_t materials = 0;  // bits of Material of the polygons
+    real sah_cost = 0;  // BVH::sahCost() when the BVH was built
+    // GPU time per sample of a pixel measured by the last render, which
+    // sizes the first tiles of the next one. 0 until measured.
+    double ns_per_sample = 0.0;
+
+    // bytes of the texture buffers.
+    size_t bytes() const;
+  };
 
 private:
   GLFWwindow* window = nullptr;
+  HeadlessGLContext headless_context;
 
-  GLuint gl_program_id;
-  GLuint vs_id;
-  GLuint fs_id;
+  // linked variants of the shader by their defines, see shaderDefines().
+  std::unique_ptr<ProgramBinaryCache> program_cache;
+  LruCache<std::string, std::shared_ptr<LinkedProgram>> programs{8};
 
-  BVH bvh;
-  std::vector<Polygon> light;
+  // GL objects of scenes are deleted before the context.
+  std::shared_ptr<GpuScene> scene;
 
 public:
   GlslRayTraceRenderer(const RenderConfig& r_config_,
-                       const WindowConfig& w_config_,
-                       const int& tex_side_len_ = 512)
-      : r_config(r_config_), w_config(w_config_), tex_side_len(tex_side_len_) {
+                       const WindowConfig& w_config_)
+      : r_config(r_config_), w_config(w_config_) {
     if (!init()) {
       std::cerr << "GlslRayTraceRenderer init failed." << std::endl;
     }
   }
+  // render r_config, then release the scene and the GL context.
   int start();
+  // render with config instead of r_config. the renderer must be headless,
+  // and keeps the GL context, the program and the scene for more renders.
+  int start(const RenderConfig& config);
 
-  bool setPolygons(const std::vector<Polygon>& polygons_) {
-    // setup light array
-    for (auto& pol : polygons_) {
-      if (pol.material == Material::Light) {
-        light.push_back(pol);
-      }
-    }
-    // make BVH
-    return bvh.init(polygons_);
-  }
+  // render job headless, and read back the accumulator of its rect (sum of
+  // samples and their count per pixel, rows from the bottom) into pixels
+  // instead of saving. samples of the same index are the same as start(),
+  // so jobs of disjoint ranges can be merged by adding them.
+  bool renderJob(const Job& job, std::vector<float>* pixels);
+
+  // build BVH and texels, or load them from r_config.scene_cache_dir, and
+  // upload them as the scene to render.
+  bool setPolygons(const std::vector<Polygon>& polygons_,
+                   const BVH::Config& bvh_config = BVH::Config());
+
+  // move polygons of the scene to vertices, 3 per polygon in the order of
+  // setPolygons(), for animation which keeps the polygons and materials.
+  // the BVH is refitted and only moved triangles and bounds are uploaded,
+  // unless the refit degrades the BVH so much that building it again is
+  // cheaper to render. the scene is updated in place, so renders of it by
+  // setScene() see the move too.
+  bool updateVertices(const std::vector<Vec>& vertices);
+
+  const std::shared_ptr<GpuScene>& getScene() const { return scene; }
+  void setScene(const std::shared_ptr<GpuScene>& scene_) { scene = scene_; }
 
 private:
   bool init();
+  bool initWindow();
+  bool initHeadless();
+
+  // program of the shader variant for scene and config, linked or loaded
+  // at first use. nullptr if it fails.
+  std::shared_ptr<LinkedProgram> getProgram(const GpuScene& scene,
+                                            const RenderConfig& config);
+
+  // pixels is nullptr for start().
+  int render(const RenderConfig& config, const Job& job,
+             std::vector<float>* pixels);
 };
 
 #endif /* renderer_hpp20180224 */
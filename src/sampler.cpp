@@ -0,0 +1,214 @@
+//
+//  sampler.cpp
+//  NewGlslRenderer
+//
+
+#include "sampler.h"
+
+#include <algorithm>
+
+namespace {
+
+constexpr float kTO_UNIT = 1.f / 16777216.f;
+
+// 24 bits for float in [0, 1).
+inline real toUnit(const uint32_t& x) { return real(x >> 8) * kTO_UNIT; }
+
+inline uint32_t reverseBits(uint32_t x) {
+  x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+  x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+  x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+  x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+  return (x >> 16) | (x << 16);
+}
+
+// primitive polynomials and initial numbers of Joe and Kuo for dimension 1-3.
+// dimension 0 is the van der Corput sequence.
+struct SobolPolynomial {
+  uint32_t s, a;
+  uint32_t m[3];
+};
+constexpr SobolPolynomial kSOBOL_POLYNOMIALS[] = {
+    {1, 0, {1, 0, 0}}, {2, 1, {1, 3, 0}}, {3, 1, {1, 3, 1}}};
+
+struct SobolTable {
+  uint32_t v[PixelSampler::kSOBOL_DIM * PixelSampler::kSOBOL_BITS];
+
+  SobolTable() {
+    const uint32_t kBITS = PixelSampler::kSOBOL_BITS;
+    for (uint32_t k = 0; k < kBITS; k++) {
+      v[k] = 1u << (31 - k);
+    }
+    for (uint32_t d = 1; d < PixelSampler::kSOBOL_DIM; d++) {
+      const SobolPolynomial& poly = kSOBOL_POLYNOMIALS[d - 1];
+      uint32_t* dir = v + d * kBITS;
+      for (uint32_t k = 0; k < kBITS; k++) {
+        if (k < poly.s) {
+          dir[k] = poly.m[k] << (31 - k);
+          continue;
+        }
+        dir[k] = dir[k - poly.s] ^ (dir[k - poly.s] >> poly.s);
+        for (uint32_t j = 1; j < poly.s; j++) {
+          if ((poly.a >> (poly.s - 1 - j)) & 1) dir[k] ^= dir[k - j];
+        }
+      }
+    }
+  }
+};
+
+// void and cluster method of Ulichney on a torus.
+std::vector<float> makeBlueNoise(const int& size) {
+  const size_t n = size_t(size) * size_t(size);
+  constexpr float kSIGMA = 1.5f;
+
+  // energy of a pixel at toroidal offset (dx, dy).
+  std::vector<float> kernel(n);
+  for (int dy = 0; dy < size; dy++) {
+    for (int dx = 0; dx < size; dx++) {
+      const float x = float(std::min(dx, size - dx));
+      const float y = float(std::min(dy, size - dy));
+      kernel[size_t(dy * size + dx)] =
+          std::exp(-(x * x + y * y) / (2 * kSIGMA * kSIGMA));
+    }
+  }
+
+  std::vector<char> pattern(n, 0);
+  std::vector<float> energy(n, 0.f);
+  auto toggle = [&](std::vector<char>* pat, std::vector<float>* e,
+                    const size_t& p, const bool& on) {
+    (*pat)[p] = on;
+    const int px = int(p) % size, py = int(p) / size;
+    const float sign = on ? 1.f : -1.f;
+    for (int y = 0; y < size; y++) {
+      const int dy = (y - py + size) % size;
+      for (int x = 0; x < size; x++) {
+        const int dx = (x - px + size) % size;
+        (*e)[size_t(y * size + x)] += sign * kernel[size_t(dy * size + dx)];
+      }
+    }
+  };
+  // tightest cluster of ones, or largest void of zeros.
+  auto find = [&](const std::vector<char>& pat, const std::vector<float>& e,
+                  const bool& cluster) {
+    size_t best = n;
+    for (size_t p = 0; p < n; p++) {
+      if (pat[p] != cluster) continue;
+      if (best == n || (cluster ? e[p] > e[best] : e[p] < e[best])) best = p;
+    }
+    return best;
+  };
+
+  // initial pattern of 10% ones, relaxed until it is stable.
+  SplitMix64 rng(0x5EED);
+  size_t n_ones = 0;
+  while (n_ones < n / 10) {
+    const size_t p = size_t(rng.next() % n);
+    if (pattern[p]) continue;
+    toggle(&pattern, &energy, p, true);
+    n_ones++;
+  }
+  for (size_t i = 0; i < n; i++) {
+    const size_t cluster = find(pattern, energy, true);
+    toggle(&pattern, &energy, cluster, false);
+    const size_t hole = find(pattern, energy, false);
+    toggle(&pattern, &energy, hole, true);
+    if (hole == cluster) break;
+  }
+
+  std::vector<size_t> rank(n);
+  {
+    std::vector<char> pat = pattern;
+    std::vector<float> e = energy;
+    for (size_t count = n_ones; count > 0; count--) {
+      const size_t cluster = find(pat, e, true);
+      toggle(&pat, &e, cluster, false);
+      rank[cluster] = count - 1;
+    }
+  }
+  // filling largest voids is also removing tightest clusters of zeros,
+  // as the sum of the kernel is constant.
+  for (size_t count = n_ones; count < n; count++) {
+    const size_t hole = find(pattern, energy, false);
+    toggle(&pattern, &energy, hole, true);
+    rank[hole] = count;
+  }
+
+  std::vector<float> values(n);
+  for (size_t p = 0; p < n; p++) {
+    values[p] = (float(rank[p]) + 0.5f) / float(n);
+  }
+  return values;
+}
+
+}  // namespace
+
+constexpr uint32_t PixelSampler::kSOBOL_DIM;
+constexpr uint32_t PixelSampler::kSOBOL_BITS;
+constexpr int PixelSampler::kBLUE_NOISE_SIZE;
+
+void PixelSampler::init(const SamplerType& type_, const uint32_t& seed_,
+                        const int& x_, const int& y_) {
+  type = type_;
+  seed = seed_;
+  x = x_;
+  y = y_;
+  pixel_seed = pcgHash(uint32_t(x) + pcgHash(uint32_t(y) + pcgHash(seed)));
+}
+
+real PixelSampler::rand() {
+  const uint32_t d = dim++;
+  if (type == SamplerType::PCG) {
+    return toUnit(pcgHash(pixel_seed ^ pcgHash(index ^ pcgHash(d))));
+  }
+
+  // dimensions are padded by 4D sets with their own scrambling.
+  const uint32_t base = type == SamplerType::Sobol ? pixel_seed : seed;
+  const uint32_t group_seed = pcgHash(base ^ pcgHash(d / kSOBOL_DIM));
+  const uint32_t shuffled = owenScramble(index, group_seed);
+  const real u = toUnit(owenScramble(sobol(shuffled, d % kSOBOL_DIM),
+                                     pcgHash(group_seed ^ d)));
+  if (type == SamplerType::Sobol) return u;
+
+  const uint32_t size = uint32_t(kBLUE_NOISE_SIZE);
+  const uint32_t h = pcgHash(d + seed);
+  const int bx = (x + int(h % size)) % kBLUE_NOISE_SIZE;
+  const int by = (y + int(h / size % size)) % kBLUE_NOISE_SIZE;
+  const real r = u + blueNoise()[size_t(by * kBLUE_NOISE_SIZE + bx)];
+  return r - std::floor(r);
+}
+
+const uint32_t* PixelSampler::sobolDirections() {
+  static const SobolTable table;
+  return table.v;
+}
+
+const std::vector<float>& PixelSampler::blueNoise() {
+  static const std::vector<float> values = makeBlueNoise(kBLUE_NOISE_SIZE);
+  return values;
+}
+
+uint32_t PixelSampler::pcgHash(const uint32_t& v) {
+  const uint32_t state = v * 747796405u + 2891336453u;
+  const uint32_t word = ((state >> ((state >> 28) + 4)) ^ state) * 277803737u;
+  return (word >> 22) ^ word;
+}
+
+// nested uniform scramble with the hash of Laine and Karras (Burley 2020).
+uint32_t PixelSampler::owenScramble(uint32_t x, const uint32_t& seed) {
+  x = reverseBits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverseBits(x);
+}
+
+uint32_t PixelSampler::sobol(uint32_t index, const uint32_t& dim) {
+  const uint32_t* dir = sobolDirections() + dim * kSOBOL_BITS;
+  uint32_t x = 0;
+  for (uint32_t bit = 0; index != 0; bit++, index >>= 1) {
+    if (index & 1) x ^= dir[bit];
+  }
+  return x;
+}
@@ -0,0 +1,67 @@
+//
+//  sampler.h
+//  NewGlslRenderer
+//
+
+#ifndef sampler_h20261017
+#define sampler_h20261017
+
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+
+// same values as sampler_type in test.frag.
+enum class SamplerType { PCG = 0, Sobol = 1, BlueNoise = 2 };
+
+/**
+ Random numbers of one pixel addressed by (pixel, sample index, dimension),
+ same as rand() in test.frag, so GPU and CPU draw the same sequences.
+
+ PCG       : white noise by PCG hash.
+ Sobol     : 4D Sobol points Owen scrambled by the hash of Laine and Karras.
+             Each 4 dimensions use other seeds for scrambling and for
+             shuffling the sample index, and seeds differ by pixel.
+ BlueNoise : Sobol scrambled with the same seeds for all pixels, rotated
+             (Cranley-Patterson) by a blue noise mask shifted for each
+             dimension, so errors of neighbor pixels are not correlated.
+ **/
+class PixelSampler {
+public:
+  static constexpr uint32_t kSOBOL_DIM = 4;
+  static constexpr uint32_t kSOBOL_BITS = 32;
+  // side of the tiled blue noise mask. same as kBLUE_NOISE_SIZE in test.frag.
+  static constexpr int kBLUE_NOISE_SIZE = 64;
+
+private:
+  SamplerType type = SamplerType::PCG;
+  uint32_t seed = 0;
+  uint32_t pixel_seed = 0;
+  int x = 0, y = 0;
+  uint32_t index = 0;
+  uint32_t dim = 0;
+
+public:
+  // sequence of pixel (x, y), rows from bottom as gl_FragCoord.
+  void init(const SamplerType& type_, const uint32_t& seed_, const int& x_,
+            const int& y_);
+
+  // begin sample index from dimension 0.
+  void start(const uint32_t& index_) {
+    index = index_;
+    dim = 0;
+  }
+  // next dimension of the sample, in [0, 1).
+  real rand();
+
+  // direction numbers, kSOBOL_DIM x kSOBOL_BITS words.
+  static const uint32_t* sobolDirections();
+  // void and cluster ranks in (0, 1), kBLUE_NOISE_SIZE^2 values row by row.
+  static const std::vector<float>& blueNoise();
+
+  static uint32_t pcgHash(const uint32_t& v);
+  static uint32_t owenScramble(uint32_t x, const uint32_t& seed);
+  static uint32_t sobol(uint32_t index, const uint32_t& dim);
+};
+
+#endif /* sampler_h20261017 */
@@ -0,0 +1,195 @@
+//
+//  scene_cache.cpp
+//  NewGlslRenderer
+//
+
+#include "scene_cache.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include "logger.h"
+
+namespace {
+
+static_assert(std::is_trivially_copyable<Polygon>::value,
+              "Polygon is saved as bytes");
+static_assert(std::is_trivially_copyable<BVH::Node>::value,
+              "BVH::Node is saved as bytes");
+
+// sections are aligned for texture upload and SIMD loads.
+constexpr size_t kALIGN = 64;
+
+enum Section {
+  kPOLYGON,
+  kNODE,
+  kORDER,
+  kTRIANGLE,
+  kMATERIAL,
+  kBOUND,
+  kINFO,
+  kLIGHT,
+  kNUM_SECTION
+};
+
+struct Header {
+  char magic[8] = {'G', 'R', 'T', 'S', 'C', 'N', 'E', '\0'};
+  uint32_t version = SceneCache::kVERSION;
+  // layout of the structs saved as bytes, which depends on the compiler.
+  uint32_t polygon_size = sizeof(Polygon);
+  uint32_t node_size = sizeof(BVH::Node);
+  uint32_t pad = 0;
+  uint64_t key = 0;
+  float bright_mag = 1.f;
+  float light_power = 0.f;
+  uint64_t offset[kNUM_SECTION] = {};  // from the head of file
+  uint64_t count[kNUM_SECTION] = {};   // number of elements
+};
+
+size_t alignUp(const size_t& x) { return (x + kALIGN - 1) / kALIGN * kALIGN; }
+
+template <class T>
+bool sectionView(const MappedFile& file, const Header& header,
+                 const Section& section, ArrayView<T>* view) {
+  const size_t offset = size_t(header.offset[section]);
+  const size_t count = size_t(header.count[section]);
+  if (offset % alignof(T) != 0 || offset > file.size() ||
+      count > (file.size() - offset) / sizeof(T)) {
+    return false;
+  }
+  *view = ArrayView<T>(reinterpret_cast<const T*>(file.data() + offset), count);
+  return true;
+}
+
+}  // namespace
+
+constexpr uint32_t SceneCache::kVERSION;
+
+uint64_t SceneCache::key(const uint64_t& scene_hash,
+                         const BVH::Config& config) {
+  uint64_t hash = scene_hash;
+  auto mix = [&hash](const uint64_t& word) {
+    hash = (hash ^ word) * 0x100000001B3ull;
+  };
+  uint32_t cost;
+  std::memcpy(&cost, &config.traversal_cost, sizeof(cost));
+  mix(uint64_t(config.n_bin));
+  mix(uint64_t(config.max_leaf_size));
+  mix(cost);
+  mix(kVERSION);
+  return hash;
+}
+
+std::string SceneCache::path(const std::string& dir, const uint64_t& key) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016" PRIx64 ".scene", key);
+  if (dir.empty() || dir.back() == '/') return dir + name;
+  return dir + "/" + name;
+}
+
+bool SceneCache::load(const std::string& filename, const uint64_t& key,
+                      BVH* bvh, SceneTexels* texels) {
+  MappedFile& file = texels->file;
+  if (!file.open(filename)) return false;
+
+  Header header;
+  const Header expected;
+  if (file.size() >= sizeof(Header)) {
+    std::memcpy(&header, file.data(), sizeof(header));
+  }
+  ArrayView<Polygon> polygons;
+  ArrayView<BVH::Node> nodes;
+  ArrayView<size_t> order;
+  if (file.size() < sizeof(Header) ||
+      std::memcmp(header.magic, expected.magic, sizeof(expected.magic)) != 0 ||
+      header.version != kVERSION ||
+      header.polygon_size != expected.polygon_size ||
+      header.node_size != expected.node_size || header.key != key ||
+      !sectionView(file, header, kPOLYGON, &polygons) ||
+      !sectionView(file, header, kNODE, &nodes) ||
+      !sectionView(file, header, kORDER, &order) ||
+      order.size != polygons.size ||
+      !sectionView(file, header, kTRIANGLE, &texels->triangles) ||
+      !sectionView(file, header, kMATERIAL, &texels->materials) ||
+      !sectionView(file, header, kBOUND, &texels->bounds) ||
+      !sectionView(file, header, kINFO, &texels->info) ||
+      !sectionView(file, header, kLIGHT, &texels->lights)) {
+    LOG_INFO("scene cache is broken or outdated : ", filename);
+    file.close();
+    texels->triangles = ArrayView<float>();
+    texels->materials = ArrayView<float>();
+    texels->bounds = ArrayView<float>();
+    texels->info = ArrayView<int32_t>();
+    texels->lights = ArrayView<int32_t>();
+    return false;
+  }
+
+  // BVH is used on CPU too, so it is copied. texels stay in the mapping.
+  bvh->polygons.assign(polygons.data, polygons.data + polygons.size);
+  bvh->nodes.assign(nodes.data, nodes.data + nodes.size);
+  bvh->order.assign(order.data, order.data + order.size);
+  texels->bright_mag = header.bright_mag;
+  texels->light_power = header.light_power;
+  return true;
+}
+
+bool SceneCache::save(const std::string& filename, const uint64_t& key,
+                      const BVH& bvh, const SceneTexels& texels) {
+  Header header;
+  header.key = key;
+  header.bright_mag = texels.bright_mag;
+  header.light_power = texels.light_power;
+
+  const void* data[kNUM_SECTION] = {bvh.polygons.data(), bvh.nodes.data(),
+                                    bvh.order.data(), texels.triangles.data,
+                                    texels.materials.data, texels.bounds.data,
+                                    texels.info.data, texels.lights.data};
+  const size_t bytes[kNUM_SECTION] = {
+      bvh.polygons.size() * sizeof(Polygon),
+      bvh.nodes.size() * sizeof(BVH::Node),
+      bvh.order.size() * sizeof(size_t),
+      texels.triangles.size * sizeof(float),
+      texels.materials.size * sizeof(float), texels.bounds.size * sizeof(float),
+      texels.info.size * sizeof(int32_t),
+      texels.lights.size * sizeof(int32_t)};
+  header.count[kPOLYGON] = bvh.polygons.size();
+  header.count[kNODE] = bvh.nodes.size();
+  header.count[kORDER] = bvh.order.size();
+  header.count[kTRIANGLE] = texels.triangles.size;
+  header.count[kMATERIAL] = texels.materials.size;
+  header.count[kBOUND] = texels.bounds.size;
+  header.count[kINFO] = texels.info.size;
+  header.count[kLIGHT] = texels.lights.size;
+
+  size_t offset = alignUp(sizeof(Header));
+  for (int s = 0; s < kNUM_SECTION; s++) {
+    header.offset[s] = offset;
+    offset = alignUp(offset + bytes[s]);
+  }
+
+  const std::string tmp_name = filename + ".tmp";
+  std::ofstream file(tmp_name, std::ios::binary);
+  if (!file) {
+    LOG_INFO("failed to open a file : ", tmp_name);
+    return false;
+  }
+  const char zeros[kALIGN] = {};
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  size_t pos = sizeof(header);
+  for (int s = 0; s < kNUM_SECTION; s++) {
+    file.write(zeros, std::streamsize(header.offset[s] - pos));
+    file.write(static_cast<const char*>(data[s]), std::streamsize(bytes[s]));
+    pos = header.offset[s] + bytes[s];
+  }
+  file.close();
+
+  if (!file || std::rename(tmp_name.c_str(), filename.c_str()) != 0) {
+    LOG_INFO("failed to write scene cache : ", filename);
+    std::remove(tmp_name.c_str());
+    return false;
+  }
+  return true;
+}
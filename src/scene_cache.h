@@ -0,0 +1,79 @@
+//
+//  scene_cache.h
+//  NewGlslRenderer
+//
+
+#ifndef scene_cache_h20261017
+#define scene_cache_h20261017
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "mapped_file.h"
+
+/** Read only array in a vector or in a mapped file. **/
+template <class T>
+struct ArrayView {
+  const T* data = nullptr;
+  size_t size = 0;
+
+  ArrayView() {}
+  ArrayView(const std::vector<T>& v) : data(v.data()), size(v.size()) {}
+  ArrayView(const T* data_, const size_t& size_) : data(data_), size(size_) {}
+};
+
+/**
+ Scene ready for upload: texels of triangle, material, BVH and light
+ textures.
+ Texels are views of the vectors below when the scene is built, or of the
+ mapped cache file when it is loaded.
+ **/
+struct SceneTexels {
+  float bright_mag = 1.f;  // from computeBrightMagnification
+  float light_power = 0.f;  // LightSampler::total_power
+  ArrayView<float> triangles;
+  ArrayView<float> materials;
+  ArrayView<float> bounds;
+  ArrayView<int32_t> info;
+  ArrayView<int32_t> lights;
+
+  std::vector<float> triangle_storage;
+  std::vector<float> material_storage;
+  std::vector<float> bound_storage;
+  std::vector<int32_t> info_storage;
+  std::vector<int32_t> light_storage;
+  MappedFile file;
+
+  // point views to the vectors.
+  void useStorage() {
+    triangles = triangle_storage;
+    materials = material_storage;
+    bounds = bound_storage;
+    info = info_storage;
+    lights = light_storage;
+  }
+};
+
+/**
+ Versioned binary file of reordered polygons, their order, BVH nodes and
+ texels, named by a hash of the input polygons and of the settings used to
+ build them.
+ Loading maps the file and texels are uploaded from the mapping directly.
+ **/
+class SceneCache {
+public:
+  // bump when BVH build or texel layout changes.
+  static constexpr uint32_t kVERSION = 6;
+
+  static uint64_t key(const uint64_t& scene_hash, const BVH::Config& config);
+  static std::string path(const std::string& dir, const uint64_t& key);
+
+  static bool load(const std::string& filename, const uint64_t& key, BVH* bvh,
+                   SceneTexels* texels);
+  static bool save(const std::string& filename, const uint64_t& key,
+                   const BVH& bvh, const SceneTexels& texels);
+};
+
+#endif /* scene_cache_h20261017 */
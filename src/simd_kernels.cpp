@@ -0,0 +1,541 @@
+//
+//  simd_kernels.cpp
+//  NewGlslRenderer
+//
+
+#include "simd_kernels.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define USE_X86_SIMD 1
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#include "logger.h"
+
+namespace {
+
+constexpr float kZERO = 0.0001f;
+constexpr float kFLT_INF = std::numeric_limits<float>::infinity();
+
+// ------------------------------------------------------------------ scalar
+
+int scalarIntersectTriangles(const TriangleSoA& tris, const Ray& ray,
+                             const size_t& begin, const int& count, real* t) {
+  int hit = -1;
+  for (int k = 0; k < count; k++) {
+    const size_t i = begin + size_t(k);
+    const Vec position0(tris.v0[0][i], tris.v0[1][i], tris.v0[2][i]);
+    const Vec edge0(tris.e0[0][i], tris.e0[1][i], tris.e0[2][i]);
+    const Vec edge1(tris.e1[0][i], tris.e1[1][i], tris.e1[2][i]);
+
+    const Vec P = cross(ray.dir, edge1);
+    const real det = dot(P, edge0);
+    if (-kZERO < det && det < kZERO) continue;
+    const real inv_det = 1 / det;
+    const Vec T = ray.org - position0;
+    const real u = dot(T, P) * inv_det;
+    if (u < 0 || 1 < u) continue;
+    const Vec Q = cross(T, edge0);
+    const real v = dot(ray.dir, Q) * inv_det;
+    if (v < 0 || 1 < u + v) continue;
+    const real t_hit = dot(edge1, Q) * inv_det;
+
+    if (kZERO < t_hit && *t > t_hit) {
+      *t = t_hit;
+      hit = int(i);
+    }
+  }
+  return hit;
+}
+
+int scalarIntersectBoxPacket(const RayPacket& packet, const Vec& start,
+                             const Vec& end) {
+  int mask = 0;
+  for (int l = 0; l < kSIMD_LANES; l++) {
+    if (!(packet.active & (1 << l))) continue;
+    float t_far = kFLT_INF, t_near = -kFLT_INF;
+    for (int i = 0; i < 3; i++) {
+      const float t1 = (start[i] - packet.org[i][l]) * packet.inv_dir[i][l];
+      const float t2 = (end[i] - packet.org[i][l]) * packet.inv_dir[i][l];
+      // comparisons with NaN are false, so such axes are ignored.
+      if (std::min(t1, t2) > t_near) t_near = std::min(t1, t2);
+      if (std::max(t1, t2) < t_far) t_far = std::max(t1, t2);
+    }
+    if (t_near <= t_far && t_far > 0 && t_near < packet.t[l]) {
+      mask |= 1 << l;
+    }
+  }
+  return mask;
+}
+
+void scalarIntersectTrianglePacket(RayPacket* packet, const TriangleSoA& tris,
+                                   const size_t& idx, const int& mask) {
+  for (int l = 0; l < kSIMD_LANES; l++) {
+    if (!(mask & (1 << l))) continue;
+    Ray ray(Vec(packet->org[0][l], packet->org[1][l], packet->org[2][l]),
+            Vec(packet->dir[0][l], packet->dir[1][l], packet->dir[2][l]));
+    if (scalarIntersectTriangles(tris, ray, idx, 1, &packet->t[l]) != -1) {
+      packet->tri_idx[l] = int(idx);
+    }
+  }
+}
+
+int scalarIntersectBoxes(const float* start, const float* end, const int& n,
+                         const Ray& ray, const Vec& inv_dir, const real& t_max,
+                         float* t_near) {
+  int mask = 0;
+  for (int k = 0; k < n; k++) {
+    float t_far = kFLT_INF;
+    t_near[k] = -kFLT_INF;
+    for (int i = 0; i < 3; i++) {
+      const float t1 = (start[i * n + k] - ray.org[i]) * inv_dir[i];
+      const float t2 = (end[i * n + k] - ray.org[i]) * inv_dir[i];
+      // comparisons with NaN are false, so such axes are ignored.
+      if (std::min(t1, t2) > t_near[k]) t_near[k] = std::min(t1, t2);
+      if (std::max(t1, t2) < t_far) t_far = std::max(t1, t2);
+    }
+    if (t_near[k] <= t_far && t_far > 0 && t_near[k] < t_max) {
+      mask |= 1 << k;
+    }
+  }
+  return mask;
+}
+
+const SimdKernels kSCALAR_KERNELS = {
+    "scalar",
+    scalarIntersectTriangles,
+    scalarIntersectBoxPacket,
+    scalarIntersectTrianglePacket,
+    scalarIntersectBoxes,
+};
+
+#ifdef USE_X86_SIMD
+
+// --------------------------------------------------------------------- SSE
+
+struct Vec4 {
+  __m128 x, y, z;
+};
+
+inline Vec4 cross4(const Vec4& a, const Vec4& b) {
+  return {_mm_sub_ps(_mm_mul_ps(a.y, b.z), _mm_mul_ps(a.z, b.y)),
+          _mm_sub_ps(_mm_mul_ps(a.z, b.x), _mm_mul_ps(a.x, b.z)),
+          _mm_sub_ps(_mm_mul_ps(a.x, b.y), _mm_mul_ps(a.y, b.x))};
+}
+
+inline __m128 dot4(const Vec4& a, const Vec4& b) {
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)),
+                    _mm_mul_ps(a.z, b.z));
+}
+
+inline __m128 select4(const __m128& mask, const __m128& a, const __m128& b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+// Möller–Trumbore on 4 lanes, returns the mask of hits nearer than t_cur.
+inline __m128 mollerTrumbore4(const Vec4& org, const Vec4& dir,
+                              const Vec4& position0, const Vec4& edge0,
+                              const Vec4& edge1, const __m128& t_cur,
+                              __m128* t_hit) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.f);
+  const __m128 eps = _mm_set1_ps(kZERO);
+
+  const Vec4 P = cross4(dir, edge1);
+  const __m128 det = dot4(P, edge0);
+  const __m128 inv_det = _mm_div_ps(one, det);
+  const Vec4 T = {_mm_sub_ps(org.x, position0.x),
+                  _mm_sub_ps(org.y, position0.y),
+                  _mm_sub_ps(org.z, position0.z)};
+  const __m128 u = _mm_mul_ps(dot4(T, P), inv_det);
+  const Vec4 Q = cross4(T, edge0);
+  const __m128 v = _mm_mul_ps(dot4(dir, Q), inv_det);
+  *t_hit = _mm_mul_ps(dot4(edge1, Q), inv_det);
+
+  __m128 valid = _mm_or_ps(_mm_cmpgt_ps(det, eps),
+                           _mm_cmplt_ps(det, _mm_sub_ps(zero, eps)));
+  valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+  valid = _mm_and_ps(valid, _mm_cmple_ps(u, one));
+  valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+  valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+  valid = _mm_and_ps(valid, _mm_cmpgt_ps(*t_hit, eps));
+  valid = _mm_and_ps(valid, _mm_cmplt_ps(*t_hit, t_cur));
+  return valid;
+}
+
+inline Vec4 loadTriangle4(const std::vector<float>* v, const size_t& i) {
+  return {_mm_loadu_ps(&v[0][i]), _mm_loadu_ps(&v[1][i]),
+          _mm_loadu_ps(&v[2][i])};
+}
+
+inline Vec4 broadcast4(const Vec& v) {
+  return {_mm_set1_ps(v.x), _mm_set1_ps(v.y), _mm_set1_ps(v.z)};
+}
+
+int sseIntersectTriangles(const TriangleSoA& tris, const Ray& ray,
+                          const size_t& begin, const int& count, real* t) {
+  const Vec4 org = broadcast4(ray.org);
+  const Vec4 dir = broadcast4(ray.dir);
+
+  int hit = -1;
+  for (int k = 0; k < count; k += 4) {
+    const size_t i = begin + size_t(k);
+    __m128 t_hit;
+    __m128 valid = mollerTrumbore4(
+        org, dir, loadTriangle4(tris.v0, i), loadTriangle4(tris.e0, i),
+        loadTriangle4(tris.e1, i), _mm_set1_ps(*t), &t_hit);
+    int mask = _mm_movemask_ps(valid) & ((1 << std::min(4, count - k)) - 1);
+    while (mask) {
+      const int l = __builtin_ctz(unsigned(mask));
+      mask &= mask - 1;
+      alignas(16) float ts[4];
+      _mm_store_ps(ts, t_hit);
+      if (ts[l] < *t) {
+        *t = ts[l];
+        hit = int(i) + l;
+      }
+    }
+  }
+  return hit;
+}
+
+int sseIntersectBoxPacket(const RayPacket& packet, const Vec& start,
+                          const Vec& end) {
+  int mask = 0;
+  for (int h = 0; h < kSIMD_LANES; h += 4) {
+    __m128 t_near = _mm_set1_ps(-kFLT_INF);
+    __m128 t_far = _mm_set1_ps(kFLT_INF);
+    for (int i = 0; i < 3; i++) {
+      const __m128 org = _mm_load_ps(&packet.org[i][h]);
+      const __m128 inv_dir = _mm_load_ps(&packet.inv_dir[i][h]);
+      const __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(start[i]), org),
+                                   inv_dir);
+      const __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(end[i]), org),
+                                   inv_dir);
+      // keep the accumulator as 2nd operand so NaN lanes are ignored.
+      t_near = _mm_max_ps(_mm_min_ps(t1, t2), t_near);
+      t_far = _mm_min_ps(_mm_max_ps(t1, t2), t_far);
+    }
+    __m128 hit = _mm_cmple_ps(t_near, t_far);
+    hit = _mm_and_ps(hit, _mm_cmpgt_ps(t_far, _mm_setzero_ps()));
+    hit = _mm_and_ps(hit, _mm_cmplt_ps(t_near, _mm_load_ps(&packet.t[h])));
+    mask |= _mm_movemask_ps(hit) << h;
+  }
+  return mask & packet.active;
+}
+
+void sseIntersectTrianglePacket(RayPacket* packet, const TriangleSoA& tris,
+                                const size_t& idx, const int& mask) {
+  const Vec4 position0 = {_mm_set1_ps(tris.v0[0][idx]),
+                          _mm_set1_ps(tris.v0[1][idx]),
+                          _mm_set1_ps(tris.v0[2][idx])};
+  const Vec4 edge0 = {_mm_set1_ps(tris.e0[0][idx]),
+                      _mm_set1_ps(tris.e0[1][idx]),
+                      _mm_set1_ps(tris.e0[2][idx])};
+  const Vec4 edge1 = {_mm_set1_ps(tris.e1[0][idx]),
+                      _mm_set1_ps(tris.e1[1][idx]),
+                      _mm_set1_ps(tris.e1[2][idx])};
+  const __m128 idx4 = _mm_castsi128_ps(_mm_set1_epi32(int(idx)));
+
+  for (int h = 0; h < kSIMD_LANES; h += 4) {
+    const int lanes = (mask >> h) & 0xF;
+    if (!lanes) continue;
+    const Vec4 org = {_mm_load_ps(&packet->org[0][h]),
+                      _mm_load_ps(&packet->org[1][h]),
+                      _mm_load_ps(&packet->org[2][h])};
+    const Vec4 dir = {_mm_load_ps(&packet->dir[0][h]),
+                      _mm_load_ps(&packet->dir[1][h]),
+                      _mm_load_ps(&packet->dir[2][h])};
+    const __m128 lane_mask = _mm_castsi128_ps(_mm_cmpeq_epi32(
+        _mm_and_si128(_mm_set1_epi32(lanes), _mm_setr_epi32(1, 2, 4, 8)),
+        _mm_setr_epi32(1, 2, 4, 8)));
+    const __m128 t_cur = _mm_load_ps(&packet->t[h]);
+    __m128 t_hit;
+    const __m128 valid = _mm_and_ps(
+        lane_mask,
+        mollerTrumbore4(org, dir, position0, edge0, edge1, t_cur, &t_hit));
+
+    _mm_store_ps(&packet->t[h], select4(valid, t_hit, t_cur));
+    float* ids = reinterpret_cast<float*>(&packet->tri_idx[h]);
+    _mm_storeu_ps(ids, select4(valid, idx4, _mm_loadu_ps(ids)));
+  }
+}
+
+int sseIntersectBoxes(const float* start, const float* end, const int& n,
+                      const Ray& ray, const Vec& inv_dir, const real& t_max,
+                      float* t_near) {
+  int mask = 0;
+  for (int h = 0; h < n; h += 4) {
+    __m128 near = _mm_set1_ps(-kFLT_INF);
+    __m128 far = _mm_set1_ps(kFLT_INF);
+    for (int i = 0; i < 3; i++) {
+      const __m128 org = _mm_set1_ps(ray.org[i]);
+      const __m128 inv = _mm_set1_ps(inv_dir[i]);
+      const __m128 t1 =
+          _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&start[i * n + h]), org), inv);
+      const __m128 t2 =
+          _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&end[i * n + h]), org), inv);
+      near = _mm_max_ps(_mm_min_ps(t1, t2), near);
+      far = _mm_min_ps(_mm_max_ps(t1, t2), far);
+    }
+    __m128 hit = _mm_cmple_ps(near, far);
+    hit = _mm_and_ps(hit, _mm_cmpgt_ps(far, _mm_setzero_ps()));
+    hit = _mm_and_ps(hit, _mm_cmplt_ps(near, _mm_set1_ps(t_max)));
+    _mm_storeu_ps(&t_near[h], near);
+    mask |= _mm_movemask_ps(hit) << h;
+  }
+  return mask;
+}
+
+const SimdKernels kSSE_KERNELS = {
+    "sse",
+    sseIntersectTriangles,
+    sseIntersectBoxPacket,
+    sseIntersectTrianglePacket,
+    sseIntersectBoxes,
+};
+
+// -------------------------------------------------------------------- AVX2
+
+struct Vec8 {
+  __m256 x, y, z;
+};
+
+AVX2_TARGET inline Vec8 cross8(const Vec8& a, const Vec8& b) {
+  return {_mm256_sub_ps(_mm256_mul_ps(a.y, b.z), _mm256_mul_ps(a.z, b.y)),
+          _mm256_sub_ps(_mm256_mul_ps(a.z, b.x), _mm256_mul_ps(a.x, b.z)),
+          _mm256_sub_ps(_mm256_mul_ps(a.x, b.y), _mm256_mul_ps(a.y, b.x))};
+}
+
+AVX2_TARGET inline __m256 dot8(const Vec8& a, const Vec8& b) {
+  return _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)),
+      _mm256_mul_ps(a.z, b.z));
+}
+
+AVX2_TARGET inline __m256 mollerTrumbore8(const Vec8& org, const Vec8& dir,
+                                          const Vec8& position0,
+                                          const Vec8& edge0, const Vec8& edge1,
+                                          const __m256& t_cur,
+                                          __m256* t_hit) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.f);
+  const __m256 eps = _mm256_set1_ps(kZERO);
+
+  const Vec8 P = cross8(dir, edge1);
+  const __m256 det = dot8(P, edge0);
+  const __m256 inv_det = _mm256_div_ps(one, det);
+  const Vec8 T = {_mm256_sub_ps(org.x, position0.x),
+                  _mm256_sub_ps(org.y, position0.y),
+                  _mm256_sub_ps(org.z, position0.z)};
+  const __m256 u = _mm256_mul_ps(dot8(T, P), inv_det);
+  const Vec8 Q = cross8(T, edge0);
+  const __m256 v = _mm256_mul_ps(dot8(dir, Q), inv_det);
+  *t_hit = _mm256_mul_ps(dot8(edge1, Q), inv_det);
+
+  __m256 valid =
+      _mm256_or_ps(_mm256_cmp_ps(det, eps, _CMP_GT_OQ),
+                   _mm256_cmp_ps(det, _mm256_sub_ps(zero, eps), _CMP_LT_OQ));
+  valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+  valid = _mm256_and_ps(valid, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+  valid = _mm256_and_ps(valid, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+  valid = _mm256_and_ps(valid,
+                        _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+  valid = _mm256_and_ps(valid, _mm256_cmp_ps(*t_hit, eps, _CMP_GT_OQ));
+  valid = _mm256_and_ps(valid, _mm256_cmp_ps(*t_hit, t_cur, _CMP_LT_OQ));
+  return valid;
+}
+
+AVX2_TARGET inline Vec8 loadTriangle8(const std::vector<float>* v,
+                                      const size_t& i) {
+  return {_mm256_loadu_ps(&v[0][i]), _mm256_loadu_ps(&v[1][i]),
+          _mm256_loadu_ps(&v[2][i])};
+}
+
+AVX2_TARGET inline __m256 laneMask8(const int& lanes) {
+  const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  return _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+      _mm256_and_si256(_mm256_set1_epi32(lanes), bits), bits));
+}
+
+AVX2_TARGET int avx2IntersectTriangles(const TriangleSoA& tris, const Ray& ray,
+                                       const size_t& begin, const int& count,
+                                       real* t) {
+  const Vec8 org = {_mm256_set1_ps(ray.org.x), _mm256_set1_ps(ray.org.y),
+                    _mm256_set1_ps(ray.org.z)};
+  const Vec8 dir = {_mm256_set1_ps(ray.dir.x), _mm256_set1_ps(ray.dir.y),
+                    _mm256_set1_ps(ray.dir.z)};
+
+  __m256 t_hit;
+  __m256 valid = mollerTrumbore8(
+      org, dir, loadTriangle8(tris.v0, begin), loadTriangle8(tris.e0, begin),
+      loadTriangle8(tris.e1, begin), _mm256_set1_ps(*t), &t_hit);
+  valid = _mm256_and_ps(valid, laneMask8((1 << count) - 1));
+  if (_mm256_testz_ps(valid, valid)) return -1;
+
+  // horizontal min of hit distances.
+  __m256 t_min = _mm256_blendv_ps(_mm256_set1_ps(kFLT_INF), t_hit, valid);
+  t_min = _mm256_min_ps(t_min, _mm256_permute_ps(t_min, 0xB1));
+  t_min = _mm256_min_ps(t_min, _mm256_permute_ps(t_min, 0x4E));
+  t_min = _mm256_min_ps(t_min, _mm256_permute2f128_ps(t_min, t_min, 0x01));
+
+  const int nearest = _mm256_movemask_ps(
+      _mm256_and_ps(valid, _mm256_cmp_ps(t_hit, t_min, _CMP_EQ_OQ)));
+  *t = _mm_cvtss_f32(_mm256_castps256_ps128(t_min));
+  return int(begin) + __builtin_ctz(unsigned(nearest));
+}
+
+AVX2_TARGET int avx2IntersectBoxPacket(const RayPacket& packet,
+                                       const Vec& start, const Vec& end) {
+  __m256 t_near = _mm256_set1_ps(-kFLT_INF);
+  __m256 t_far = _mm256_set1_ps(kFLT_INF);
+  for (int i = 0; i < 3; i++) {
+    const __m256 org = _mm256_load_ps(packet.org[i]);
+    const __m256 inv_dir = _mm256_load_ps(packet.inv_dir[i]);
+    const __m256 t1 =
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(start[i]), org), inv_dir);
+    const __m256 t2 =
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(end[i]), org), inv_dir);
+    // keep the accumulator as 2nd operand so NaN lanes are ignored.
+    t_near = _mm256_max_ps(_mm256_min_ps(t1, t2), t_near);
+    t_far = _mm256_min_ps(_mm256_max_ps(t1, t2), t_far);
+  }
+  __m256 hit = _mm256_cmp_ps(t_near, t_far, _CMP_LE_OQ);
+  hit = _mm256_and_ps(
+      hit, _mm256_cmp_ps(t_far, _mm256_setzero_ps(), _CMP_GT_OQ));
+  hit = _mm256_and_ps(
+      hit, _mm256_cmp_ps(t_near, _mm256_load_ps(packet.t), _CMP_LT_OQ));
+  return _mm256_movemask_ps(hit) & packet.active;
+}
+
+AVX2_TARGET void avx2IntersectTrianglePacket(RayPacket* packet,
+                                             const TriangleSoA& tris,
+                                             const size_t& idx,
+                                             const int& mask) {
+  const Vec8 position0 = {_mm256_set1_ps(tris.v0[0][idx]),
+                          _mm256_set1_ps(tris.v0[1][idx]),
+                          _mm256_set1_ps(tris.v0[2][idx])};
+  const Vec8 edge0 = {_mm256_set1_ps(tris.e0[0][idx]),
+                      _mm256_set1_ps(tris.e0[1][idx]),
+                      _mm256_set1_ps(tris.e0[2][idx])};
+  const Vec8 edge1 = {_mm256_set1_ps(tris.e1[0][idx]),
+                      _mm256_set1_ps(tris.e1[1][idx]),
+                      _mm256_set1_ps(tris.e1[2][idx])};
+  const Vec8 org = {_mm256_load_ps(packet->org[0]),
+                    _mm256_load_ps(packet->org[1]),
+                    _mm256_load_ps(packet->org[2])};
+  const Vec8 dir = {_mm256_load_ps(packet->dir[0]),
+                    _mm256_load_ps(packet->dir[1]),
+                    _mm256_load_ps(packet->dir[2])};
+  const __m256 t_cur = _mm256_load_ps(packet->t);
+
+  __m256 t_hit;
+  const __m256 valid = _mm256_and_ps(
+      laneMask8(mask),
+      mollerTrumbore8(org, dir, position0, edge0, edge1, t_cur, &t_hit));
+
+  _mm256_store_ps(packet->t, _mm256_blendv_ps(t_cur, t_hit, valid));
+  float* ids = reinterpret_cast<float*>(packet->tri_idx);
+  _mm256_store_ps(
+      ids, _mm256_blendv_ps(_mm256_load_ps(ids),
+                            _mm256_castsi256_ps(_mm256_set1_epi32(int(idx))),
+                            valid));
+}
+
+AVX2_TARGET int avx2IntersectBoxes(const float* start, const float* end,
+                                   const int& n, const Ray& ray,
+                                   const Vec& inv_dir, const real& t_max,
+                                   float* t_near) {
+  if (n != 8) {
+    return sseIntersectBoxes(start, end, n, ray, inv_dir, t_max, t_near);
+  }
+  __m256 near = _mm256_set1_ps(-kFLT_INF);
+  __m256 far = _mm256_set1_ps(kFLT_INF);
+  for (int i = 0; i < 3; i++) {
+    const __m256 org = _mm256_set1_ps(ray.org[i]);
+    const __m256 inv = _mm256_set1_ps(inv_dir[i]);
+    const __m256 t1 = _mm256_mul_ps(
+        _mm256_sub_ps(_mm256_loadu_ps(&start[i * 8]), org), inv);
+    const __m256 t2 =
+        _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&end[i * 8]), org), inv);
+    near = _mm256_max_ps(_mm256_min_ps(t1, t2), near);
+    far = _mm256_min_ps(_mm256_max_ps(t1, t2), far);
+  }
+  __m256 hit = _mm256_cmp_ps(near, far, _CMP_LE_OQ);
+  hit = _mm256_and_ps(hit,
+                      _mm256_cmp_ps(far, _mm256_setzero_ps(), _CMP_GT_OQ));
+  hit = _mm256_and_ps(
+      hit, _mm256_cmp_ps(near, _mm256_set1_ps(t_max), _CMP_LT_OQ));
+  _mm256_storeu_ps(t_near, near);
+  return _mm256_movemask_ps(hit);
+}
+
+const SimdKernels kAVX2_KERNELS = {
+    "avx2",
+    avx2IntersectTriangles,
+    avx2IntersectBoxPacket,
+    avx2IntersectTrianglePacket,
+    avx2IntersectBoxes,
+};
+
+#endif  // USE_X86_SIMD
+
+const SimdKernels& detectSimdKernels() {
+#ifdef USE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return kAVX2_KERNELS;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return kSSE_KERNELS;
+  }
+#endif
+  return kSCALAR_KERNELS;
+}
+
+const SimdKernels& detectAndLogSimdKernels() {
+  const SimdKernels& kernels = detectSimdKernels();
+  LOG_INFO("SIMD kernels : ", kernels.name);
+  return kernels;
+}
+
+}  // namespace
+
+void TriangleSoA::init(const std::vector<Polygon>& polygons) {
+  size = polygons.size();
+  for (int c = 0; c < 3; c++) {
+    v0[c].assign(size + kSIMD_LANES, 0.f);
+    e0[c].assign(size + kSIMD_LANES, 0.f);
+    e1[c].assign(size + kSIMD_LANES, 0.f);
+  }
+  for (size_t i = 0; i < size; i++) {
+    const Polygon& pol = polygons[i];
+    const Vec edge0 = pol.vert[1] - pol.vert[0];
+    const Vec edge1 = pol.vert[2] - pol.vert[0];
+    for (int c = 0; c < 3; c++) {
+      v0[c][i] = pol.vert[0][c];
+      e0[c][i] = edge0[c];
+      e1[c][i] = edge1[c];
+    }
+  }
+}
+
+void RayPacket::set(const int& lane, const Vec& org_, const Vec& dir_) {
+  for (int c = 0; c < 3; c++) {
+    org[c][lane] = org_[c];
+    dir[c][lane] = dir_[c];
+    inv_dir[c][lane] = 1.f / dir_[c];
+  }
+  t[lane] = kINF;
+  tri_idx[lane] = -1;
+  active |= 1 << lane;
+}
+
+const SimdKernels& selectSimdKernels() {
+  static const SimdKernels& kernels = detectAndLogSimdKernels();
+  return kernels;
+}
@@ -0,0 +1,72 @@
+//
+//  simd_kernels.h
+//  NewGlslRenderer
+//
+
+#ifndef simd_kernels_h20261017
+#define simd_kernels_h20261017
+
+#include <vector>
+
+#include "common.h"
+
+// max number of rays in a packet, or triangles tested by one call.
+constexpr int kSIMD_LANES = 8;
+
+/**
+ Triangles of BVH::polygons in SoA layout (vertex 0 and two edges).
+ Each array is padded by kSIMD_LANES so kernels can always load 8 lanes.
+ **/
+struct TriangleSoA {
+  std::vector<float> v0[3];
+  std::vector<float> e0[3];
+  std::vector<float> e1[3];
+  size_t size = 0;
+
+  void init(const std::vector<Polygon>& polygons);
+};
+
+/** Up to kSIMD_LANES rays in SoA layout with their nearest hits. **/
+struct alignas(32) RayPacket {
+  float org[3][kSIMD_LANES];
+  float dir[3][kSIMD_LANES];
+  float inv_dir[3][kSIMD_LANES];
+  float t[kSIMD_LANES];
+  int tri_idx[kSIMD_LANES];
+  int active = 0;  // bit mask of used lanes
+
+  void set(const int& lane, const Vec& org_, const Vec& dir_);
+};
+
+/**
+ Ray/triangle (Möller–Trumbore) and ray/box (slab) kernels.
+ Hit conditions are the same as intersectTriangle and intersectBoundingBox
+ in test.frag. Use selectSimdKernels() to get the best set for this CPU.
+ **/
+struct SimdKernels {
+  const char* name;
+
+  // nearest hit of one ray in triangles [begin, begin + count), count <= 8.
+  // returns the index of the triangle and updates *t, or returns -1.
+  int (*intersectTriangles)(const TriangleSoA& tris, const Ray& ray,
+                            const size_t& begin, const int& count, real* t);
+
+  // mask of active lanes which hit the box nearer than their current hit.
+  int (*intersectBoxPacket)(const RayPacket& packet, const Vec& start,
+                            const Vec& end);
+
+  // test lanes in mask against one triangle and update t and tri_idx.
+  void (*intersectTrianglePacket)(RayPacket* packet, const TriangleSoA& tris,
+                                  const size_t& idx, const int& mask);
+
+  // one ray against n (4 or 8) boxes in SoA layout, start[axis * n + k].
+  // returns mask of boxes hit nearer than t_max, with entry distances.
+  int (*intersectBoxes)(const float* start, const float* end, const int& n,
+                        const Ray& ray, const Vec& inv_dir,
+                        const real& t_max, float* t_near);
+};
+
+// AVX2 or SSE kernels if this CPU supports them, else scalar ones.
+const SimdKernels& selectSimdKernels();
+
+#endif /* simd_kernels_h20261017 */
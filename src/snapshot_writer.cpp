@@ -0,0 +1,189 @@
+//
+//  snapshot_writer.cpp
+//  NewGlslRenderer
+//
+
+#include "snapshot_writer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "logger.h"
+#include "thread_pool.h"
+
+namespace {
+
+// pixels per task of tone mapping.
+constexpr size_t kTONE_MAP_CHUNK = 1 << 14;
+
+/**
+ x^gamma for x in [0, 1] by table lookup. The table is indexed by the
+ exponent and upper 7 bits of mantissa of x and linearly interpolated by
+ the rest, so relative error is about 1e-5 over kOCTAVE octaves.
+ Below 2^-kOCTAVE, it is interpolated linearly to 0.
+ **/
+class GammaTable {
+  static constexpr int kOCTAVE = 40;
+  static constexpr int kSTEP_BITS = 7;
+  static constexpr int kSHIFT = 23 - kSTEP_BITS;
+  static constexpr uint32_t kBASE = uint32_t(127 - kOCTAVE) << 23;
+
+  std::vector<float> table;
+  float min_value;
+
+public:
+  explicit GammaTable(const float& gamma)
+      : table((size_t(kOCTAVE) << kSTEP_BITS) + 2) {
+    for (size_t i = 0; i < table.size(); i++) {
+      const uint32_t bits = kBASE + (uint32_t(i) << kSHIFT);
+      float x;
+      std::memcpy(&x, &bits, sizeof(x));
+      table[i] = std::pow(x, gamma);
+    }
+    min_value = std::ldexp(1.f, -kOCTAVE);
+  }
+
+  // x must be in [0, 1].
+  float operator()(const float& x) const {
+    if (x < min_value) return table[0] * x / min_value;
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits -= kBASE;
+    const uint32_t idx = bits >> kSHIFT;
+    const float frac =
+        float(bits & ((1u << kSHIFT) - 1)) * (1.f / float(1u << kSHIFT));
+    return table[idx] + (table[idx + 1] - table[idx]) * frac;
+  }
+};
+
+}  // namespace
+
+void toneMapPixels(const float& brightness, const float& gamma,
+                   const std::vector<float>& rgba, std::vector<float>* rgb) {
+  const size_t length = rgba.size() / 4;
+  rgb->resize(length * 3);
+
+  const GammaTable pow_gamma(gamma);
+  const size_t n_chunk = std::max<size_t>(1, length / kTONE_MAP_CHUNK);
+  parallelFor(0, length, n_chunk, [&](size_t s, size_t e, size_t) {
+    const float* src = rgba.data() + s * 4;
+    float* dst = rgb->data() + s * 3;
+    // scale and clamp first in a plain loop, which is vectorized.
+    for (size_t i = 0; i < e - s; i++) {
+      const float scale = brightness / std::max(1.f, src[i * 4 + 3]);
+      for (int c = 0; c < 3; c++) {
+        dst[i * 3 + c] =
+            std::max(0.f, std::min(1.f, scale * src[i * 4 + size_t(c)]));
+      }
+    }
+    for (size_t i = 0; i < (e - s) * 3; i++) {
+      dst[i] = pow_gamma(dst[i]);
+    }
+  });
+}
+
+void radiancePixels(const float& brightness, const std::vector<float>& rgba,
+                    std::vector<float>* rgb) {
+  const size_t length = rgba.size() / 4;
+  rgb->resize(length * 3);
+  for (size_t i = 0; i < length; i++) {
+    const float scale = brightness / std::max(1.f, rgba[i * 4 + 3]);
+    for (size_t c = 0; c < 3; c++) {
+      (*rgb)[i * 3 + c] = scale * rgba[i * 4 + c];
+    }
+  }
+}
+
+SnapshotWriter::SnapshotWriter(const float& brightness_, const float& gamma_,
+                               const size_t& max_queue_)
+    : brightness(brightness_),
+      gamma(gamma_),
+      max_queue(max_queue_),
+      worker([this]() { run(); }) {}
+
+SnapshotWriter::~SnapshotWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stop = true;
+  }
+  cond.notify_all();
+  worker.join();
+}
+
+bool SnapshotWriter::push(Snapshot&& snapshot, const bool& wait) {
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (wait) {
+      cond.wait(lock, [this]() { return queue.size() < max_queue; });
+    } else if (queue.size() >= max_queue) {
+      return false;
+    }
+    queue.emplace_back(std::move(snapshot));
+  }
+  cond.notify_all();
+  return true;
+}
+
+void SnapshotWriter::wait() {
+  std::unique_lock<std::mutex> lock(mtx);
+  cond.wait(lock, [this]() { return queue.empty() && !busy; });
+}
+
+size_t SnapshotWriter::numFailed() {
+  std::lock_guard<std::mutex> lock(mtx);
+  return n_failed;
+}
+
+void SnapshotWriter::run() {
+  while (true) {
+    Snapshot snapshot;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cond.wait(lock, [this]() { return stop || !queue.empty(); });
+      // pushed snapshots are saved even when stopping.
+      if (queue.empty()) return;
+      snapshot = std::move(queue.front());
+      queue.pop_front();
+      busy = true;
+    }
+
+    const bool saved = save(snapshot);
+    if (saved) {
+      LOG_INFO("Save Image : ", snapshot.filename);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      busy = false;
+      if (!saved) n_failed++;
+    }
+    cond.notify_all();
+  }
+}
+
+bool SnapshotWriter::save(const Snapshot& snapshot) const {
+  ImageFormat format = snapshot.format;
+  if (format == ImageFormat::Auto) {
+    format = imageFormatFromPath(snapshot.filename);
+  }
+
+  std::vector<float> rgb;
+  if (isHDRFormat(format)) {
+    radiancePixels(brightness, snapshot.pixels, &rgb);
+  } else {
+    toneMapPixels(brightness, gamma, snapshot.pixels, &rgb);
+  }
+
+  const std::string tmp_name = snapshot.filename + ".tmp";
+  if (!SaveImage(tmp_name, rgb, snapshot.width, snapshot.height, format)) {
+    return false;
+  }
+  if (std::rename(tmp_name.c_str(), snapshot.filename.c_str()) != 0) {
+    LOG_INFO("failed to rename a file : ", tmp_name);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,80 @@
+//
+//  snapshot_writer.h
+//  NewGlslRenderer
+//
+
+#ifndef snapshot_writer_h20261017
+#define snapshot_writer_h20261017
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "image_io.h"
+
+/** Accumulated pixels read back from the renderer. **/
+struct Snapshot {
+  // sum of samples in RGB and their count in A, the first row is the bottom
+  std::vector<float> pixels;
+  int width;
+  int height;
+  std::string filename;
+  ImageFormat format = ImageFormat::Auto;
+};
+
+/**
+ Tone map and save snapshots on a background thread so the render loop only
+ pays for the readback. Tone mapping is split over ThreadPool::shared().
+ Files are written to a temporary name and renamed, so readers never see
+ a partial image.
+ **/
+class SnapshotWriter {
+private:
+  const float brightness;
+  const float gamma;
+  const size_t max_queue;
+
+  std::deque<Snapshot> queue;
+  std::mutex mtx;
+  std::condition_variable cond;
+  bool busy = false;
+  bool stop = false;
+  size_t n_failed = 0;
+  std::thread worker;
+
+public:
+  SnapshotWriter(const float& brightness_, const float& gamma_,
+                 const size_t& max_queue_ = 2);
+  ~SnapshotWriter();
+
+  SnapshotWriter(const SnapshotWriter&) = delete;
+  SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+  // false (and snapshot is dropped) if max_queue snapshots are waiting,
+  // unless wait, which blocks until one of them is taken.
+  bool push(Snapshot&& snapshot, const bool& wait = false);
+
+  // block until all pushed snapshots are saved.
+  void wait();
+
+  // number of snapshots which could not be saved.
+  size_t numFailed();
+
+private:
+  void run();
+  bool save(const Snapshot& snapshot) const;
+};
+
+// RGBA accumulation to RGB in [0, 1] with brightness and gamma, in parallel.
+// each pixel is divided by its count in A.
+void toneMapPixels(const float& brightness, const float& gamma,
+                   const std::vector<float>& rgba, std::vector<float>* rgb);
+
+// RGBA accumulation to linear RGB radiance scaled by brightness.
+void radiancePixels(const float& brightness, const std::vector<float>& rgba,
+                    std::vector<float>* rgb);
+
+#endif /* snapshot_writer_h20261017 */
@@ -0,0 +1,250 @@
+//
+//  test.cpp
+//  NewGlslRenderer
+//
+//  Tests of parts which run without a GL context. exits with 1 if one fails.
+//
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "camera_controller.h"
+#include "mesh_loader.h"
+#include "message_socket.h"
+#include "snapshot_writer.h"
+#include "thread_pool.h"
+
+namespace {
+
+int n_failed = 0;
+
+#define EXPECT(cond)                                                   \
+  do {                                                                 \
+    if (!(cond)) {                                                     \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond        \
+                << " failed" << std::endl;                             \
+      n_failed++;                                                      \
+    }                                                                  \
+  } while (0)
+
+// file of contents in the temporary directory, removed with the object.
+class TempFile {
+public:
+  std::string path;
+
+  TempFile(const std::string& suffix, const std::string& contents) {
+    char name[] = "/tmp/glsl_test_XXXXXX";
+    const int fd = mkstemp(name);
+    if (fd >= 0) close(fd);
+    std::remove(name);
+    path = name + suffix;
+    std::ofstream(path, std::ios::binary) << contents;
+  }
+  ~TempFile() { std::remove(path.c_str()); }
+
+  TempFile(const TempFile&) = delete;
+  TempFile& operator=(const TempFile&) = delete;
+};
+
+void testParallelForEmpty() {
+  size_t n_call = 0;
+  parallelFor(0, 0, 0, [&](size_t, size_t, size_t) { n_call++; });
+  parallelFor(0, 0, 4, [&](size_t, size_t, size_t) { n_call++; });
+  parallelFor(5, 5, 1, [&](size_t, size_t, size_t) { n_call++; });
+  EXPECT(n_call == 0);
+}
+
+// binary little endian PLY of 3 vertices and faces of 3 indices.
+std::string binaryPly(const std::vector<int32_t>& indices) {
+  const size_t n_face = indices.size() / 3;
+  std::string ply =
+      "ply\nformat binary_little_endian 1.0\nelement vertex 3\n"
+      "property float x\nproperty float y\nproperty float z\n"
+      "element face " +
+      std::to_string(n_face) +
+      "\nproperty list uchar int vertex_indices\nend_header\n";
+  const float verts[9] = {0, 0, 0, 1, 0, 0, 0, 1, 0};
+  ply.append(reinterpret_cast<const char*>(verts), sizeof(verts));
+  for (size_t f = 0; f < n_face; f++) {
+    ply += char(3);
+    ply.append(reinterpret_cast<const char*>(&indices[f * 3]),
+               3 * sizeof(int32_t));
+  }
+  return ply;
+}
+
+void testPlyWithoutFaces() {
+  const TempFile file(".ply", binaryPly({}));
+  std::vector<Polygon> polygons;
+  EXPECT(LoadMesh(file.path, &polygons));
+  EXPECT(polygons.empty());
+
+  const TempFile one_face(".ply", binaryPly({0, 1, 2}));
+  EXPECT(LoadMesh(one_face.path, &polygons));
+  EXPECT(polygons.size() == 1);
+}
+
+// header of MessageSocket : magic, type and payload size.
+std::string messageHeader(const uint64_t& size) {
+  const uint32_t head[2] = {0x4d545247, 1};
+  std::string header(reinterpret_cast<const char*>(head), sizeof(head));
+  header.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  return header;
+}
+
+void testMessageLimits() {
+  int fds[2];
+  EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  MessageSocket sender(fds[0]), receiver(fds[1]);
+  uint32_t type;
+  std::vector<char> payload;
+
+  const char body[4] = {1, 2, 3, 4};
+  EXPECT(sender.send(7, body, sizeof(body)));
+  EXPECT(receiver.receive(&type, &payload, sizeof(body)));
+  EXPECT(type == 7 && payload.size() == sizeof(body));
+
+  // a payload over the limit is rejected from its header.
+  EXPECT(sender.send(7, body, sizeof(body)));
+  EXPECT(!receiver.receive(&type, &payload, sizeof(body) - 1));
+  EXPECT(!receiver.isOpen());
+
+  EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  sender = MessageSocket(fds[0]);
+  receiver = MessageSocket(fds[1]);
+  const std::string huge = messageHeader(~uint64_t(0));
+  EXPECT(write(fds[0], huge.data(), huge.size()) == ssize_t(huge.size()));
+  EXPECT(!receiver.receive(&type, &payload));
+  EXPECT(!receiver.isOpen());
+
+  // a peer which stops in a header fails by the timeout.
+  EXPECT(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  sender = MessageSocket(fds[0]);
+  receiver = MessageSocket(fds[1]);
+  EXPECT(receiver.setReceiveTimeout(0.1));
+  const std::string half = messageHeader(4).substr(0, 6);
+  EXPECT(write(fds[0], half.data(), half.size()) == ssize_t(half.size()));
+  EXPECT(!receiver.receive(&type, &payload));
+  EXPECT(!receiver.isOpen());
+}
+
+void testSnapshotWait() {
+  SnapshotWriter writer(1.f, 1.f, 1);
+  // more snapshots than the queue holds, none is dropped.
+  std::vector<std::unique_ptr<TempFile>> files;
+  for (int i = 0; i < 4; i++) files.emplace_back(new TempFile(".pfm", ""));
+  for (const auto& file : files) {
+    Snapshot snapshot;
+    snapshot.pixels.assign(64 * 64 * 4, 1.f);
+    snapshot.width = 64;
+    snapshot.height = 64;
+    snapshot.filename = file->path;
+    EXPECT(writer.push(std::move(snapshot), true));
+  }
+  writer.wait();
+  EXPECT(writer.numFailed() == 0);
+  for (const auto& file : files) {
+    std::ifstream saved(file->path, std::ios::binary | std::ios::ate);
+    EXPECT(saved.good() && saved.tellg() > 0);
+  }
+}
+
+bool near(const Vec& a, const Vec& b) { return (a - b).length() < 1e-4f; }
+
+void testCameraController() {
+  CameraController camera(Vec(0, 0, 0), Vec(2, 0, 0), 2);
+  EXPECT(near(camera.dir, Vec(1, 0, 0)));
+  CameraController::Input input;
+  EXPECT(!camera.update(input, 0.05));
+
+  input.pressed[CameraController::kFORWARD] = true;
+  EXPECT(camera.update(input, 0.05));
+  EXPECT(near(camera.pos, Vec(0.1f, 0, 0)));
+  // a stall moves as far as kMAX_STEP.
+  EXPECT(camera.update(input, 10.0));
+  EXPECT(near(camera.pos, Vec(0.3f, 0, 0)));
+  input.pressed[CameraController::kFORWARD] = false;
+
+  input.pressed[CameraController::kUP] = true;
+  input.pressed[CameraController::kRIGHT] = true;
+  EXPECT(camera.update(input, 0.05));
+  EXPECT(near(camera.pos, Vec(0.3f, -0.1f, 0.1f)));
+  input = CameraController::Input();
+
+  // the press of the button doesn't turn, dragging from there does.
+  input.dragging = true;
+  input.cursor_x = 100;
+  EXPECT(!camera.update(input, 0.05));
+  EXPECT(!camera.update(input, 0.05));
+  input.cursor_x = 100 - 3.14159265 / 2 / 0.005;
+  EXPECT(camera.update(input, 0.05));
+  EXPECT(near(camera.dir, Vec(0, 1, 0)));
+  EXPECT(near(camera.pos, Vec(0.3f, -0.1f, 0.1f)));
+
+  // pitch stops before the pole.
+  input.cursor_y = -1000;
+  EXPECT(camera.update(input, 0.05));
+  EXPECT(camera.dir.z < 1 && camera.dir.z > 0.99f);
+
+  // moving the cursor without the button doesn't turn.
+  const Vec dir = camera.dir;
+  input.dragging = false;
+  input.cursor_y = 0;
+  EXPECT(!camera.update(input, 0.05));
+  EXPECT(near(camera.dir, dir));
+}
+
+void testPreviewSchedule() {
+  PreviewSchedule preview(2);
+  EXPECT(preview.next() == -1);
+  EXPECT(preview.showing() == -1);
+
+  preview.restart();
+  EXPECT(preview.next() == 0);
+  EXPECT(preview.showing() == 0);
+  // a frame which was drawn before the move doesn't hide previews.
+  preview.frameEnd();
+  EXPECT(preview.showing() == 0);
+  EXPECT(preview.next() == 1);
+  EXPECT(preview.next() == -1);
+  EXPECT(preview.showing() == 1);
+  preview.frameEnd();
+  EXPECT(preview.showing() == -1);
+
+  // a move during previews starts from the lowest resolution again.
+  preview.restart();
+  EXPECT(preview.next() == 0);
+  preview.restart();
+  EXPECT(preview.next() == 0);
+  EXPECT(preview.next() == 1);
+
+  PreviewSchedule none(0);
+  none.restart();
+  EXPECT(none.next() == -1);
+  EXPECT(none.showing() == -1);
+}
+
+}  // namespace
+
+int main() {
+  testParallelForEmpty();
+  testPlyWithoutFaces();
+  testMessageLimits();
+  testSnapshotWait();
+  testCameraController();
+  testPreviewSchedule();
+
+  if (n_failed > 0) {
+    std::cerr << n_failed << " checks failed" << std::endl;
+    return 1;
+  }
+  std::cout << "all tests passed" << std::endl;
+  return 0;
+}
@@ -4,34 +4,115 @@ R"(
 #define kINF 100000000
 #define kZERO 0.0001
 #define kPI 3.1415926535
+// kBVH_STACK_SIZE in renderer.cpp
+#define kSTACK_SIZE 32
+// same as PixelSampler
+#define kSOBOL_DIM 4u
+#define kBLUE_NOISE_SIZE 64
+// kBLOCK_SIZE in renderer.cpp, pixels of a side of an adaptive block
+#define kBLOCK_SIZE 16
+
+// the renderer compiles a variant for each scene and config by defining
+// these after #version (see shaderDefines() in renderer.cpp).
+// bounces of a path and the base of russian roulette.
+#ifndef kMAX_DEPTH
+#define kMAX_DEPTH 5
+#endif
+#ifndef kROULETTE
+#define kROULETTE 0.6
+#endif
+// HAS_LIGHT, HAS_DIR_LIGHT : materials in the scene.
+// USE_NEE : emitters for next event estimation.
+// BVH_STACKLESS : brother links instead of the stack, for BVH deeper than it.
+// without SCENE_FEATURES, any scene is rendered.
+#ifndef SCENE_FEATURES
+#define HAS_LIGHT
+#define HAS_DIR_LIGHT
+#define USE_NEE
+#endif
+
+// constants of a render, uploaded once. RenderParams in renderer.cpp.
+layout(std140) uniform RenderParams {
+  vec3 camera_pos;
+  float aspect_ratio;
+  vec3 camera_dir;
+  // sample sequence of rand(), same as PixelSampler in sampler.h.
+  // 0 : PCG, 1 : Sobol, 2 : blue noise (SamplerType)
+  int sampler_type;
+  uint sampler_seed;
+  float brightness;
+  float gamma;
+  // PixelSampler::sobolDirections(), kSOBOL_DIM x 32 bits, 4 per element
+  uvec4 sobol_dir[32];
+};
 
-uniform int TRI_TEX_COL;
-
-const vec3 camera_dir = vec3(1, 0, 0);
-const vec3 camera_pos = vec3(-3, 0, 0);
+// constants of a scene, uploaded with it. SceneParams in renderer.cpp.
+layout(std140) uniform SceneParams {
+  int bvh_size;
+  int num_light;
+  // sum of power x area of emitters
+  float light_power;
+};
 
 const vec2 screen_size = vec2(640, 480);
 
+// samples of this draw, added to the accumulator by blending.
 uniform int num_sample;
+// index of the first sample of this draw
+uniform uint sample_index;
 
-uniform float aspect_ratio;
+// PixelSampler::blueNoise(), kBLUE_NOISE_SIZE^2 texels
+uniform samplerBuffer blue_noise_tex;
 
-uniform vec4 rand_seed;
+// 3 texels per triangle : (vertex 0, normal.x), (edge 0, normal.y),
+//                         (edge 1, normal.z)
+uniform samplerBuffer tri_tex;
+// 1 texel per triangle : (color, material), read only for the nearest hit
+uniform samplerBuffer mat_tex;
 
-uniform sampler2D tri_tex;
-uniform int num_tri;
+// 2 texels per node : start, end of bounding box
+uniform samplerBuffer bvh_tex;
+// 1 texel per node :
+//   leaf     : (first, end) triangle, brother or -1
+//   internal : (-1, right child), brother or -1 (left child is next node)
+uniform isamplerBuffer bvh_info_tex;
 
-uniform sampler2D bvh_tex;
-uniform isampler1D bvh_info_tex;
-uniform int bvh_size;
+// 1 texel per emitter : alias table of LightSampler,
+//   (triangle, alias triangle, floatBitsToInt(threshold), 0)
+uniform isamplerBuffer light_tex;
 
 uniform bool onlyDraw;
+// accumulator, sum of samples in rgb and their count in a.
 uniform sampler2D d_tex;
-uniform float brightness;
-uniform float gamma;
+// sum of squared samples in rgb and squared luminance in a.
+uniform sampler2D moment_tex;
+// accumulator or denoised image drawn by onlyDraw.
+uniform sampler2D display_tex;
+
+// 1 texel per block : nonzero if converged, then it is not sampled.
+uniform sampler2D mask_tex;
+// draw errors of blocks instead of samples.
+uniform bool estimateError;
+
+// AOVs of first hits, summed as the accumulator.
+// sum of normals facing the camera in xyz and depths in w.
+uniform sampler2D normal_tex;
+// sum of albedos in xyz.
+uniform sampler2D albedo_tex;
+
+// step of an a-trous denoise pass in pixels, 0 for other passes.
+// the first pass (step 1) reads the accumulator, others read denoise_tex.
+uniform int atrous_step;
+// (illumination, variance) of the previous pass.
+uniform sampler2D denoise_tex;
+// the last pass writes (radiance, 1) instead.
+uniform bool atrous_last;
 
 in vec2 position;
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+layout(location = 1) out vec4 MomentColor;
+layout(location = 2) out vec4 NormalColor;
+layout(location = 3) out vec4 AlbedoColor;
 
 struct Intersection {
   vec3 point;
@@ -56,28 +137,91 @@ struct Solid {
   bool light;
 };
 
-struct Seed {
-  vec2 co[2];
+struct Sampler {
+  uint seed;  // of pixel for Sobol, or sampler_seed for blue noise
+  uint pixel_seed;
+  ivec2 pixel;
+  uint index;
+  uint dim;
 };
 
-Seed seed;
+Sampler smp;
 
+uint pcgHash(uint v) {
+  uint state = v * 747796405u + 2891336453u;
+  uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+  return (word >> 22u) ^ word;
+}
+
+uint reverseBits(uint x) {
+  x = ((x >> 1u) & 0x55555555u) | ((x & 0x55555555u) << 1u);
+  x = ((x >> 2u) & 0x33333333u) | ((x & 0x33333333u) << 2u);
+  x = ((x >> 4u) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4u);
+  x = ((x >> 8u) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8u);
+  return (x >> 16u) | (x << 16u);
+}
+
+// nested uniform scramble with the hash of Laine and Karras (Burley 2020).
+uint owenScramble(uint x, uint seed) {
+  x = reverseBits(x);
+  x += seed;
+  x ^= x * 0x6c50b47cu;
+  x ^= x * 0xb82f1e52u;
+  x ^= x * 0xc7afe638u;
+  x ^= x * 0x8d22f6e6u;
+  return reverseBits(x);
+}
+
+uint sobol(uint index, uint dim) {
+  uint x = 0u;
+  for (uint bit = 0u; index != 0u; bit++) {
+    uint i = dim * 32u + bit;
+    if ((index & 1u) != 0u) x ^= sobol_dir[i >> 2u][i & 3u];
+    index >>= 1u;
+  }
+  return x;
+}
+
+float toUnit(uint x) {
+  return float(x >> 8u) * (1.0 / 16777216.0);
+}
+
+void initSampler(ivec2 pixel) {
+  smp.pixel = pixel;
+  smp.pixel_seed = pcgHash(uint(pixel.x) +
+                           pcgHash(uint(pixel.y) + pcgHash(sampler_seed)));
+  smp.seed = sampler_type == 1 ? smp.pixel_seed : sampler_seed;
+}
+
+void startSample(uint index) {
+  smp.index = index;
+  smp.dim = 0u;
+}
+
+// next dimension of the sample, in [0, 1).
 float rand() {
-  vec2 buf;
-  buf.x = fract(sin(dot(seed.co[0] ,vec2(12.9898,78.233))) * 43758.5453);
-  buf.y = fract(sin(dot(seed.co[1] ,vec2(62.4293,29.845))) * 71354.8973);
-  seed.co[1] = seed.co[0];
-  seed.co[0] = buf;
-  return buf.x;
+  uint dim = smp.dim++;
+  if (sampler_type == 0) {
+    return toUnit(pcgHash(smp.pixel_seed ^ pcgHash(smp.index ^ pcgHash(dim))));
+  }
+
+  // dimensions are padded by 4D sets with their own scrambling.
+  uint group_seed = pcgHash(smp.seed ^ pcgHash(dim / kSOBOL_DIM));
+  uint shuffled = owenScramble(smp.index, group_seed);
+  float u = toUnit(owenScramble(sobol(shuffled, dim % kSOBOL_DIM),
+                                pcgHash(group_seed ^ dim)));
+  if (sampler_type == 1) return u;
+
+  uint size = uint(kBLUE_NOISE_SIZE);
+  uint h = pcgHash(dim + sampler_seed);
+  ivec2 p = (smp.pixel + ivec2(h % size, h / size % size)) % kBLUE_NOISE_SIZE;
+  return fract(u + texelFetch(blue_noise_tex, p.y * kBLUE_NOISE_SIZE + p.x).x);
 }
 
 void intersectTriangle(const Ray ray, const int tri_idx, inout Intersection result) {
-  int col_idx = tri_idx % TRI_TEX_COL;
-  int row_idx = tri_idx / TRI_TEX_COL;
-  float per_tex = 1.0 / TRI_TEX_COL;
-  vec3 position0 = texture(tri_tex, vec2(4*col_idx+0, row_idx) * per_tex).xyz;
-  vec3 edge0 = texture(tri_tex, vec2(4*col_idx+1, row_idx) * per_tex).xyz - position0;
-  vec3 edge1 = texture(tri_tex, vec2(4*col_idx+2, row_idx) * per_tex).xyz - position0;
+  vec3 position0 = texelFetch(tri_tex, 3*tri_idx+0).xyz;
+  vec3 edge0 = texelFetch(tri_tex, 3*tri_idx+1).xyz;
+  vec3 edge1 = texelFetch(tri_tex, 3*tri_idx+2).xyz;
 
   /* Möller–Trumbore intersection algorithm */
   vec3 P = cross(ray.dir, edge1);
@@ -93,52 +237,111 @@ void intersectTriangle(const Ray ray, const int tri_idx, inout Intersection resu
   float t = dot(edge1, Q) * inv_det;
 
   if(kZERO < t && result.t > t){ // Hit
-    result.point = ray.org + ray.dir * t;
     result.t = t;
-    vec4 data = texture(tri_tex, vec2(4*col_idx+3, row_idx) * per_tex);
-    result.col = data.xyz;
-    result.normal = normalize(cross(edge0, edge1));
     result.pol_id = tri_idx;
-    if (dot(result.normal, ray.dir) > 0) {
-      result.normal = -result.normal;
-    }
-    result.material = int(data.w);
   }
 }
 
-bool intersectBoundingBox(const Ray ray, const int bb_idx) {
-  int col_idx = bb_idx % TRI_TEX_COL;
-  int row_idx = bb_idx / TRI_TEX_COL;
-  float per_tex = 1.0 / TRI_TEX_COL;
-  
-  vec3 start = texture(bvh_tex, vec2(2*col_idx+0, row_idx) * per_tex).xyz;
-  vec3 end = texture(bvh_tex, vec2(2*col_idx+1, row_idx) * per_tex).xyz;
- 
-  float t_far = kINF, t_near = -kINF;
-  for(int i = 0; i < 3; i++){
-    float t1 = (start[i] - ray.org[i]) / ray.dir[i];
-    float t2 = (end[i] - ray.org[i]) / ray.dir[i];
-    if(t1 < t2){
-      t_far = min(t_far, t2);
-      t_near = max(t_near, t1);
-    }else{
-      t_far = min(t_far, t1);
-      t_near = max(t_near, t2);
+// fill the shading data of the nearest hit found by intersectTriangle.
+void completeIntersection(const Ray ray, inout Intersection result) {
+  if (result.t == kINF) return;
+  int tri_idx = result.pol_id;
+  result.point = ray.org + ray.dir * result.t;
+  result.normal = vec3(texelFetch(tri_tex, 3*tri_idx+0).w,
+                       texelFetch(tri_tex, 3*tri_idx+1).w,
+                       texelFetch(tri_tex, 3*tri_idx+2).w);
+  if (dot(result.normal, ray.dir) > 0) {
+    result.normal = -result.normal;
+  }
+  vec4 data = texelFetch(mat_tex, tri_idx);
+  result.col = data.xyz;
+  result.material = int(data.w);
+}
+
+// distance to the box, or kINF if it is missed or farther than t_max.
+float intersectBoundingBox(const Ray ray, const vec3 inv_dir, const int bb_idx,
+                           const float t_max) {
+  vec3 start = texelFetch(bvh_tex, 2*bb_idx+0).xyz;
+  vec3 end = texelFetch(bvh_tex, 2*bb_idx+1).xyz;
+
+  vec3 t1 = (start - ray.org) * inv_dir;
+  vec3 t2 = (end - ray.org) * inv_dir;
+  vec3 t_min = min(t1, t2);
+  vec3 t_max3 = max(t1, t2);
+  float t_near = max(max(t_min.x, t_min.y), t_min.z);
+  float t_far = min(min(min(t_max3.x, t_max3.y), t_max3.z), t_max);
+  if (t_far < t_near || t_far <= 0) return float(kINF);
+  return t_near;
+}
+
+// nearer child first with a short stack, boxes behind the hit are skipped.
+// hits farther than t_max are ignored.
+Intersection intersectBVHOrdered(const Ray ray, const float t_max) {
+  Intersection isect;
+  isect.t = t_max;
+  vec3 inv_dir = 1.0 / ray.dir;
+
+  int stack_node[kSTACK_SIZE];
+  float stack_t[kSTACK_SIZE];
+  int sp = 0;
+
+  int node_idx = 0;
+  if (intersectBoundingBox(ray, inv_dir, 0, isect.t) == kINF) return isect;
+  while(true) {
+    ivec2 info = texelFetch(bvh_info_tex, node_idx).xy;
+
+    if (info.x != -1) {
+      for(int tri_idx = info.x; tri_idx < info.y; tri_idx++){
+        intersectTriangle(ray, tri_idx, isect);
+      }
+    } else {
+      int left = node_idx + 1;
+      int right = info.y;
+      float t_left = intersectBoundingBox(ray, inv_dir, left, isect.t);
+      float t_right = intersectBoundingBox(ray, inv_dir, right, isect.t);
+      if (t_left != kINF && t_right != kINF) {
+        if (t_left <= t_right) {
+          stack_node[sp] = right;
+          stack_t[sp] = t_right;
+          node_idx = left;
+        } else {
+          stack_node[sp] = left;
+          stack_t[sp] = t_left;
+          node_idx = right;
+        }
+        sp++;
+        continue;
+      }
+      if (t_left != kINF) {
+        node_idx = left;
+        continue;
+      }
+      if (t_right != kINF) {
+        node_idx = right;
+        continue;
+      }
     }
-    if(t_far < t_near) return false;
+
+    // pop the nearest pushed node which is still nearer than the hit.
+    while (sp > 0 && stack_t[sp - 1] >= isect.t) sp--;
+    if (sp == 0) break;
+    sp--;
+    node_idx = stack_node[sp];
   }
-  return t_far > 0;
+  return isect;
 }
 
-Intersection intersectBVH(const Ray ray) {
+// stackless traversal in depth first order with brother links.
+Intersection intersectBVHStackless(const Ray ray, const float t_max) {
   Intersection isect;
-  isect.t = kINF;
+  isect.t = t_max;
+  vec3 inv_dir = 1.0 / ray.dir;
  
   int node_idx = 0;
   while(true) {
-    ivec3 info = texture(bvh_info_tex, float(node_idx) / TRI_TEX_COL).xyz;
+    ivec3 info = texelFetch(bvh_info_tex, node_idx).xyz;
     
-    if (intersectBoundingBox(ray, node_idx)) {
+    if (intersectBoundingBox(ray, inv_dir, node_idx, isect.t) != kINF) {
       if (info.x != -1) {
         for(int tri_idx = info.x; tri_idx < info.y; tri_idx++){
           intersectTriangle(ray, tri_idx, isect);
@@ -157,15 +360,24 @@ Intersection intersectBVH(const Ray ray) {
   return isect;
 }
 
-Intersection intersect(const Ray ray) {
-  Intersection isect;
-  isect.t = kINF;
-  for (int i = 0; i < num_tri; i++) {
-    intersectTriangle(ray, i, isect);
-  }
+#ifdef BVH_STACKLESS
+#define intersectBVHNearest intersectBVHStackless
+#else
+#define intersectBVHNearest intersectBVHOrdered
+#endif
+
+Intersection intersectBVH(const Ray ray) {
+  Intersection isect = intersectBVHNearest(ray, kINF);
+  completeIntersection(ray, isect);
   return isect;
 }
 
+// true if something is hit nearer than t_max.
+bool occluded(const Ray ray, const float t_max) {
+  Intersection isect = intersectBVHNearest(ray, t_max);
+  return isect.t < t_max;
+}
+
 Ray decideRay(const vec3 normal, const vec3 point, const vec3 color, inout float pdf) {
   Ray ray;
 
@@ -186,97 +398,258 @@ Ray decideRay(const vec3 normal, const vec3 point, const vec3 color, inout float
   return ray;
 }
 
-/*
-vec3 toLight(const vec3 point, inout float pdf) {
-  vec3 color = vec3(0);
-//  int light_sam = int(num_tri + floor(rand() * num_light));
-  float per_tex = 1.0 / TRI_TEX_COL;
-  for (int light_sam = 0; light_sam < num_light; light_sam++) {
-    int col_idx = light_sam % TRI_TEX_COL;
-    int row_idx = light_sam / TRI_TEX_COL;
-
-    float u = rand();
-    float v = rand();
-    
-    if (u + v > 1) {
-      u = 1 - u;
-      v = 1 - v;
-    }
+float powerHeuristic(const float pdf_a, const float pdf_b) {
+  return pdf_a * pdf_a / (pdf_a * pdf_a + pdf_b * pdf_b);
+}
 
-    vec3 position0 = texture(tri_tex, vec2(4*col_idx+0, row_idx) * per_tex).xyz * mag;
-    vec3 edge0 = texture(tri_tex, vec2(4*col_idx+1, row_idx) * per_tex).xyz * mag - position0;
-    vec3 edge1 = texture(tri_tex, vec2(4*col_idx+2, row_idx) * per_tex).xyz * mag - position0;
-    vec3 pos = edge0 * u + edge1 * v + position0;
+// LightSampler::power
+float lightPower(const vec3 col) {
+  return max(0.0, dot(col, vec3(0.2126, 0.7152, 0.0722)));
+}
 
-    Ray to_l = Ray(point, normalize(pos - point), vec3(1));
+// pdf per solid angle that sampleLight chooses the emitter hit by ray.
+float lightPdf(const Ray ray, const Intersection isect) {
+  float cos_l = abs(dot(isect.normal, ray.dir));
+  if (num_light == 0 || cos_l <= 0.0) return 0.0;
+  return lightPower(isect.col) / light_power * isect.t * isect.t / cos_l;
+}
 
-    Intersection isect = intersect(to_l);
-    if (isect.pol_id == light_sam){
-      color += isect.col * -dot(isect.normal, to_l.dir);
-      pdf *= length(pos - point) * kPI;
-    }
+// next event estimation : radiance from a point on an emitter chosen by the
+// alias table, weighted against decideRay by the power heuristic.
+// as decideRay divides by kPI, the BRDF is col / kPI^2.
+vec3 sampleLight(const Intersection isect) {
+  int k = min(int(rand() * num_light), num_light - 1);
+  ivec4 entry = texelFetch(light_tex, k);
+  int tri_idx = rand() < intBitsToFloat(entry.z) ? entry.x : entry.y;
+
+  vec4 data0 = texelFetch(tri_tex, 3*tri_idx+0);
+  vec4 data1 = texelFetch(tri_tex, 3*tri_idx+1);
+  vec4 data2 = texelFetch(tri_tex, 3*tri_idx+2);
+  float su = sqrt(rand());
+  float v = rand();
+  vec3 pos = data0.xyz + data1.xyz * (su * (1.0 - v)) + data2.xyz * (su * v);
+  vec3 normal = vec3(data0.w, data1.w, data2.w);
+
+  vec3 to_light = pos - isect.point;
+  float dist2 = dot(to_light, to_light);
+  float dist = sqrt(dist2);
+  vec3 dir = to_light / dist;
+  float cos_x = dot(isect.normal, dir);
+  float cos_l = abs(dot(normal, dir));
+  if (cos_x <= 0.0 || cos_l <= 0.0) return vec3(0);
+  // the emitter itself is at dist.
+  if (occluded(Ray(isect.point, dir, vec3(1)), dist * (1.0 - 1e-3))) {
+    return vec3(0);
   }
 
-  return color / num_light;
+  vec3 col = texelFetch(mat_tex, tri_idx).xyz;
+  float pdf_light = lightPower(col) / light_power * dist2 / cos_l;
+  float pdf_bsdf = cos_x / kPI;
+  return col * cos_x / (kPI * kPI * pdf_light) *
+         powerHeuristic(pdf_light, pdf_bsdf);
 }
-*/
 
-vec3 renderRay(Ray ray, out float pdf) {
-  pdf = 1.f;
+// radiance along ray divided by its pdf.
+// first is the nearest hit of the camera ray, t is kINF if missed.
+vec3 renderRay(Ray ray, out Intersection first) {
+  float pdf = 1.f;
   ray.col = vec3(1);
+  vec3 radiance = vec3(0);
+  // pdf per solid angle of decideRay which made ray.
+  float pdf_bsdf = 0.0;
   int n = 1;
   while(true) {
     Intersection result = intersectBVH(ray);
+    if (n == 1) first = result;
     if (result.t == kINF) {
-      return vec3(0, 0, 0);
+      return radiance;
     }
+#ifdef HAS_LIGHT
     else if (result.material == 0) {  // material == Light
-      ray.col *= result.col;
-      return ray.col;
+#ifdef USE_NEE
+      // camera rays are not sampled by sampleLight.
+      float weight =
+          n == 1 ? 1.0 : powerHeuristic(pdf_bsdf, lightPdf(ray, result));
+#else
+      float weight = 1.0;
+#endif
+      return radiance + ray.col * result.col * weight / pdf;
     }
+#endif
+#ifdef HAS_DIR_LIGHT
     else if (result.material == 1) {  // material == DirLight
-      ray.col *= result.col * -dot(result.normal, ray.dir);
-      return ray.col;
+      return radiance +
+             ray.col * result.col * -dot(result.normal, ray.dir) / pdf;
     }
-    if (n > 5 || rand() > pow(0.6, n-1)) {
-      return vec3(0);
+#endif
+    if (n > kMAX_DEPTH || rand() > pow(kROULETTE, n-1)) {
+      return radiance;
     }
-    pdf *= pow(0.6, n - 1);
+    pdf *= pow(kROULETTE, n - 1);
  
     ray.col *= result.col;
+#ifdef USE_NEE
+    radiance += ray.col * sampleLight(result) / pdf;
+#endif
     ray = decideRay(result.normal, result.point, ray.col, pdf);
+    pdf_bsdf = dot(result.normal, ray.dir) / kPI;
 
     n += 1;
   }
 }
 
+float luminance(const vec3 col) {
+  return max(0.0, dot(col, vec3(0.2126, 0.7152, 0.0722)));
+}
+
+// relative standard error of the mean luminance of a pixel, measured in
+// displayed brightness. dark pixels are relative to 1% of white.
+float pixelError(const vec4 acc, const float moment) {
+  float n = acc.w;
+  if (n < 2.0) return float(kINF);
+  float mean = brightness * luminance(acc.xyz) / n;
+  float var = max(0.0, brightness * brightness * moment / n - mean * mean);
+  return sqrt(var / (n - 1.0)) / (mean + 0.01);
+}
+
+// (max error, sum of errors, pixels, min samples) of a block.
+vec4 blockError(const ivec2 block) {
+  ivec2 size = textureSize(d_tex, 0);
+  ivec2 start = block * kBLOCK_SIZE;
+  ivec2 end = min(start + kBLOCK_SIZE, size);
+  vec4 err = vec4(0, 0, 0, kINF);
+  for (int y = start.y; y < end.y; y++) {
+    for (int x = start.x; x < end.x; x++) {
+      vec4 acc = texelFetch(d_tex, ivec2(x, y), 0);
+      float e = pixelError(acc, texelFetch(moment_tex, ivec2(x, y), 0).w);
+      err = vec4(max(err.x, e), err.y + e, err.z + 1.0, min(err.w, acc.w));
+    }
+  }
+  return err;
+}
+
+// demodulation by albedo keeps textures out of the filter.
+#define kALBEDO_EPS 0.001
+// edge stopping of normal (power of cosine), depth (relative per pixel) and
+// luminance (standard deviations), after Dammertz et al. and SVGF.
+#define kSIGMA_N 128.0
+#define kSIGMA_Z 0.05
+#define kSIGMA_L 4.0
+
+struct Guide {
+  vec3 normal;
+  float depth;
+  vec3 albedo;
+};
+
+Guide fetchGuide(const ivec2 p) {
+  float n = max(texelFetch(d_tex, p, 0).w, 1.0);
+  vec4 nz = texelFetch(normal_tex, p, 0) / n;
+  float len = length(nz.xyz);
+  return Guide(len > 0.0 ? nz.xyz / len : vec3(0), nz.w,
+               max(texelFetch(albedo_tex, p, 0).xyz / n, vec3(kALBEDO_EPS)));
+}
+
+// illumination and variance of its luminance.
+vec4 fetchIllumination(const ivec2 p, const Guide g) {
+  if (atrous_step != 1) return texelFetch(denoise_tex, p, 0);
+  vec4 acc = texelFetch(d_tex, p, 0);
+  float n = max(acc.w, 1.0);
+  float l = luminance(acc.xyz) / n;
+  float var = max(0.0, texelFetch(moment_tex, p, 0).w / n - l * l) /
+              max(n - 1.0, 1.0);
+  float a = luminance(g.albedo);
+  return vec4(acc.xyz / n / g.albedo, var / max(a * a, kALBEDO_EPS));
+}
+
+// a pass of 5x5 B3 spline kernel dilated by atrous_step.
+vec4 atrous(const ivec2 p) {
+  const float kernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+  ivec2 size = textureSize(d_tex, 0);
+  Guide gp = fetchGuide(p);
+  vec4 cp = fetchIllumination(p, gp);
+  float lp = luminance(cp.xyz);
+  float sigma_l = kSIGMA_L * sqrt(cp.w) + 1e-10;
+
+  vec3 sum = vec3(0);
+  float var = 0.0;
+  float w_sum = 0.0;
+  for (int dy = -2; dy <= 2; dy++) {
+    for (int dx = -2; dx <= 2; dx++) {
+      ivec2 offset = ivec2(dx, dy) * atrous_step;
+      ivec2 q = p + offset;
+      if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size))) {
+        continue;
+      }
+      Guide gq = fetchGuide(q);
+      vec4 cq = fetchIllumination(q, gq);
+      float w_n = pow(max(0.0, dot(gp.normal, gq.normal)), kSIGMA_N);
+      float w_z = exp(-abs(gp.depth - gq.depth) /
+                      (kSIGMA_Z * gp.depth * length(vec2(offset)) + 1e-4));
+      float w_l = exp(-abs(lp - luminance(cq.xyz)) / sigma_l);
+      float w = kernel[abs(dx)] * kernel[abs(dy)] *
+                (dx == 0 && dy == 0 ? 1.0 : w_n * w_z * w_l);
+      sum += w * cq.xyz;
+      var += w * w * cq.w;
+      w_sum += w;
+    }
+  }
+  vec3 illumination = sum / w_sum;
+  if (atrous_last) return vec4(illumination * gp.albedo, 1);
+  return vec4(illumination, var / (w_sum * w_sum));
+}
+
 void main() {
+  if (atrous_step > 0) {
+    FragColor = atrous(ivec2(gl_FragCoord.xy));
+    return;
+  }
+  if (estimateError) {
+    FragColor = blockError(ivec2(gl_FragCoord.xy));
+    return;
+  }
   if (onlyDraw) {
-    vec4 col = texture(d_tex, position);
-    col = clamp(brightness * col / num_sample, vec4(0), vec4(1));
-    FragColor = vec4(pow(col.xyz, vec3(gamma)), 1);
+    vec4 acc = texture(display_tex, position);
+    vec3 col = clamp(brightness * acc.xyz / max(acc.w, 1.0), vec3(0), vec3(1));
+    FragColor = vec4(pow(col, vec3(gamma)), 1);
     return;
   }
  
   vec3 c_x = normalize(cross(camera_dir, vec3(0, 0, 1)));
   vec3 c_y = normalize(cross(camera_dir, c_x));
 
-  seed.co[0] = rand_seed.xy * fract(sin(position.xy) * 1000);
-  seed.co[1] = rand_seed.zw * fract(cos(position.yx) * 1000);
+  // converged blocks are skipped by whole warps.
+  if (texelFetch(mask_tex, ivec2(gl_FragCoord.xy) / kBLOCK_SIZE, 0).r > 0.5) {
+    discard;
+  }
+
+  initSampler(ivec2(gl_FragCoord.xy));
 
   vec3 color = vec3(0);
+  vec4 moment = vec4(0);
+  vec4 normal = vec4(0);
+  vec3 albedo = vec3(0);
   for (int i = 0; i < num_sample; i++) {
+    startSample(sample_index + uint(i));
     vec3 ray_d = normalize(c_x * (position.x - 0.5 + rand() / screen_size.x) * aspect_ratio +
                            c_y * (position.y - 0.5 + rand() / screen_size.y) +
                            camera_dir);
     Ray ray = Ray(camera_pos, ray_d, vec3(1));
 
-    float pdf;
-    vec3 col = renderRay(ray, pdf);
-    color += col / pdf;
+    Intersection first;
+    vec3 c = renderRay(ray, first);
+    float l = luminance(c);
+    color += c;
+    moment += vec4(c * c, l * l);
+    if (first.t < kINF) {
+      normal += vec4(faceforward(first.normal, ray_d, first.normal), first.t);
+      albedo += first.col;
+    }
   }
-  color /= num_sample;
-  
-  FragColor = vec4(texture(d_tex, position).xyz + color, 1);
+
+  FragColor = vec4(color, float(num_sample));
+  MomentColor = moment;
+  NormalColor = normal;
+  AlbedoColor = vec4(albedo, 0);
 }
 )"
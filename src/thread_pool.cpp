@@ -0,0 +1,68 @@
+//
+//  thread_pool.cpp
+//  NewGlslRenderer
+//
+
+#include "thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(const int& n_threads) {
+  const int n = n_threads > 0
+                    ? n_threads
+                    : std::max(1, int(std::thread::hardware_concurrency()));
+  // the caller of TaskGroup::wait works as the last thread.
+  for (int i = 1; i < n; i++) {
+    workers.emplace_back([this]() {
+      std::function<void()> task;
+      while (popTask(&task)) {
+        task();
+      }
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stop = true;
+  }
+  cond.notify_all();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
+void ThreadPool::push(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    tasks.emplace_back(std::move(task));
+  }
+  cond.notify_one();
+}
+
+bool ThreadPool::runPendingTask() {
+  std::function<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (tasks.empty()) return false;
+    task = std::move(tasks.front());
+    tasks.pop_front();
+  }
+  task();
+  return true;
+}
+
+ThreadPool& ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+bool ThreadPool::popTask(std::function<void()>* task) {
+  std::unique_lock<std::mutex> lock(mtx);
+  cond.wait(lock, [this]() { return stop || !tasks.empty(); });
+  if (tasks.empty()) return false;
+  *task = std::move(tasks.front());
+  tasks.pop_front();
+  return true;
+}
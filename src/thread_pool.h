@@ -0,0 +1,107 @@
+//
+//  thread_pool.h
+//  NewGlslRenderer
+//
+
+#ifndef thread_pool_h20261017
+#define thread_pool_h20261017
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Fixed number of worker threads which run pushed tasks in FIFO order. **/
+class ThreadPool {
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> tasks;
+  std::mutex mtx;
+  std::condition_variable cond;
+  bool stop = false;
+
+public:
+  // if n_threads is 0, use all hardware threads.
+  explicit ThreadPool(const int& n_threads = 0);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // number of threads including the caller which helps in TaskGroup::wait.
+  int size() const { return int(workers.size()) + 1; }
+
+  void push(std::function<void()> task);
+
+  // run one pending task on the calling thread. false if there is none.
+  bool runPendingTask();
+
+  // pool shared in this process.
+  static ThreadPool& shared();
+
+private:
+  bool popTask(std::function<void()>* task);
+};
+
+/**
+ Set of tasks which can be waited together.
+ wait() runs pending tasks of the pool while waiting, so tasks can spawn and
+ wait sub tasks without blocking workers.
+ **/
+class TaskGroup {
+private:
+  ThreadPool& pool;
+  std::atomic<int> pending;
+
+public:
+  explicit TaskGroup(ThreadPool& pool_ = ThreadPool::shared())
+      : pool(pool_), pending(0) {}
+  ~TaskGroup() { wait(); }
+
+  template <class Func>
+  void run(Func func) {
+    pending++;
+    pool.push([this, func]() {
+      func();
+      pending--;
+    });
+  }
+
+  bool isRunning() const { return pending > 0; }
+
+  void wait() {
+    while (pending > 0) {
+      if (!pool.runPendingTask()) {
+        std::this_thread::yield();
+      }
+    }
+  }
+};
+
+/**
+ Call func(chunk_begin, chunk_end, chunk_idx) for n_chunk (>= 1) chunks of
+ [begin, end) in parallel. func is not called for an empty range or 0
+ chunks.
+ Chunks are split by index, so results which are merged in chunk order are
+ deterministic.
+ **/
+template <class Func>
+void parallelFor(const size_t& begin, const size_t& end,
+                 const size_t& n_chunk, Func func,
+                 ThreadPool& pool = ThreadPool::shared()) {
+  if (n_chunk == 0 || begin >= end) return;
+  const size_t len = end - begin;
+  TaskGroup group(pool);
+  for (size_t c = 1; c < n_chunk; c++) {
+    group.run([=]() {
+      func(begin + len * c / n_chunk, begin + len * (c + 1) / n_chunk, c);
+    });
+  }
+  func(begin, begin + len / n_chunk, size_t(0));
+  group.wait();
+}
+
+#endif /* thread_pool_h20261017 */
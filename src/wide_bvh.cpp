@@ -0,0 +1,150 @@
+//
+//  wide_bvh.cpp
+//  NewGlslRenderer
+//
+
+#include "wide_bvh.h"
+
+#include <algorithm>
+
+#include "logger.h"
+
+namespace {
+
+real surfaceArea(const BVH::Node& a) {
+  const Vec l = a.end - a.start;
+  return 2 * (l[0] * l[1] + l[1] * l[2] + l[2] * l[0]);
+}
+
+template <int N>
+class Collapser {
+  using Wide = WideBVH<N>;
+
+  const BVH& bvh;
+  Wide* wide;
+
+public:
+  Collapser(const BVH& bvh_, Wide* wide_) : bvh(bvh_), wide(wide_) {}
+
+  void build() {
+    const BVH::Node& root = bvh.nodes[0];
+    if (root.leaf) {
+      const size_t idx = newNode(1);
+      setChild(idx, 0, root.start, root.end,
+               leafRef(root.s_idx, root.e_idx, 2));
+    } else {
+      buildNode(0, 1);
+    }
+  }
+
+private:
+  size_t newNode(const size_t& depth) {
+    typename Wide::Node node;
+    for (int k = 0; k < N; k++) {
+      for (int c = 0; c < 3; c++) {
+        node.start[c][k] = 0.f;
+        node.end[c][k] = 0.f;
+      }
+      node.child[k] = Wide::kEMPTY;
+    }
+    wide->nodes.emplace_back(node);
+    wide->depth = std::max(wide->depth, depth);
+    return wide->nodes.size() - 1;
+  }
+
+  void setChild(const size_t& idx, const int& k, const Vec& start,
+                const Vec& end, const uint32_t& ref) {
+    typename Wide::Node& node = wide->nodes[idx];
+    for (int c = 0; c < 3; c++) {
+      node.start[c][k] = start[c];
+      node.end[c][k] = end[c];
+    }
+    node.child[k] = ref;
+  }
+
+  // leaf with more than kMAX_LEAF_COUNT polygons is split into a node.
+  uint32_t leafRef(const size_t& s_idx, const size_t& e_idx,
+                   const size_t& depth) {
+    const size_t count = e_idx - s_idx;
+    if (count <= Wide::kMAX_LEAF_COUNT) {
+      return Wide::kLEAF | uint32_t(count << 27) | uint32_t(s_idx);
+    }
+
+    const size_t idx = newNode(depth);
+    for (int k = 0; k < N; k++) {
+      const size_t s = s_idx + count * size_t(k) / N;
+      const size_t e = s_idx + count * size_t(k + 1) / N;
+      if (s == e) continue;
+      Vec start(kINF), end(-kINF);
+      for (size_t i = s; i < e; i++) {
+        for (auto& vert : bvh.polygons[i].vert) {
+          start = min(start, vert);
+          end = max(end, vert);
+        }
+      }
+      setChild(idx, k, start, end, leafRef(s, e, depth + 1));
+    }
+    return uint32_t(idx);
+  }
+
+  // collapse children of internal node bin_idx until N nodes, opening the
+  // largest internal child first.
+  uint32_t buildNode(const size_t& bin_idx, const size_t& depth) {
+    const size_t idx = newNode(depth);
+
+    std::vector<size_t> children{bin_idx + 1, bvh.nodes[bin_idx + 1].brother};
+    while (children.size() < size_t(N)) {
+      int open = -1;
+      real max_area = -1;
+      for (size_t k = 0; k < children.size(); k++) {
+        const BVH::Node& child = bvh.nodes[children[k]];
+        if (!child.leaf && surfaceArea(child) > max_area) {
+          max_area = surfaceArea(child);
+          open = int(k);
+        }
+      }
+      if (open == -1) break;
+      const size_t c = children[size_t(open)];
+      children[size_t(open)] = c + 1;
+      children.emplace_back(bvh.nodes[c + 1].brother);
+    }
+
+    for (size_t k = 0; k < children.size(); k++) {
+      const BVH::Node& child = bvh.nodes[children[k]];
+      const uint32_t ref = child.leaf
+                               ? leafRef(child.s_idx, child.e_idx, depth + 1)
+                               : buildNode(children[k], depth + 1);
+      setChild(idx, int(k), child.start, child.end, ref);
+    }
+    return uint32_t(idx);
+  }
+};
+
+}  // namespace
+
+template <int N>
+constexpr uint32_t WideBVH<N>::kEMPTY;
+template <int N>
+constexpr uint32_t WideBVH<N>::kLEAF;
+template <int N>
+constexpr uint32_t WideBVH<N>::kMAX_LEAF_COUNT;
+template <int N>
+constexpr uint32_t WideBVH<N>::kMAX_POLYGON;
+
+template <int N>
+bool WideBVH<N>::init(const BVH& bvh) {
+  nodes.clear();
+  depth = 0;
+  if (bvh.nodes.empty() || bvh.polygons.size() >= kMAX_POLYGON) {
+    return false;
+  }
+
+  nodes.reserve(bvh.nodes.size() / (N - 1) + 1);
+  Collapser<N>(bvh, this).build();
+
+  DEBUG_LOG("WideBVH", N, " size is ", nodes.size(), ", depth is ", depth);
+  return true;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,90 @@
+//
+//  wide_bvh.h
+//  NewGlslRenderer
+//
+
+#ifndef wide_bvh_h20261017
+#define wide_bvh_h20261017
+
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include "common.h"
+
+/** std::allocator which aligns elements to Align bytes. **/
+template <class T, size_t Align>
+struct AlignedAllocator {
+  using value_type = T;
+  template <class U>
+  struct rebind {
+    using other = AlignedAllocator<U, Align>;
+  };
+
+  AlignedAllocator() = default;
+  template <class U>
+  AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+  T* allocate(const size_t& n) {
+    void* p = nullptr;
+    if (posix_memalign(&p, Align, n * sizeof(T)) != 0) throw std::bad_alloc();
+    return static_cast<T*>(p);
+  }
+  void deallocate(T* p, const size_t&) { std::free(p); }
+
+  template <class U>
+  bool operator==(const AlignedAllocator<U, Align>&) const {
+    return true;
+  }
+  template <class U>
+  bool operator!=(const AlignedAllocator<U, Align>&) const {
+    return false;
+  }
+};
+
+/**
+ BVH with N (4 or 8) children per node, collapsed from a binary BVH for
+ traversal on CPU. Child bounds are stored in SoA layout so that one SIMD
+ instruction tests all children, and nodes are aligned to cache lines.
+
+ Child reference is 32 bit:
+   internal : index of the child node (MSB is 0)
+   leaf     : 1 | count (4 bit) | index of the first polygon (27 bit)
+   empty    : kEMPTY
+ **/
+template <int N>
+class WideBVH {
+  static_assert(N == 4 || N == 8, "WideBVH supports 4 or 8 children");
+
+public:
+  // padded to whole cache lines, 128 bytes for N = 4 and 256 for N = 8.
+  struct alignas(64) Node {
+    float start[3][N];
+    float end[3][N];
+    uint32_t child[N];
+  };
+  static_assert(sizeof(Node) % 64 == 0, "nodes don't cross cache lines");
+
+  static constexpr uint32_t kEMPTY = 0xFFFFFFFFu;
+  static constexpr uint32_t kLEAF = 0x80000000u;
+  static constexpr uint32_t kMAX_LEAF_COUNT = 15;
+  static constexpr uint32_t kMAX_POLYGON = 1u << 27;
+
+  std::vector<Node, AlignedAllocator<Node, 64>> nodes;
+  size_t depth = 0;  // max depth of nodes, root is 1
+
+public:
+  // collapse bvh. it fails if bvh has too many polygons to encode.
+  bool init(const BVH& bvh);
+
+  static bool isLeaf(const uint32_t& child) { return (child & kLEAF) != 0; }
+  static uint32_t leafCount(const uint32_t& child) {
+    return (child >> 27) & 0xF;
+  }
+  static uint32_t leafStart(const uint32_t& child) {
+    return child & (kMAX_POLYGON - 1);
+  }
+};
+
+#endif /* wide_bvh_h20261017 */